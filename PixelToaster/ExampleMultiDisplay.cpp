@@ -64,6 +64,10 @@ int main()
             }
         }
 
+		// the displays share a connection to the window system, send all three updates at once
+
+		beginUpdates();
+
 		if ( a.open() )
 			a.update( pixels );
 
@@ -72,5 +76,7 @@ int main()
 
 		if ( c.open() )
 			c.update( pixels );
+
+		endUpdates();
 	}
 }
@@ -12,6 +12,11 @@
 #include "PixelToasterCommon.h"
 #include "PixelToasterConversion.h"
 
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
 
 #if PIXELTOASTER_PLATFORM == PIXELTOASTER_UNIX
 	#include "PixelToasterUnix.h"
@@ -37,13 +42,34 @@
 #endif
 
 
+#if !defined( PIXELTOASTER_NO_CRT ) && PIXELTOASTER_PLATFORM != PIXELTOASTER_WINDOWS
+	#include <stdlib.h>
+	#include <sys/mman.h>
+#endif
+
+
 #if !defined( DisplayClass ) || !defined( TimerClass )
 	#error unknown pixeltoaster platform!
 #endif
 
+#ifndef PIXELTOASTER_NO_CRT
+	#include "PixelToasterOffscreen.h"
+#endif
+
 
 PixelToaster::DisplayInterface * PixelToaster::createDisplay()
 {
+	return createDisplay( Output::Default );
+}
+
+PixelToaster::DisplayInterface * PixelToaster::createDisplay( PixelToaster::Output output )
+{
+#ifndef PIXELTOASTER_NO_CRT
+	const char * offscreen = getenv( "PIXELTOASTER_OFFSCREEN" );
+	if ( output == Output::Offscreen || ( offscreen && *offscreen ) )
+		return new OffscreenDisplay();
+#endif
+
 #ifdef DisplayClass
     return new DisplayClass();
 #else
@@ -61,6 +87,128 @@ PixelToaster::TimerInterface * PixelToaster::createTimer()
 }
 
 
+// the cache line in front of every block of pixels says how to give it back
+
+namespace
+{
+	struct PixelBlock
+	{
+		void * base;		// start of the allocation
+		size_t mapped;		// length of the mapping, zero when the block came from the heap
+	};
+
+	const size_t pixelAlignment = 64;
+	const size_t hugePageSize = 2 * 1024 * 1024;
+}
+
+void * PixelToaster::allocatePixels( size_t bytes )
+{
+	void * base = NULL;
+	size_t mapped = 0;
+	char * pixels = NULL;
+
+#if PIXELTOASTER_PLATFORM == PIXELTOASTER_WINDOWS
+
+	// whole pages, which needs no crt. large pages need a privilege that applications don't normally have
+	base = VirtualAlloc( NULL, bytes + pixelAlignment, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+	if ( base )
+		pixels = (char*) base + pixelAlignment;
+
+#elif !defined( PIXELTOASTER_NO_CRT )
+
+	#ifdef MAP_ANONYMOUS
+	if ( bytes >= hugePageSize )
+	{
+		// the pixels start on a huge page boundary and fill as few huge pages as they can, the bookkeeping goes
+		// on an ordinary page in front of them. the address space is reserved first, with room to move the
+		// pixels up to the boundary, and only the pages used are backed
+		const size_t length = ( bytes + hugePageSize - 1 ) & ~( hugePageSize - 1 );
+		const size_t reserved = length + hugePageSize + pixelAlignment;
+		void * reservation = mmap( NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+		if ( reservation != MAP_FAILED )
+		{
+			char * start = (char*) ( ( (size_t) reservation + pixelAlignment + hugePageSize - 1 ) & ~( hugePageSize - 1 ) );
+			const size_t pageSize = (size_t) sysconf( _SC_PAGESIZE );
+			bool backed = false;
+		#ifdef MAP_HUGETLB
+			// reserved huge pages first
+			backed = mmap( start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0 ) != MAP_FAILED;
+		#endif
+			if ( !backed )
+			{
+				// then transparent ones. a failed huge page mapping may have taken the reservation with it, so map over it again
+				backed = mmap( start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0 ) != MAP_FAILED;
+			#ifdef MADV_HUGEPAGE
+				if ( backed )
+					madvise( start, length, MADV_HUGEPAGE );
+			#endif
+			}
+			if ( backed && mprotect( start - pageSize, pageSize, PROT_READ | PROT_WRITE ) == 0 )
+			{
+				base = reservation;
+				mapped = reserved;
+				pixels = start;
+			}
+			else
+				munmap( reservation, reserved );
+		}
+	}
+	#endif
+
+	if ( !pixels )
+	{
+		if ( posix_memalign( &base, pixelAlignment, bytes + pixelAlignment ) != 0 )
+			return NULL;
+		pixels = (char*) base + pixelAlignment;
+	}
+
+#endif
+
+	if ( !pixels )
+		return NULL;
+
+	PixelBlock * block = (PixelBlock*) ( pixels - pixelAlignment );
+	block->base = base;
+	block->mapped = mapped;
+	return pixels;
+}
+
+void PixelToaster::freePixels( void * pixels )
+{
+	if ( !pixels )
+		return;
+
+	const PixelBlock block = *(const PixelBlock*) ( (char*) pixels - pixelAlignment );
+
+#if PIXELTOASTER_PLATFORM == PIXELTOASTER_WINDOWS
+	VirtualFree( block.base, 0, MEM_RELEASE );
+#elif !defined( PIXELTOASTER_NO_CRT )
+	#ifdef MAP_ANONYMOUS
+	if ( block.mapped )
+	{
+		munmap( block.base, block.mapped );
+		return;
+	}
+	#endif
+	free( block.base );
+#endif
+}
+
+void PixelToaster::beginUpdates()
+{
+#if PIXELTOASTER_PLATFORM == PIXELTOASTER_UNIX
+	UnixConnection::beginUpdates();
+#endif
+}
+
+void PixelToaster::endUpdates()
+{
+#if PIXELTOASTER_PLATFORM == PIXELTOASTER_UNIX
+	UnixConnection::endUpdates();
+#endif
+}
+
+
 PixelToaster::Converter_XBGRFFFF_to_XBGRFFFF 	converter_XBGRFFFF_to_XBGRFFFF;
 PixelToaster::Converter_XBGRFFFF_to_XRGB8888 	converter_XBGRFFFF_to_XRGB8888;
 PixelToaster::Converter_XBGRFFFF_to_XBGR8888 	converter_XBGRFFFF_to_XBGR8888;
@@ -82,8 +230,191 @@ PixelToaster::Converter_XRGB8888_to_XRGB1555 	converter_XRGB8888_to_XRGB1555;
 PixelToaster::Converter_XRGB8888_to_XBGR1555 	converter_XRGB8888_to_XBGR1555;
 
 
+#ifdef PIXELTOASTER_SIMD
+
+#define PIXELTOASTER_SIMD_CONVERTERS( isa )																				\
+																														\
+PixelToaster::Converter_XBGRFFFF_to_XRGB8888_##isa 	converter_XBGRFFFF_to_XRGB8888_##isa;								\
+PixelToaster::Converter_XBGRFFFF_to_XBGR8888_##isa 	converter_XBGRFFFF_to_XBGR8888_##isa;								\
+PixelToaster::Converter_XBGRFFFF_to_RGB888_##isa 	converter_XBGRFFFF_to_RGB888_##isa;									\
+PixelToaster::Converter_XBGRFFFF_to_BGR888_##isa 	converter_XBGRFFFF_to_BGR888_##isa;									\
+PixelToaster::Converter_XBGRFFFF_to_RGB565_##isa 	converter_XBGRFFFF_to_RGB565_##isa;									\
+PixelToaster::Converter_XBGRFFFF_to_BGR565_##isa 	converter_XBGRFFFF_to_BGR565_##isa;									\
+PixelToaster::Converter_XBGRFFFF_to_XRGB1555_##isa 	converter_XBGRFFFF_to_XRGB1555_##isa;								\
+PixelToaster::Converter_XBGRFFFF_to_XBGR1555_##isa 	converter_XBGRFFFF_to_XBGR1555_##isa;								\
+																														\
+PixelToaster::Converter_XRGB8888_to_XBGRFFFF_##isa 	converter_XRGB8888_to_XBGRFFFF_##isa;								\
+PixelToaster::Converter_XRGB8888_to_XBGR8888_##isa 	converter_XRGB8888_to_XBGR8888_##isa;								\
+PixelToaster::Converter_XRGB8888_to_RGB888_##isa 	converter_XRGB8888_to_RGB888_##isa;									\
+PixelToaster::Converter_XRGB8888_to_BGR888_##isa 	converter_XRGB8888_to_BGR888_##isa;									\
+PixelToaster::Converter_XRGB8888_to_RGB565_##isa 	converter_XRGB8888_to_RGB565_##isa;									\
+PixelToaster::Converter_XRGB8888_to_BGR565_##isa 	converter_XRGB8888_to_BGR565_##isa;									\
+PixelToaster::Converter_XRGB8888_to_XRGB1555_##isa 	converter_XRGB8888_to_XRGB1555_##isa;								\
+PixelToaster::Converter_XRGB8888_to_XBGR1555_##isa 	converter_XRGB8888_to_XBGR1555_##isa;								\
+																														\
+static PixelToaster::Converter * requestConverter_##isa( PixelToaster::Format source, PixelToaster::Format destination )	\
+{																														\
+	using namespace PixelToaster;																						\
+																														\
+    if ( source == Format::XBGRFFFF )																					\
+    {																													\
+        switch ( destination )																							\
+        {																												\
+            case Format::XRGB8888: 		return &converter_XBGRFFFF_to_XRGB8888_##isa;									\
+            case Format::XBGR8888: 		return &converter_XBGRFFFF_to_XBGR8888_##isa;									\
+            case Format::RGB888: 		return &converter_XBGRFFFF_to_RGB888_##isa;										\
+            case Format::BGR888: 		return &converter_XBGRFFFF_to_BGR888_##isa;										\
+            case Format::RGB565: 		return &converter_XBGRFFFF_to_RGB565_##isa;										\
+            case Format::BGR565: 		return &converter_XBGRFFFF_to_BGR565_##isa;										\
+            case Format::XRGB1555: 		return &converter_XBGRFFFF_to_XRGB1555_##isa;									\
+            case Format::XBGR1555: 		return &converter_XBGRFFFF_to_XBGR1555_##isa;									\
+			default: break;																								\
+        }																												\
+    }																													\
+    else if ( source == Format::XRGB8888 )																				\
+    {																													\
+        switch ( destination )																							\
+        {																												\
+            case Format::XBGRFFFF: 		return &converter_XRGB8888_to_XBGRFFFF_##isa;									\
+            case Format::XBGR8888: 		return &converter_XRGB8888_to_XBGR8888_##isa;									\
+            case Format::RGB888: 		return &converter_XRGB8888_to_RGB888_##isa;										\
+            case Format::BGR888: 		return &converter_XRGB8888_to_BGR888_##isa;										\
+            case Format::RGB565: 		return &converter_XRGB8888_to_RGB565_##isa;										\
+            case Format::BGR565: 		return &converter_XRGB8888_to_BGR565_##isa;										\
+            case Format::XRGB1555: 		return &converter_XRGB8888_to_XRGB1555_##isa;									\
+            case Format::XBGR1555: 		return &converter_XRGB8888_to_XBGR1555_##isa;									\
+			default: break;																								\
+        }																												\
+    }																													\
+																														\
+	/* copies are memcpy, which is as fast as it gets already */														\
+	return requestConverter( source, destination, InstructionSet::Scalar );												\
+}
+
+PIXELTOASTER_SIMD_CONVERTERS( SSE2 )
+PIXELTOASTER_SIMD_CONVERTERS( SSSE3 )
+PIXELTOASTER_SIMD_CONVERTERS( AVX2 )
+
+#undef PIXELTOASTER_SIMD_CONVERTERS
+
+#endif
+
+
+PixelToaster::InstructionSet PixelToaster::detectInstructionSet()
+{
+#ifdef PIXELTOASTER_SIMD
+	static const InstructionSet instructionSet = cpuInstructionSet();
+	return instructionSet;
+#else
+	return InstructionSet::Scalar;
+#endif
+}
+
+int PixelToaster::processorCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	const int count = (int) info.dwNumberOfProcessors;
+#else
+	const int count = (int) sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+	return count > 0 ? count : 1;
+}
+
 PixelToaster::Converter * PixelToaster::requestConverter( PixelToaster::Format source, PixelToaster::Format destination )
 {
+	return requestConverter( source, destination, detectInstructionSet(), 0 );
+}
+
+#ifdef PIXELTOASTER_THREADS
+
+static int pixelSize( PixelToaster::Format format )
+{
+	using namespace PixelToaster;
+
+	switch ( format )
+	{
+		case Format::XBGRFFFF:		return 16;
+		case Format::XRGB8888:
+		case Format::XBGR8888:		return 4;
+		case Format::RGB888:
+		case Format::BGR888:		return 3;
+		default:					return 2;
+	}
+}
+
+// parallel converters are created on demand and kept for the life of the program, like the static ones
+
+struct ParallelConverterEntry
+{
+	PixelToaster::Converter * converter;
+	PixelToaster::ParallelConverter * parallel;
+	int threads;
+	ParallelConverterEntry * next;
+};
+
+static ParallelConverterEntry * parallelConverters = NULL;
+static pthread_mutex_t parallelConvertersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#endif
+
+PixelToaster::Converter * PixelToaster::requestConverter( PixelToaster::Format source, PixelToaster::Format destination, PixelToaster::InstructionSet instructionSet, int threads )
+{
+	Converter * converter = requestConverter( source, destination, instructionSet );
+
+#ifdef PIXELTOASTER_THREADS
+
+	const int processors = processorCount();
+	if ( threads <= 0 || threads > processors )
+		threads = processors;
+
+	if ( !converter || threads == 1 )
+		return converter;
+
+	pthread_mutex_lock( &parallelConvertersMutex );
+
+	ParallelConverterEntry * entry = parallelConverters;
+	while ( entry && ( entry->converter != converter || entry->threads != threads ) )
+		entry = entry->next;
+
+	if ( !entry )
+	{
+		entry = new ParallelConverterEntry;
+		entry->converter = converter;
+		entry->parallel = new ParallelConverter( converter, pixelSize( source ), pixelSize( destination ), threads );
+		entry->threads = threads;
+		entry->next = parallelConverters;
+		parallelConverters = entry;
+	}
+
+	pthread_mutex_unlock( &parallelConvertersMutex );
+
+	return entry->parallel;
+
+#else
+
+	return converter;
+
+#endif
+}
+
+PixelToaster::Converter * PixelToaster::requestConverter( PixelToaster::Format source, PixelToaster::Format destination, PixelToaster::InstructionSet instructionSet )
+{
+	// never hand out a converter the cpu can't run
+	if ( instructionSet > detectInstructionSet() )
+		return NULL;
+
+#ifdef PIXELTOASTER_SIMD
+	switch ( instructionSet )
+	{
+		case InstructionSet::SSE2:		return requestConverter_SSE2( source, destination );
+		case InstructionSet::SSSE3:		return requestConverter_SSSE3( source, destination );
+		case InstructionSet::AVX2:		return requestConverter_AVX2( source, destination );
+		default:						break;
+	}
+#endif
+
     if ( source == Format::XBGRFFFF )
     {
         switch ( destination )
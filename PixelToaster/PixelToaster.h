@@ -429,6 +429,42 @@ if ( display.open() )
             return enumeration;
         }
 
+    private:
+
+        Enumeration enumeration;
+    };
+
+	// this is an internal class representing the instruction sets the converters are implemented with.
+	// requestConverter picks the best one the cpu supports, the others are there for testing and profiling.
+	// each instruction set implies the ones before it.
+
+    class InstructionSet
+    {
+    public:
+
+        enum Enumeration
+        {
+            Scalar,         ///< plain c++, works everywhere.
+            SSE2,           ///< x86 SSE2.
+            SSSE3,          ///< x86 SSSE3 (byte shuffles).
+            AVX2            ///< x86 AVX2 (eight pixels at a time).
+        };
+
+        InstructionSet()
+        {
+            enumeration = Scalar;
+        }
+
+		InstructionSet( Enumeration enumeration )
+        {
+            this->enumeration = enumeration;
+        }
+
+        operator Enumeration() const
+        {
+            return enumeration;
+        }
+
     private:
 
         Enumeration enumeration;
@@ -506,7 +542,8 @@ if ( display.open() )
         {
             Default,            ///< default output. let the display choose between windowed and fullscreen. windowed output is preferred if available.
             Windowed,           ///< windowed output. output pixels to a window.
-            Fullscreen          ///< fullscreen output. switch to a fullscreen display mode.
+            Fullscreen,         ///< fullscreen output. switch to a fullscreen display mode.
+            Offscreen           ///< no output. convert pixels into memory and take input from a script, see PixelToasterOffscreen.h. useful for benchmarks and headless rendering.
         };
 
         /// The default constructor sets the enumeration value to Default.
@@ -538,6 +575,127 @@ if ( display.open() )
         Enumeration enumeration;
     };
 
+    /** \brief Determines when the pixels passed to Display::update are presented.
+
+		By default the display presents synchronously: Display::update converts the pixels, copies them
+		to the window and only returns once that is done.
+
+		In asynchronous presentation, Display::update copies the changed pixels into a small queue of frames
+		and returns right away. A dedicated thread converts and presents the queued frames, so the application
+		can render its next frame while the previous one is going up on the screen.
+
+		When the queue is full, Presentation::Asynchronous replaces the newest frame that is still waiting with
+		the new one, so presentation never falls behind rendering (frames may be dropped, see PresentStatistics).
+		Presentation::AsynchronousBlocking makes Display::update wait for a free frame instead, which throttles
+		the application to the speed of presentation.
+
+		With Presentation::External the display presents nothing: the application draws into the window itself,
+		through the native handle from Display::handle (eg. with a cairo xlib surface on an X connection of its own).
+		Display::update then only processes events, and the display never paints over what the application drew.
+
+		Not every display supports asynchronous or external presentation, see Display::presentation.
+	 **/
+
+    class Presentation
+    {
+    public:
+
+        /// %Presentation enumeration.
+
+        enum Enumeration
+        {
+            Synchronous,            ///< present inside Display::update.
+            Asynchronous,           ///< present on a separate thread. replace waiting frames when the queue is full.
+            AsynchronousBlocking,   ///< present on a separate thread. wait for a free frame when the queue is full.
+            External                ///< don't present. the application draws into the window through Display::handle.
+        };
+
+        /// The default constructor sets the enumeration value to Synchronous.
+
+        Presentation()
+        {
+            enumeration = Synchronous;
+        }
+
+        /// This constructor enables automatic conversion from the enumeration type to a presentation object.
+		/// @param enumeration the enumeration value.
+
+        Presentation( Enumeration enumeration )
+        {
+            this->enumeration = enumeration;
+        }
+
+        /// Cast from presentation object to enumeration.
+        /// Allows you to treat this class as if it was the enumeration itself.
+        /// This enables the ==, != operators, and the use of presentation objects in a switch statement.
+
+        operator Enumeration() const
+        {
+            return enumeration;
+        }
+
+    private:
+
+        Enumeration enumeration;
+    };
+
+    /** \brief Determines on which thread keyboard and mouse events are read and sent to the Listener.
+
+		By default the display reads its input synchronously: events that arrived since the last update are
+		sent to the listener from inside Display::update. Input is then sampled once per rendered frame, and
+		the delay until an event is seen depends on how long the application takes to render.
+
+		With threaded input, a dedicated thread waits on the window system and sends each keyboard and mouse
+		event to the listener as soon as it arrives, independent of the rate of updates. The key and mouse
+		callbacks of the Listener are then called on the input thread, concurrently with the thread calling
+		Display::update, so the listener must synchronize with the rest of the application. A common way is to
+		only queue the events in the callbacks, and take them off the queue on the thread that uses them.
+		Activation and close requests are still sent from inside Display::update.
+
+		Not every display supports threaded input, see Display::input.
+	 **/
+
+    class Input
+    {
+    public:
+
+        /// %Input enumeration.
+
+        enum Enumeration
+        {
+            Synchronous,            ///< read input and call the listener inside Display::update.
+            Threaded                ///< read input and call the listener on a separate thread, as soon as events arrive.
+        };
+
+        /// The default constructor sets the enumeration value to Synchronous.
+
+        Input()
+        {
+            enumeration = Synchronous;
+        }
+
+        /// This constructor enables automatic conversion from the enumeration type to an input object.
+		/// @param enumeration the enumeration value.
+
+        Input( Enumeration enumeration )
+        {
+            this->enumeration = enumeration;
+        }
+
+        /// Cast from input object to enumeration.
+        /// Allows you to treat this class as if it was the enumeration itself.
+        /// This enables the ==, != operators, and the use of input objects in a switch statement.
+
+        operator Enumeration() const
+        {
+            return enumeration;
+        }
+
+    private:
+
+        Enumeration enumeration;
+    };
+
     /** \brief Describes the current mouse position and the state of the left, right and middle mouse buttons.
 
 		This class is used by the Listener interface for each of the event callbacks for mouse input.
@@ -763,11 +921,54 @@ assert( ! (a == b) );
 		Rectangle(int xb, int xe, int yb, int ye): xBegin(xb), xEnd(xe), yBegin(yb), yEnd(ye) {}
 	};
 
-	// internal factory methods
+	// Counters of asynchronous presentation, see Display::presentStatistics.
+	// Latencies are measured from the call to Display::update until the frame has been handed to the window system.
+	//
+	struct PresentStatistics
+	{
+		int queueLength;				///< number of frames in the queue
+		int queuedFrames;				///< frames waiting to be presented right now
+		int maxQueuedFrames;			///< most frames that were waiting at the same time
+		unsigned int framesQueued;		///< frames passed to update
+		unsigned int framesPresented;	///< frames that made it to the screen
+		unsigned int framesDropped;		///< frames replaced by a newer one before they were presented
+		unsigned int stalls;			///< updates that had to wait for a free frame
+		double stallTime;				///< total time spent waiting for free frames, in seconds
+		double lastLatency;				///< latency of the most recent frame, in seconds
+		double averageLatency;			///< mean latency of all presented frames, in seconds
+		double maxLatency;				///< worst latency of all presented frames, in seconds
+		PresentStatistics(): queueLength(0), queuedFrames(0), maxQueuedFrames(0), framesQueued(0), framesPresented(0),
+			framesDropped(0), stalls(0), stallTime(0), lastLatency(0), averageLatency(0), maxLatency(0) {}
+	};
+
+	// internal factory methods.
+	// requestConverter with a thread count splits large conversions across that many threads (zero for all processors).
+	// the two argument version uses the best instruction set and every processor.
 
 	PIXELTOASTER_API class DisplayInterface * createDisplay();
+	PIXELTOASTER_API class DisplayInterface * createDisplay( Output output );
 	PIXELTOASTER_API class TimerInterface * createTimer();
 	PIXELTOASTER_API class Converter * requestConverter( Format source, Format destination );
+	PIXELTOASTER_API class Converter * requestConverter( Format source, Format destination, InstructionSet instructionSet );
+	PIXELTOASTER_API class Converter * requestConverter( Format source, Format destination, InstructionSet instructionSet, int threads );
+	PIXELTOASTER_API InstructionSet detectInstructionSet();
+
+	// number of processors currently online, at least one.
+
+	PIXELTOASTER_API int processorCount();
+
+	// memory for pixels. blocks are 64 byte aligned, and blocks of 2MB or more start on a 2MB boundary and are
+	// put on 2MB pages where the system has them: reserved huge pages first, then transparent ones. allocatePixels
+	// returns null when out of memory, and its blocks go back through freePixels.
+	PIXELTOASTER_API void * allocatePixels( size_t bytes );
+	PIXELTOASTER_API void freePixels( void * pixels );
+
+	// batching the updates of several displays. on X11 all displays share one connection to the server, and
+	// between beginUpdates and endUpdates their updates go out with a single flush in endUpdates. draw into a
+	// Display::buffer only after endUpdates, the server may be reading it until then. does nothing elsewhere.
+	PIXELTOASTER_API void beginUpdates();
+	PIXELTOASTER_API void endUpdates();
+
 
 	// internal display interface
 
@@ -784,9 +985,18 @@ assert( ! (a == b) );
 
         virtual bool update( const FloatingPointPixel pixels[], const Rectangle* dirtyBox = 0 ) = 0;
         virtual bool update( const TrueColorPixel pixels[], const Rectangle* dirtyBox = 0 ) = 0;
+        virtual bool update( const FloatingPointPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount ) = 0;
+        virtual bool update( const TrueColorPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount ) = 0;
 
         virtual const char * title() const = 0;
 		virtual void title( const char title[] ) = 0;
+		virtual TrueColorPixel * buffer() = 0;
+		virtual void * handle() const = 0;
+		virtual bool presentation( Presentation presentation, int queueLength = 2 ) = 0;
+		virtual Presentation presentation() const = 0;
+		virtual PresentStatistics presentStatistics() const = 0;
+		virtual bool input( Input input ) = 0;
+		virtual Input input() const = 0;
         virtual int width() const = 0;
         virtual int height() const = 0;
         virtual Mode mode() const = 0;
@@ -895,6 +1105,21 @@ while ( display.open() )
 
         bool open( const char title[], int width, int height, Output output = Output::Default, Mode mode = Mode::FloatingPoint )
         {
+			// offscreen output is a display implementation of its own, swap it in keeping the listener.
+			// once offscreen, the display stays offscreen.
+
+			if ( internal && output == Output::Offscreen && internal->output() != Output::Offscreen )
+			{
+				DisplayInterface * offscreen = createDisplay( Output::Offscreen );
+				if ( offscreen )
+				{
+					offscreen->wrapper( this );
+					offscreen->listener( internal->listener() );
+					delete internal;
+					internal = offscreen;
+				}
+			}
+
             if ( internal )
                 return internal->open( title, width, height, output, mode );
             else
@@ -971,6 +1196,36 @@ while ( display.open() )
                 return false;
         }
 
+        /// Update display with floating point pixels, given a list of changed regions.
+        /// This works like the single dirty box update, except that the hint is a list of disjoint boxes.
+        /// Displays that support partial updates only convert and copy the pixels inside the boxes,
+        /// so the cost of an update scales with how much of the image changed, not with its size.
+        /// Passing a count of zero means nothing has changed since the last call. The display is
+        /// not redrawn, but events are still processed.
+        /// @param pixels the pixels to copy to the screen.
+        /// @param dirtyBoxes array of ranges of pixels that have been changed since last call.
+        /// @param dirtyBoxCount number of boxes in dirtyBoxes.
+        /// @returns true if the update was successful.
+
+        bool update( const class FloatingPointPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount )
+        {
+            if ( internal )
+                return internal->update( pixels, dirtyBoxes, dirtyBoxCount );
+            else
+                return false;
+        }
+
+        /// Update display with truecolor pixels, given a list of changed regions.
+        /// @see update( const FloatingPointPixel[], const Rectangle[], int )
+
+        bool update( const TrueColorPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount )
+        {
+            if ( internal )
+                return internal->update( pixels, dirtyBoxes, dirtyBoxCount );
+            else
+                return false;
+        }
+
 #ifndef PIXELTOASTER_NO_STL
 
         /// Update display with standard vector of floating point pixels.
@@ -993,6 +1248,22 @@ while ( display.open() )
 			return update( &pixels[0], dirtyBox );
         }
 
+        /// Update display with standard vector of floating point pixels and a list of changed regions.
+		/// An empty list means nothing has changed since the last call.
+
+		bool update( const vector<FloatingPointPixel> & pixels, const vector<Rectangle> & dirtyBoxes )
+        {
+			return update( &pixels[0], dirtyBoxes.empty() ? 0 : &dirtyBoxes[0], (int) dirtyBoxes.size() );
+        }
+
+        /// Update display with standard vector of truecolor pixels and a list of changed regions.
+		/// An empty list means nothing has changed since the last call.
+
+		bool update( const vector<TrueColorPixel> & pixels, const vector<Rectangle> & dirtyBoxes )
+        {
+			return update( &pixels[0], dirtyBoxes.empty() ? 0 : &dirtyBoxes[0], (int) dirtyBoxes.size() );
+        }
+
 #endif
 
         /// Get display title
@@ -1013,6 +1284,99 @@ while ( display.open() )
 				internal->title(title);
 		}
 
+		/// Get the display's own truecolor pixel buffer, if it has one.
+		/// Some displays present out of memory that is shared with the window system (eg. MIT-SHM on X11).
+		/// Rendering straight into that memory and passing it to Display::update avoids copying the pixels
+		/// before they are presented. The buffer holds width x height pixels laid out like the arrays
+		/// passed to update, and it keeps its contents between updates.
+		/// The pointer is valid until the display is closed.
+		/// @returns the buffer, or null if the display does not have one. render into your own pixels in that case.
+
+		TrueColorPixel * buffer()
+		{
+			if ( internal )
+				return internal->buffer();
+			else
+				return 0;
+		}
+
+		/// Get the native handle of the display's window, for drawing into it with another library.
+		/// On X11 this is the Window (an XID, cast to a pointer), on Windows the HWND. Xlib connections are not
+		/// thread safe, so open a connection of your own to the same X server to use the window.
+		/// Pair it with Presentation::External, or the display paints its pixels over whatever is drawn.
+		/// @returns the handle, or null if the display has no window.
+
+		void * handle() const
+		{
+			if ( internal )
+				return internal->handle();
+			else
+				return 0;
+		}
+
+		/// Choose how updates are presented.
+		/// This can be called before or after the display is opened, the choice is kept when the display is closed and opened again.
+		/// While asynchronous presentation is active, Display::buffer returns null: the presentation thread may still be
+		/// reading from the display's memory while the application draws the next frame.
+		/// @param presentation synchronous, external or one of the asynchronous modes. see Presentation.
+		/// @param queueLength number of frames in the queue for asynchronous presentation: 2 for double buffering, 3 for triple buffering.
+		/// @returns false if the display does not support the presentation or the queue length is out of range.
+
+		bool presentation( Presentation presentation, int queueLength = 2 )
+		{
+			if ( internal )
+				return internal->presentation( presentation, queueLength );
+			else
+				return false;
+		}
+
+		/// Get the presentation in effect.
+		/// If the display could not start asynchronous presentation when it was opened, it falls back to synchronous presentation.
+
+		Presentation presentation() const
+		{
+			if ( internal )
+				return internal->presentation();
+			else
+				return Presentation::Synchronous;
+		}
+
+		/// Get queue depth and latency counters of asynchronous presentation.
+		/// The counters are reset when the display is opened or asynchronous presentation is started.
+
+		PresentStatistics presentStatistics() const
+		{
+			if ( internal )
+				return internal->presentStatistics();
+			else
+				return PresentStatistics();
+		}
+
+		/// Choose the thread that reads keyboard and mouse input and calls the listener.
+		/// This can be called before or after the display is opened, the choice is kept when the display is closed and opened again.
+		/// With threaded input the key and mouse callbacks of the listener run on the input thread, see Input.
+		/// @param input synchronous or threaded. see Input.
+		/// @returns false if the display does not support the input mode.
+
+		bool input( Input input )
+		{
+			if ( internal )
+				return internal->input( input );
+			else
+				return false;
+		}
+
+		/// Get the input mode in effect.
+		/// If the display could not start its input thread when it was opened, it falls back to synchronous input.
+
+		Input input() const
+		{
+			if ( internal )
+				return internal->input();
+			else
+				return Input::Synchronous;
+		}
+
         /// Get display width
 
         int width() const
@@ -1099,7 +1463,7 @@ while ( display.open() )
         virtual double time() = 0;
         virtual double delta() = 0;
         virtual double resolution() = 0;
-        virtual void wait( double seconds ) = 0;
+        virtual void wait( double seconds, bool precise ) = 0;
     };
 
     /** \brief A high resolution timer.
@@ -1190,12 +1554,16 @@ while ( display.open() )
         }
 
         /// Wait for a period of time.
+        /// A plain wait sleeps, and may return late by as much as the operating system scheduler likes.
+        /// A precise wait sleeps for most of the period and spins for the rest, which costs some cpu time
+        /// but returns within microseconds of the deadline. use it to pace frames or simulation steps.
         /// @param seconds the number of seconds to wait before returning from this method.
+        /// @param precise true to spin for the last part of the wait.
 
-        void wait( double seconds )
+        void wait( double seconds, bool precise = false )
         {
             if ( internal )
-                internal->wait( seconds );
+                internal->wait( seconds, precise );
         }
 
     private:
@@ -1391,12 +1759,37 @@ int main()
 
 		virtual void onActivate( DisplayInterface & display, bool active ) {}
 
+        /// On visible.
+        /// Called when the display window is hidden or shown again. A window is hidden while it is minimized,
+        /// unmapped or completely covered by other windows, so nothing drawn to it can be seen.
+        /// Applications can skip rendering while hidden, but should keep calling Display::update to receive events:
+        /// an update with a dirty box count of zero draws nothing and only processes events.
+		/// @param display the display sending the event
+        /// @param visible true if the window can be seen (at least partially), false if it is hidden.
+
+		virtual void onVisible( DisplayInterface & display, bool visible ) {}
+
 		/// On open.
 		/// Called when a display is opened successfully.
 		/// @param display the display sending the event
 
 		virtual void onOpen( DisplayInterface & display ) {}
 
+		/// On convert begin.
+		/// Called before the display converts the dirty pixels of a frame into its own format, on the thread
+		/// doing the conversion: the presentation thread when presenting asynchronously, otherwise the thread
+		/// calling Display::update. Meant for profiling the converters, so keep it short.
+		/// @param display the display sending the event
+
+		virtual void onConvertBegin( DisplayInterface & display ) {}
+
+		/// On convert end.
+		/// Called on the same thread once the conversion announced by onConvertBegin is done.
+		/// @param display the display sending the event
+		/// @param pixels the number of pixels converted.
+
+		virtual void onConvertEnd( DisplayInterface & display, int pixels ) {}
+
         /// On close.
         /// Called when the window has been requested to close by the user.
         /// You are responsible for responding to this event by quitting
@@ -111,8 +111,9 @@ namespace PixelToaster
 			return 1.0 / 1000000.0;		// microseconds
 		}
 	
-		void wait( double seconds )
+		void wait( double seconds, bool precise )
 		{
+			// this spins anyway
 			UInt64 counter;
 			Microseconds( (UnsignedWide*) &counter );
 			UInt64 finish = counter + UInt64( seconds*1000000 );
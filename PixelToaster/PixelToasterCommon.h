@@ -6,6 +6,10 @@
 #include <ctime>
 #endif
 
+#if defined(_MSC_VER) && ( defined(_M_IX86) || defined(_M_X64) )
+#include <intrin.h>
+#endif
+
 namespace PixelToaster
 {
 	// glenn's magical strcpy replacement with bram's template touch ...
@@ -22,6 +26,100 @@ namespace PixelToaster
 		dest[i] = 0;
 	}
 
+	// clip a box to the [0,width) x [0,height) range of a display.
+	// returns false if there is nothing left of it.
+
+	inline bool clipRectangle( Rectangle & box, int width, int height )
+	{
+		if ( box.xBegin < 0 ) box.xBegin = 0;
+		if ( box.yBegin < 0 ) box.yBegin = 0;
+		if ( box.xEnd > width ) box.xEnd = width;
+		if ( box.yEnd > height ) box.yEnd = height;
+		return box.xBegin < box.xEnd && box.yBegin < box.yEnd;
+	}
+
+	// grow a box to include another one
+
+	inline void mergeRectangle( Rectangle & bounds, const Rectangle & box )
+	{
+		if ( box.xBegin < bounds.xBegin ) bounds.xBegin = box.xBegin;
+		if ( box.xEnd > bounds.xEnd ) bounds.xEnd = box.xEnd;
+		if ( box.yBegin < bounds.yBegin ) bounds.yBegin = box.yBegin;
+		if ( box.yEnd > bounds.yEnd ) bounds.yEnd = box.yEnd;
+	}
+
+	// convert only the pixels inside a (clipped) box from one linear width x height image into another.
+	// boxes spanning the full width are converted with a single call to keep the converter loops long.
+
+	inline void convertRectangle( Converter * converter, const void * source, int sourcePixelSize,
+		void * destination, int destinationPixelSize, int width, const Rectangle & box )
+	{
+		const char * src = static_cast<const char*>(source);
+		char * dst = static_cast<char*>(destination);
+
+		if ( box.xBegin == 0 && box.xEnd == width )
+		{
+			const int offset = box.yBegin * width;
+			converter->convert( src + offset * sourcePixelSize, dst + offset * destinationPixelSize, ( box.yEnd - box.yBegin ) * width );
+			return;
+		}
+
+		for ( int y = box.yBegin; y < box.yEnd; ++y )
+		{
+			const int offset = y * width + box.xBegin;
+			converter->convert( src + offset * sourcePixelSize, dst + offset * destinationPixelSize, box.xEnd - box.xBegin );
+		}
+	}
+
+	// tell the cpu we are spinning, so it can save power and give the other hyperthread a go
+
+	inline void spinPause()
+	{
+	#if defined(__GNUC__) && ( defined(__i386__) || defined(__x86_64__) )
+		__asm__ __volatile__( "pause" );
+	#elif defined(_MSC_VER) && ( defined(_M_IX86) || defined(_M_X64) )
+		_mm_pause();
+	#endif
+	}
+
+	// how long before the deadline a precise wait should stop sleeping and start spinning.
+	// it follows the oversleep the timer actually sees: it jumps up to cover a late wakeup at once
+	// and creeps back down while wakeups are early enough, so the spin stays as short as it can.
+
+	class WaitMargin
+	{
+	public:
+
+		WaitMargin( double initial, double minimum, double maximum )
+		{
+			_margin = initial;
+			_minimum = minimum;
+			_maximum = maximum;
+		}
+
+		double margin() const
+		{
+			return _margin;
+		}
+
+		void oversleep( double seconds )
+		{
+			if ( seconds > _margin )
+				_margin = seconds * 1.25;
+			else
+				_margin -= ( _margin - seconds ) * ( 1.0 / 64 );
+
+			if ( _margin < _minimum ) _margin = _minimum;
+			if ( _margin > _maximum ) _margin = _maximum;
+		}
+
+	private:
+
+		double _margin;
+		double _minimum;
+		double _maximum;
+	};
+
 	// derive your platform's display implementation from this and it will handle all the mundane details for you
 
 	class DisplayAdapter : public DisplayInterface
@@ -82,6 +180,22 @@ namespace PixelToaster
 				return false;
 		}
 
+		bool update( const TrueColorPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount )
+		{
+			if ( pixels )
+				return update( pixels, 0, dirtyBoxes, dirtyBoxCount );
+			else
+				return false;
+		}
+
+		bool update( const FloatingPointPixel pixels[], const Rectangle dirtyBoxes[], int dirtyBoxCount )
+		{
+			if ( pixels )
+				return update( 0, pixels, dirtyBoxes, dirtyBoxCount );
+			else
+				return false;
+		}
+
 		const char * title() const
 		{
 			return _title;
@@ -92,6 +206,47 @@ namespace PixelToaster
 			magical_strcpy(_title, title);
 		}
 
+		TrueColorPixel * buffer()
+		{
+			return 0;
+		}
+
+		void * handle() const
+		{
+			return 0;
+		}
+
+		// note: override these if your display can present on a separate thread.
+		// by default only synchronous presentation is supported.
+
+		bool presentation( Presentation presentation, int queueLength )
+		{
+			return presentation == Presentation::Synchronous;
+		}
+
+		Presentation presentation() const
+		{
+			return Presentation::Synchronous;
+		}
+
+		PresentStatistics presentStatistics() const
+		{
+			return PresentStatistics();
+		}
+
+		// note: override these if your display can read input on a separate thread.
+		// by default input is only read synchronously.
+
+		bool input( Input input )
+		{
+			return input == Input::Synchronous;
+		}
+
+		Input input() const
+		{
+			return Input::Synchronous;
+		}
+
 		int width() const
 		{
 			return _width;
@@ -140,6 +295,22 @@ namespace PixelToaster
 
 		virtual bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle * dirtyBox ) { return true; }
 
+		// "unified" update for a list of dirty boxes. override this if your display can present
+		// several disjoint regions cheaper than their bounding box. the default merges the list
+		// into a single bounding box and forwards it to the single box update above.
+		// an empty list means nothing changed, which is forwarded as a full update so events still get pumped.
+
+		virtual bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle dirtyBoxes[], int dirtyBoxCount )
+		{
+			if ( dirtyBoxCount <= 0 )
+				return update( trueColorPixels, floatingPointPixels, (const Rectangle*) 0 );
+
+			Rectangle bounds = dirtyBoxes[0];
+			for ( int i = 1; i < dirtyBoxCount; ++i )
+				mergeRectangle( bounds, dirtyBoxes[i] );
+			return update( trueColorPixels, floatingPointPixels, &bounds );
+		}
+
 		// this defaults is virtual, override it to add your own defaults
 		// but make sure you always call the superclass defaults in your overridden function!
 		// note: due to c++ constructor oddities, make sure you also call defaults in your own 
@@ -229,8 +400,9 @@ namespace PixelToaster
 			return _resolution;
 		}
 		
-		void wait(double seconds)
+		void wait( double seconds, bool precise )
 		{
+			// this spins anyway
 			clock_t start = std::clock();
 			clock_t finish = start + clock_t( seconds / _resolution );
 			while ( std::clock() < finish );
@@ -257,7 +429,7 @@ namespace PixelToaster
 		double time() { return 0.0f; }
 		double delta() { return 0.0f; }
 		double resolution() { return 0.0f; }
-		void wait( double seconds ) {}
+		void wait( double seconds, bool precise ) {}
 	};
 	
 #endif
@@ -11,6 +11,50 @@
 #include <memory.h>
 #endif
 
+// the simd converters need intrinsics, and a compiler that can build single functions for an instruction set.
+// define PIXELTOASTER_NO_SIMD to leave them out.
+
+#if !defined(PIXELTOASTER_NO_SIMD) && ( \
+	( defined(__GNUC__) && ( defined(__i386__) || defined(__x86_64__) ) && ( defined(__clang__) || __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) ) ) || \
+	( defined(_MSC_VER) && _MSC_VER >= 1800 && ( defined(_M_IX86) || defined(_M_X64) ) ) )
+#define PIXELTOASTER_SIMD
+#endif
+
+// large conversions are split across a pool of worker threads where pthreads and atomic builtins are available.
+// define PIXELTOASTER_NO_THREADS to always convert on the calling thread.
+
+#if !defined(PIXELTOASTER_NO_THREADS) && !defined(PIXELTOASTER_NO_CRT) && defined(__GNUC__)
+#define PIXELTOASTER_THREADS
+#	include <pthread.h>
+#	ifdef _WIN32
+#		include <windows.h>
+#	else
+#		include <unistd.h>
+#	endif
+#endif
+
+#ifdef PIXELTOASTER_SIMD
+#	include <immintrin.h>
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#		define PIXELTOASTER_SSE2
+#		define PIXELTOASTER_SSSE3
+#		define PIXELTOASTER_AVX2
+#	else
+#		include <cpuid.h>
+#		if defined(__i386__)
+			// 32 bit windows only keeps the stack 4 byte aligned, so realign it for vectors spilled to the stack
+#			define PIXELTOASTER_SSE2 __attribute__(( target( "sse2" ), force_align_arg_pointer ))
+#			define PIXELTOASTER_SSSE3 __attribute__(( target( "ssse3" ), force_align_arg_pointer ))
+#			define PIXELTOASTER_AVX2 __attribute__(( target( "avx2" ), force_align_arg_pointer ))
+#		else
+#			define PIXELTOASTER_SSE2 __attribute__(( target( "sse2" ) ))
+#			define PIXELTOASTER_SSSE3 __attribute__(( target( "ssse3" ) ))
+#			define PIXELTOASTER_AVX2 __attribute__(( target( "avx2" ) ))
+#		endif
+#	endif
+#endif
+
 namespace PixelToaster
 {
 	// floating point tricks!
@@ -489,6 +533,572 @@ namespace PixelToaster
 		#endif
     }
 
+	// simd converters
+	//
+	// every converter from floating point and truecolor also comes in SSE2, SSSE3 and AVX2 flavors.
+	// they work on 16 pixels at a time, leave what's left over to the scalar converters above, and
+	// produce exactly the same bits as those:
+	//
+	//  - fraction8 repeats the integer tricks of clamped_fraction_8 on four (or eight) floats at once.
+	//  - the 5 and 6 bit fractions are just the top bits of the 8 bit one, so floating point to any
+	//    format is floating point to truecolor followed by truecolor to that format, in registers.
+	//  - truecolor to floating point scales by 1/256, which is exact, and leaves the alpha of the
+	//    destination pixels alone, just like the scalar loop which only writes red, green and blue.
+	//
+	// each converter is made of a load, which gets 16 pixels into registers as truecolor, and a store,
+	// which writes them out in the destination format. the functions are compiled for their instruction
+	// set with a target attribute, so no special compiler flags are needed. requestConverter only hands
+	// them out when the cpu supports them.
+
+#ifdef PIXELTOASTER_SIMD
+
+	inline InstructionSet cpuInstructionSet()
+	{
+		unsigned int maxLeaf, eax, ebx, ecx, edx;
+
+	#if defined(_MSC_VER)
+		int info[4];
+		__cpuid( info, 0 );
+		maxLeaf = info[0];
+		__cpuid( info, 1 );
+		ecx = info[2];
+		edx = info[3];
+	#else
+		maxLeaf = __get_cpuid_max( 0, 0 );
+		if ( maxLeaf < 1 )
+			return InstructionSet::Scalar;
+		__cpuid( 1, eax, ebx, ecx, edx );
+	#endif
+
+		if ( !( edx & ( 1 << 26 ) ) )
+			return InstructionSet::Scalar;
+		if ( !( ecx & ( 1 << 9 ) ) )
+			return InstructionSet::SSE2;
+
+		// avx2 also needs the os to save the upper halves of the registers (osxsave, xcr0 bits 1 and 2)
+
+		if ( maxLeaf < 7 || !( ecx & ( 1 << 27 ) ) || !( ecx & ( 1 << 28 ) ) )
+			return InstructionSet::SSSE3;
+
+	#if defined(_MSC_VER)
+		const unsigned int xcr0 = (unsigned int) _xgetbv( 0 );
+		__cpuidex( info, 7, 0 );
+		ebx = info[1];
+	#else
+		__asm__ __volatile__ ( "xgetbv" : "=a" ( eax ), "=d" ( edx ) : "c" ( 0 ) );
+		const unsigned int xcr0 = eax;
+		__cpuid_count( 7, 0, eax, ebx, ecx, edx );
+	#endif
+
+		if ( ( xcr0 & 6 ) != 6 || !( ebx & ( 1 << 5 ) ) )
+			return InstructionSet::SSSE3;
+
+		return InstructionSet::AVX2;
+	}
+
+	// SSE2
+
+	PIXELTOASTER_SSE2 inline __m128i fraction8_SSE2( __m128 input )
+	{
+		__m128i value = _mm_castps_si128( input );
+		value = _mm_andnot_si128( _mm_srai_epi32( value, 31 ), value );
+		const __m128i saturated = _mm_cmpgt_epi32( value, _mm_set1_epi32( 0x3F7FFFFE ) );
+		value = _mm_castps_si128( _mm_add_ps( _mm_castsi128_ps( value ), _mm_set1_ps( 1.0f ) ) );
+		return _mm_srli_epi32( _mm_and_si128( _mm_or_si128( value, saturated ), _mm_set1_epi32( 0x07F8000 ) ), 15 );
+	}
+
+	PIXELTOASTER_SSE2 inline __m128i swapRedBlue_SSE2( __m128i pixels )
+	{
+		const __m128i r = _mm_and_si128( _mm_srli_epi32( pixels, 16 ), _mm_set1_epi32( 0x000000FF ) );
+		const __m128i g = _mm_and_si128( pixels, _mm_set1_epi32( 0x0000FF00 ) );
+		const __m128i b = _mm_slli_epi32( _mm_and_si128( pixels, _mm_set1_epi32( 0x000000FF ) ), 16 );
+		return _mm_or_si128( _mm_or_si128( r, g ), b );
+	}
+
+	// pack the low 16 bits of each 32 bit lane (packs_epi32 saturates, so sign extend them first)
+
+	PIXELTOASTER_SSE2 inline __m128i pack16_SSE2( __m128i a, __m128i b )
+	{
+		a = _mm_srai_epi32( _mm_slli_epi32( a, 16 ), 16 );
+		b = _mm_srai_epi32( _mm_slli_epi32( b, 16 ), 16 );
+		return _mm_packs_epi32( a, b );
+	}
+
+	// squeeze the low three bytes of four pixels into the low 12 bytes
+
+	PIXELTOASTER_SSE2 inline __m128i compact24_SSE2( __m128i pixels )
+	{
+		pixels = _mm_and_si128( pixels, _mm_set1_epi32( 0x00FFFFFF ) );
+		pixels = _mm_or_si128( _mm_and_si128( pixels, _mm_set_epi32( 0, -1, 0, -1 ) ),
+			_mm_srli_epi64( _mm_and_si128( pixels, _mm_set_epi32( -1, 0, -1, 0 ) ), 8 ) );
+		return _mm_or_si128( _mm_and_si128( pixels, _mm_set_epi32( 0, 0, -1, -1 ) ),
+			_mm_srli_si128( _mm_and_si128( pixels, _mm_set_epi32( -1, -1, 0, 0 ) ), 2 ) );
+	}
+
+	// write four vectors of 12 bytes each as 48 contiguous bytes
+
+	PIXELTOASTER_SSE2 inline void store48_SSE2( __m128i a, __m128i b, __m128i c, __m128i d, char * destination )
+	{
+		_mm_storeu_si128( (__m128i*) destination, _mm_or_si128( a, _mm_slli_si128( b, 12 ) ) );
+		_mm_storeu_si128( (__m128i*) ( destination + 16 ), _mm_or_si128( _mm_srli_si128( b, 4 ), _mm_slli_si128( c, 8 ) ) );
+		_mm_storeu_si128( (__m128i*) ( destination + 32 ), _mm_or_si128( _mm_srli_si128( c, 8 ), _mm_slli_si128( d, 4 ) ) );
+	}
+
+	// keep the alpha of the floating point pixel at destination
+
+	PIXELTOASTER_SSE2 inline void storeKeepAlpha_SSE2( __m128 pixel, float * destination )
+	{
+		const __m128 alpha = _mm_castsi128_ps( _mm_set_epi32( -1, 0, 0, 0 ) );
+		_mm_storeu_ps( destination, _mm_or_ps( _mm_andnot_ps( alpha, pixel ), _mm_and_ps( alpha, _mm_loadu_ps( destination ) ) ) );
+	}
+
+	struct Load_XBGRFFFF_SSE2
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_SSE2 void load( const char * source, __m128i pixels[4] )
+		{
+			const float * s = (const float*) source;
+			for ( int i = 0; i < 4; ++i, s += 16 )
+			{
+				__m128i p[4];
+				for ( int j = 0; j < 4; ++j )
+				{
+					const __m128 rgba = _mm_loadu_ps( s + j * 4 );
+					p[j] = fraction8_SSE2( _mm_shuffle_ps( rgba, rgba, _MM_SHUFFLE( 3, 0, 1, 2 ) ) );
+				}
+				const __m128i bytes = _mm_packus_epi16( _mm_packs_epi32( p[0], p[1] ), _mm_packs_epi32( p[2], p[3] ) );
+				pixels[i] = _mm_and_si128( bytes, _mm_set1_epi32( 0x00FFFFFF ) );
+			}
+		}
+	};
+
+	struct Load_XRGB8888_SSE2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_SSE2 void load( const char * source, __m128i pixels[4] )
+		{
+			for ( int i = 0; i < 4; ++i )
+				pixels[i] = _mm_loadu_si128( (const __m128i*) source + i );
+		}
+	};
+
+	struct Store_XRGB8888_SSE2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )
+		{
+			for ( int i = 0; i < 4; ++i )
+				_mm_storeu_si128( (__m128i*) destination + i, pixels[i] );
+		}
+	};
+
+	struct Store_XBGR8888_SSE2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )
+		{
+			for ( int i = 0; i < 4; ++i )
+				_mm_storeu_si128( (__m128i*) destination + i, swapRedBlue_SSE2( pixels[i] ) );
+		}
+	};
+
+	struct Store_RGB888_SSE2
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )
+		{
+			store48_SSE2( compact24_SSE2( swapRedBlue_SSE2( pixels[0] ) ), compact24_SSE2( swapRedBlue_SSE2( pixels[1] ) ),
+				compact24_SSE2( swapRedBlue_SSE2( pixels[2] ) ), compact24_SSE2( swapRedBlue_SSE2( pixels[3] ) ), destination );
+		}
+	};
+
+	struct Store_BGR888_SSE2
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )
+		{
+			store48_SSE2( compact24_SSE2( pixels[0] ), compact24_SSE2( pixels[1] ),
+				compact24_SSE2( pixels[2] ), compact24_SSE2( pixels[3] ), destination );
+		}
+	};
+
+	// the 16 bit stores share everything but the bit shuffling
+
+	#define PIXELTOASTER_STORE16_SSE2( format, red, green, blue )												\
+																										\
+	struct Store_##format##_SSE2																		\
+	{																									\
+		enum { size = 2 };																				\
+																										\
+		static PIXELTOASTER_SSE2 __m128i pack( __m128i p )												\
+		{																								\
+			return _mm_or_si128( _mm_or_si128( red, green ), blue );									\
+		}																								\
+																										\
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )				\
+		{																								\
+			_mm_storeu_si128( (__m128i*) destination, pack16_SSE2( pack( pixels[0] ), pack( pixels[1] ) ) );			\
+			_mm_storeu_si128( (__m128i*) destination + 1, pack16_SSE2( pack( pixels[2] ), pack( pixels[3] ) ) );		\
+		}																								\
+	};
+
+	#define PIXELTOASTER_MASK( p, mask ) _mm_and_si128( p, _mm_set1_epi32( mask ) )
+
+	PIXELTOASTER_STORE16_SSE2( RGB565,
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 8 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x0000FC00 ), 5 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 3 ) )
+
+	PIXELTOASTER_STORE16_SSE2( BGR565,
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 19 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x0000FC00 ), 5 ),
+		_mm_slli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 8 ) )
+
+	PIXELTOASTER_STORE16_SSE2( XRGB1555,
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 9 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x0000F800 ), 6 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 3 ) )
+
+	PIXELTOASTER_STORE16_SSE2( XBGR1555,
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 19 ),
+		_mm_srli_epi32( PIXELTOASTER_MASK( p, 0x0000F800 ), 6 ),
+		_mm_slli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 7 ) )
+
+	#undef PIXELTOASTER_MASK
+	#undef PIXELTOASTER_STORE16_SSE2
+
+	struct Store_XBGRFFFF_SSE2
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_SSE2 void store( const __m128i pixels[4], char * destination )
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128 scale = _mm_set1_ps( 1.0f / 256.0f );
+			float * d = (float*) destination;
+			for ( int i = 0; i < 4; ++i )
+			{
+				const __m128i low = _mm_unpacklo_epi8( pixels[i], zero );
+				const __m128i high = _mm_unpackhi_epi8( pixels[i], zero );
+				const __m128i p[4] = { _mm_unpacklo_epi16( low, zero ), _mm_unpackhi_epi16( low, zero ), _mm_unpacklo_epi16( high, zero ), _mm_unpackhi_epi16( high, zero ) };
+				for ( int j = 0; j < 4; ++j, d += 4 )
+				{
+					const __m128 bgrx = _mm_mul_ps( _mm_cvtepi32_ps( p[j] ), scale );
+					storeKeepAlpha_SSE2( _mm_shuffle_ps( bgrx, bgrx, _MM_SHUFFLE( 3, 0, 1, 2 ) ), d );
+				}
+			}
+		}
+	};
+
+	template <class Load, class Store> PIXELTOASTER_SSE2 inline unsigned int convert_SSE2( const void * source, void * destination, unsigned int count )
+	{
+		const char * s = (const char*) source;
+		char * d = (char*) destination;
+		const unsigned int blocks = count / 16;
+		for ( unsigned int i = 0; i < blocks; ++i, s += 16 * Load::size, d += 16 * Store::size )
+		{
+			__m128i pixels[4];
+			Load::load( s, pixels );
+			Store::store( pixels, d );
+		}
+		return blocks * 16;
+	}
+
+	// SSSE3: byte shuffles replace the shift and mask sequences
+
+	struct Load_XBGRFFFF_SSSE3
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_SSSE3 void load( const char * source, __m128i pixels[4] )
+		{
+			const __m128i order = _mm_setr_epi8( 2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1 );
+			const float * s = (const float*) source;
+			for ( int i = 0; i < 4; ++i, s += 16 )
+			{
+				const __m128i p0 = fraction8_SSE2( _mm_loadu_ps( s ) );
+				const __m128i p1 = fraction8_SSE2( _mm_loadu_ps( s + 4 ) );
+				const __m128i p2 = fraction8_SSE2( _mm_loadu_ps( s + 8 ) );
+				const __m128i p3 = fraction8_SSE2( _mm_loadu_ps( s + 12 ) );
+				const __m128i bytes = _mm_packus_epi16( _mm_packs_epi32( p0, p1 ), _mm_packs_epi32( p2, p3 ) );
+				pixels[i] = _mm_shuffle_epi8( bytes, order );
+			}
+		}
+	};
+
+	struct Store_XBGR8888_SSSE3
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_SSSE3 void store( const __m128i pixels[4], char * destination )
+		{
+			const __m128i order = _mm_setr_epi8( 2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1 );
+			for ( int i = 0; i < 4; ++i )
+				_mm_storeu_si128( (__m128i*) destination + i, _mm_shuffle_epi8( pixels[i], order ) );
+		}
+	};
+
+	struct Store_RGB888_SSSE3
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_SSSE3 void store( const __m128i pixels[4], char * destination )
+		{
+			const __m128i order = _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+			store48_SSE2( _mm_shuffle_epi8( pixels[0], order ), _mm_shuffle_epi8( pixels[1], order ),
+				_mm_shuffle_epi8( pixels[2], order ), _mm_shuffle_epi8( pixels[3], order ), destination );
+		}
+	};
+
+	struct Store_BGR888_SSSE3
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_SSSE3 void store( const __m128i pixels[4], char * destination )
+		{
+			const __m128i order = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+			store48_SSE2( _mm_shuffle_epi8( pixels[0], order ), _mm_shuffle_epi8( pixels[1], order ),
+				_mm_shuffle_epi8( pixels[2], order ), _mm_shuffle_epi8( pixels[3], order ), destination );
+		}
+	};
+
+	struct Store_XBGRFFFF_SSSE3
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_SSSE3 void store( const __m128i pixels[4], char * destination )
+		{
+			const __m128i order[4] =
+			{
+				_mm_setr_epi8( 2, -1, -1, -1, 1, -1, -1, -1, 0, -1, -1, -1, -1, -1, -1, -1 ),
+				_mm_setr_epi8( 6, -1, -1, -1, 5, -1, -1, -1, 4, -1, -1, -1, -1, -1, -1, -1 ),
+				_mm_setr_epi8( 10, -1, -1, -1, 9, -1, -1, -1, 8, -1, -1, -1, -1, -1, -1, -1 ),
+				_mm_setr_epi8( 14, -1, -1, -1, 13, -1, -1, -1, 12, -1, -1, -1, -1, -1, -1, -1 ),
+			};
+			const __m128 scale = _mm_set1_ps( 1.0f / 256.0f );
+			float * d = (float*) destination;
+			for ( int i = 0; i < 4; ++i )
+			{
+				for ( int j = 0; j < 4; ++j, d += 4 )
+					storeKeepAlpha_SSE2( _mm_mul_ps( _mm_cvtepi32_ps( _mm_shuffle_epi8( pixels[i], order[j] ) ), scale ), d );
+			}
+		}
+	};
+
+	typedef Load_XRGB8888_SSE2 Load_XRGB8888_SSSE3;
+	typedef Store_XRGB8888_SSE2 Store_XRGB8888_SSSE3;
+	typedef Store_RGB565_SSE2 Store_RGB565_SSSE3;
+	typedef Store_BGR565_SSE2 Store_BGR565_SSSE3;
+	typedef Store_XRGB1555_SSE2 Store_XRGB1555_SSSE3;
+	typedef Store_XBGR1555_SSE2 Store_XBGR1555_SSSE3;
+
+	template <class Load, class Store> PIXELTOASTER_SSSE3 inline unsigned int convert_SSSE3( const void * source, void * destination, unsigned int count )
+	{
+		const char * s = (const char*) source;
+		char * d = (char*) destination;
+		const unsigned int blocks = count / 16;
+		for ( unsigned int i = 0; i < blocks; ++i, s += 16 * Load::size, d += 16 * Store::size )
+		{
+			__m128i pixels[4];
+			Load::load( s, pixels );
+			Store::store( pixels, d );
+		}
+		return blocks * 16;
+	}
+
+	// AVX2: two registers of eight pixels. most instructions work within 128 bit halves,
+	// so packing needs a cross lane permute to get the pixels back in order.
+
+	PIXELTOASTER_AVX2 inline __m256i fraction8_AVX2( __m256 input )
+	{
+		__m256i value = _mm256_castps_si256( input );
+		value = _mm256_andnot_si256( _mm256_srai_epi32( value, 31 ), value );
+		const __m256i saturated = _mm256_cmpgt_epi32( value, _mm256_set1_epi32( 0x3F7FFFFE ) );
+		value = _mm256_castps_si256( _mm256_add_ps( _mm256_castsi256_ps( value ), _mm256_set1_ps( 1.0f ) ) );
+		return _mm256_srli_epi32( _mm256_and_si256( _mm256_or_si256( value, saturated ), _mm256_set1_epi32( 0x07F8000 ) ), 15 );
+	}
+
+	PIXELTOASTER_AVX2 inline __m256i shuffle_AVX2( __m256i pixels, __m128i order )
+	{
+		return _mm256_shuffle_epi8( pixels, _mm256_broadcastsi128_si256( order ) );
+	}
+
+	struct Load_XBGRFFFF_AVX2
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_AVX2 void load( const char * source, __m256i pixels[2] )
+		{
+			const __m128i order = _mm_setr_epi8( 2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1 );
+			const __m256i interleave = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+			const float * s = (const float*) source;
+			for ( int i = 0; i < 2; ++i, s += 32 )
+			{
+				const __m256i p01 = fraction8_AVX2( _mm256_loadu_ps( s ) );
+				const __m256i p23 = fraction8_AVX2( _mm256_loadu_ps( s + 8 ) );
+				const __m256i p45 = fraction8_AVX2( _mm256_loadu_ps( s + 16 ) );
+				const __m256i p67 = fraction8_AVX2( _mm256_loadu_ps( s + 24 ) );
+				const __m256i bytes = _mm256_packus_epi16( _mm256_packs_epi32( p01, p23 ), _mm256_packs_epi32( p45, p67 ) );
+				pixels[i] = shuffle_AVX2( _mm256_permutevar8x32_epi32( bytes, interleave ), order );
+			}
+		}
+	};
+
+	struct Load_XRGB8888_AVX2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_AVX2 void load( const char * source, __m256i pixels[2] )
+		{
+			pixels[0] = _mm256_loadu_si256( (const __m256i*) source );
+			pixels[1] = _mm256_loadu_si256( (const __m256i*) source + 1 );
+		}
+	};
+
+	struct Store_XRGB8888_AVX2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )
+		{
+			_mm256_storeu_si256( (__m256i*) destination, pixels[0] );
+			_mm256_storeu_si256( (__m256i*) destination + 1, pixels[1] );
+		}
+	};
+
+	struct Store_XBGR8888_AVX2
+	{
+		enum { size = 4 };
+
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )
+		{
+			const __m128i order = _mm_setr_epi8( 2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1 );
+			_mm256_storeu_si256( (__m256i*) destination, shuffle_AVX2( pixels[0], order ) );
+			_mm256_storeu_si256( (__m256i*) destination + 1, shuffle_AVX2( pixels[1], order ) );
+		}
+	};
+
+	// 24 bit: shuffle each half down to 12 bytes, close the gap between the halves, then write 2 x 24 bytes
+
+	PIXELTOASTER_AVX2 inline void store24_AVX2( const __m256i pixels[2], __m128i order, char * destination )
+	{
+		const __m256i close = _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 );
+		const __m256i a = _mm256_permutevar8x32_epi32( shuffle_AVX2( pixels[0], order ), close );
+		const __m256i b = _mm256_permutevar8x32_epi32( shuffle_AVX2( pixels[1], order ), close );
+		const __m128i bLow = _mm256_castsi256_si128( b );
+		_mm_storeu_si128( (__m128i*) destination, _mm256_castsi256_si128( a ) );
+		_mm_storeu_si128( (__m128i*) ( destination + 16 ), _mm_unpacklo_epi64( _mm256_extracti128_si256( a, 1 ), bLow ) );
+		_mm_storeu_si128( (__m128i*) ( destination + 32 ), _mm_alignr_epi8( _mm256_extracti128_si256( b, 1 ), bLow, 8 ) );
+	}
+
+	struct Store_RGB888_AVX2
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )
+		{
+			store24_AVX2( pixels, _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ), destination );
+		}
+	};
+
+	struct Store_BGR888_AVX2
+	{
+		enum { size = 3 };
+
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )
+		{
+			store24_AVX2( pixels, _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 ), destination );
+		}
+	};
+
+	#define PIXELTOASTER_STORE16_AVX2( format, red, green, blue )												\
+																										\
+	struct Store_##format##_AVX2																		\
+	{																									\
+		enum { size = 2 };																				\
+																										\
+		static PIXELTOASTER_AVX2 __m256i pack( __m256i p )												\
+		{																								\
+			return _mm256_or_si256( _mm256_or_si256( red, green ), blue );								\
+		}																								\
+																										\
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )				\
+		{																								\
+			const __m256i packed = _mm256_packus_epi32( pack( pixels[0] ), pack( pixels[1] ) );			\
+			_mm256_storeu_si256( (__m256i*) destination, _mm256_permute4x64_epi64( packed, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );	\
+		}																								\
+	};
+
+	#define PIXELTOASTER_MASK( p, mask ) _mm256_and_si256( p, _mm256_set1_epi32( mask ) )
+
+	PIXELTOASTER_STORE16_AVX2( RGB565,
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 8 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x0000FC00 ), 5 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 3 ) )
+
+	PIXELTOASTER_STORE16_AVX2( BGR565,
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 19 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x0000FC00 ), 5 ),
+		_mm256_slli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 8 ) )
+
+	PIXELTOASTER_STORE16_AVX2( XRGB1555,
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 9 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x0000F800 ), 6 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 3 ) )
+
+	PIXELTOASTER_STORE16_AVX2( XBGR1555,
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x00F80000 ), 19 ),
+		_mm256_srli_epi32( PIXELTOASTER_MASK( p, 0x0000F800 ), 6 ),
+		_mm256_slli_epi32( PIXELTOASTER_MASK( p, 0x000000F8 ), 7 ) )
+
+	#undef PIXELTOASTER_MASK
+	#undef PIXELTOASTER_STORE16_AVX2
+
+	struct Store_XBGRFFFF_AVX2
+	{
+		enum { size = 16 };
+
+		static PIXELTOASTER_AVX2 void store( const __m256i pixels[2], char * destination )
+		{
+			const __m256 scale = _mm256_set1_ps( 1.0f / 256.0f );
+			float * d = (float*) destination;
+			for ( int i = 0; i < 2; ++i )
+			{
+				const __m128i halves[2] = { _mm256_castsi256_si128( pixels[i] ), _mm256_extracti128_si256( pixels[i], 1 ) };
+				for ( int j = 0; j < 4; ++j, d += 8 )
+				{
+					// two pixels: widen bytes to [b g r x b g r x], reorder to [r g b x r g b x] and keep the old alpha
+					const __m128i pair = ( j & 1 ) ? _mm_srli_si128( halves[j >> 1], 8 ) : halves[j >> 1];
+					const __m256i bgrx = _mm256_cvtepu8_epi32( pair );
+					const __m256 rgbx = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_shuffle_epi32( bgrx, _MM_SHUFFLE( 3, 0, 1, 2 ) ) ), scale );
+					_mm256_storeu_ps( d, _mm256_blend_ps( rgbx, _mm256_loadu_ps( d ), 0x88 ) );
+				}
+			}
+		}
+	};
+
+	template <class Load, class Store> PIXELTOASTER_AVX2 inline unsigned int convert_AVX2( const void * source, void * destination, unsigned int count )
+	{
+		const char * s = (const char*) source;
+		char * d = (char*) destination;
+		const unsigned int blocks = count / 16;
+		for ( unsigned int i = 0; i < blocks; ++i, s += 16 * Load::size, d += 16 * Store::size )
+		{
+			__m256i pixels[2];
+			Load::load( s, pixels );
+			Store::store( pixels, d );
+		}
+		return blocks * 16;
+	}
+
+#endif
+
 	// declare set of converter classes
 
     class ConverterAdapter : public Converter
@@ -527,6 +1137,281 @@ namespace PixelToaster
 	PIXELTOASTER_CONVERTER( XRGB8888_to_XRGB1555, integer32, integer16 );
 	PIXELTOASTER_CONVERTER( XRGB8888_to_XBGR1555, integer32, integer16 );
 
+#ifdef PIXELTOASTER_SIMD
+
+	// simd converters: 16 pixels at a time, the rest with the scalar converter
+
+	#define PIXELTOASTER_SIMD_CONVERTER( source_format, destination_format, isa, source_type, destination_type )	\
+																										\
+	class Converter_##source_format##_to_##destination_format##_##isa : public ConverterAdapter			\
+    {																									\
+        void convert( const void * source, void * destination, int pixels )								\
+        {																								\
+			typedef Load_##source_format##_##isa Load;													\
+			typedef Store_##destination_format##_##isa Store;											\
+			const unsigned int done = convert_##isa< Load, Store >( source, destination, pixels );		\
+			convert_##source_format##_to_##destination_format(											\
+				(const source_type*) ( (const char*) source + done * Load::size ),						\
+				(destination_type*) ( (char*) destination + done * Store::size ), pixels - done );		\
+        }																								\
+    };																									\
+
+	#define PIXELTOASTER_SIMD_CONVERTERS( isa )																\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, XRGB8888, isa, Pixel, integer32 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, XBGR8888, isa, Pixel, integer32 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, RGB888, isa, Pixel, integer8 );								\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, BGR888, isa, Pixel, integer8 );								\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, RGB565, isa, Pixel, integer16 );								\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, BGR565, isa, Pixel, integer16 );								\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, XRGB1555, isa, Pixel, integer16 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XBGRFFFF, XBGR1555, isa, Pixel, integer16 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, XBGRFFFF, isa, integer32, Pixel );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, XBGR8888, isa, integer32, integer32 );						\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, RGB888, isa, integer32, integer8 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, BGR888, isa, integer32, integer8 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, RGB565, isa, integer32, integer16 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, BGR565, isa, integer32, integer16 );							\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, XRGB1555, isa, integer32, integer16 );						\
+	PIXELTOASTER_SIMD_CONVERTER( XRGB8888, XBGR1555, isa, integer32, integer16 );						\
+
+	PIXELTOASTER_SIMD_CONVERTERS( SSE2 );
+	PIXELTOASTER_SIMD_CONVERTERS( SSSE3 );
+	PIXELTOASTER_SIMD_CONVERTERS( AVX2 );
+
+	#undef PIXELTOASTER_SIMD_CONVERTERS
+	#undef PIXELTOASTER_SIMD_CONVERTER
+
+#endif
+
+#ifdef PIXELTOASTER_THREADS
+
+	// worker threads shared by all parallel converters, one per processor besides the calling thread.
+	// a conversion is cut into bands which the workers and the calling thread take in turn until none are left,
+	// so a worker that got descheduled just ends up converting fewer bands.
+
+	class ConversionPool
+	{
+	public:
+
+		enum { maxWorkers = 63 };
+
+		static ConversionPool & instance()
+		{
+			static ConversionPool pool;
+			return pool;
+		}
+
+		// total threads a conversion can run on, the calling thread included
+
+		int threads() const
+		{
+			return workerCount_ + 1;
+		}
+
+		// convert 'pixels' pixels in bands of 'bandPixels' on at most 'threads' threads.
+		// returns false without converting anything if another thread is using the pool right now.
+
+		bool convert( Converter * converter, const void * source, int sourcePixelSize, void * destination, int destinationPixelSize, int pixels, int bandPixels, int threads )
+		{
+			if ( pthread_mutex_trylock( &busy_ ) != 0 )
+				return false;
+
+			pthread_mutex_lock( &mutex_ );
+			job_.converter = converter;
+			job_.source = static_cast<const char*>(source);
+			job_.destination = static_cast<char*>(destination);
+			job_.sourcePixelSize = sourcePixelSize;
+			job_.destinationPixelSize = destinationPixelSize;
+			job_.pixels = pixels;
+			job_.bandPixels = bandPixels;
+			job_.bands = ( pixels + bandPixels - 1 ) / bandPixels;
+			job_.nextBand = 0;
+			job_.helpers = threads - 1;
+			remaining_ = workerCount_;
+			generation_++;
+			pthread_cond_broadcast( &start_ );
+			pthread_mutex_unlock( &mutex_ );
+
+			convertBands();
+
+			pthread_mutex_lock( &mutex_ );
+			while ( remaining_ > 0 )
+				pthread_cond_wait( &done_, &mutex_ );
+			pthread_mutex_unlock( &mutex_ );
+
+			pthread_mutex_unlock( &busy_ );
+			return true;
+		}
+
+	private:
+
+		ConversionPool()
+		{
+			pthread_mutex_init( &busy_, NULL );
+			pthread_mutex_init( &mutex_, NULL );
+			pthread_cond_init( &start_, NULL );
+			pthread_cond_init( &done_, NULL );
+			generation_ = 0;
+			remaining_ = 0;
+			quit_ = false;
+
+			int count = processorCount() - 1;
+			if ( count > maxWorkers )
+				count = maxWorkers;
+
+			workerCount_ = 0;
+			while ( workerCount_ < count )
+			{
+				workers_[workerCount_].pool = this;
+				workers_[workerCount_].index = workerCount_;
+				if ( pthread_create( &workers_[workerCount_].thread, NULL, worker, &workers_[workerCount_] ) != 0 )
+					break;
+				workerCount_++;
+			}
+		}
+
+		~ConversionPool()
+		{
+			pthread_mutex_lock( &mutex_ );
+			quit_ = true;
+			pthread_cond_broadcast( &start_ );
+			pthread_mutex_unlock( &mutex_ );
+
+			for ( int i = 0; i < workerCount_; ++i )
+				pthread_join( workers_[i].thread, NULL );
+
+			pthread_cond_destroy( &done_ );
+			pthread_cond_destroy( &start_ );
+			pthread_mutex_destroy( &mutex_ );
+			pthread_mutex_destroy( &busy_ );
+		}
+
+		static void * worker( void * data )
+		{
+			Worker * worker = static_cast<Worker*>(data);
+			worker->pool->work( worker->index );
+			return NULL;
+		}
+
+		void work( int index )
+		{
+			unsigned int generation = 0;
+
+			pthread_mutex_lock( &mutex_ );
+
+			while ( true )
+			{
+				while ( generation_ == generation && !quit_ )
+					pthread_cond_wait( &start_, &mutex_ );
+
+				if ( quit_ )
+					break;
+
+				generation = generation_;
+				const bool helping = index < job_.helpers;
+				pthread_mutex_unlock( &mutex_ );
+
+				if ( helping )
+					convertBands();
+
+				pthread_mutex_lock( &mutex_ );
+				if ( --remaining_ == 0 )
+					pthread_cond_signal( &done_ );
+			}
+
+			pthread_mutex_unlock( &mutex_ );
+		}
+
+		void convertBands()
+		{
+			while ( true )
+			{
+				const int band = __sync_fetch_and_add( &job_.nextBand, 1 );
+				if ( band >= job_.bands )
+					return;
+
+				const int first = band * job_.bandPixels;
+				const int count = first + job_.bandPixels < job_.pixels ? job_.bandPixels : job_.pixels - first;
+				job_.converter->convert( job_.source + first * job_.sourcePixelSize, job_.destination + first * job_.destinationPixelSize, count );
+			}
+		}
+
+		struct Worker
+		{
+			ConversionPool * pool;
+			int index;
+			pthread_t thread;
+		};
+
+		struct Job
+		{
+			Converter * converter;
+			const char * source;
+			char * destination;
+			int sourcePixelSize;
+			int destinationPixelSize;
+			int pixels;
+			int bandPixels;
+			int bands;
+			int nextBand;			// next band to take, advanced atomically
+			int helpers;			// workers joining in, the rest sit this one out
+		};
+
+		Worker workers_[maxWorkers];
+		int workerCount_;
+		Job job_;
+		unsigned int generation_;	// bumped for every job so the workers can tell a new one from a spurious wakeup
+		int remaining_;				// workers yet to finish the current job
+		bool quit_;
+		pthread_mutex_t busy_;		// held for a whole conversion
+		pthread_mutex_t mutex_;
+		pthread_cond_t start_;
+		pthread_cond_t done_;
+	};
+
+	// wraps a single threaded converter and splits large conversions into bands across the conversion pool.
+	// bands are sized to stay in cache and are whole simd blocks, so the result is identical to the wrapped converter.
+	// conversions under the threshold, or issued while the pool is busy, run on the calling thread.
+
+	class ParallelConverter : public ConverterAdapter
+	{
+	public:
+
+		enum
+		{
+			bandBytes = 64 * 1024,				// source bytes per band
+			thresholdBytes = 512 * 1024			// source bytes below which threads cost more than they save
+		};
+
+		ParallelConverter( Converter * converter, int sourcePixelSize, int destinationPixelSize, int threads )
+		{
+			converter_ = converter;
+			sourcePixelSize_ = sourcePixelSize;
+			destinationPixelSize_ = destinationPixelSize;
+			threads_ = threads;
+			bandPixels_ = ( bandBytes / sourcePixelSize ) & ~15;
+		}
+
+		void convert( const void * source, void * destination, int pixels )
+		{
+			if ( pixels * sourcePixelSize_ >= thresholdBytes && threads_ > 1 &&
+				 ConversionPool::instance().convert( converter_, source, sourcePixelSize_, destination, destinationPixelSize_, pixels, bandPixels_, threads_ ) )
+				return;
+
+			converter_->convert( source, destination, pixels );
+		}
+
+	private:
+
+		Converter * converter_;
+		int sourcePixelSize_;
+		int destinationPixelSize_;
+		int threads_;
+		int bandPixels_;
+	};
+
+#endif
+
 	#undef CONVERTER
 }
 
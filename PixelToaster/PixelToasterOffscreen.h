@@ -0,0 +1,429 @@
+// Offscreen Display Implementation
+// Part of the PixelToaster Framebuffer Library - http://www.pixeltoaster.com
+
+// an offscreen display has no window. updates are converted into a buffer in memory
+// exactly like a real display would convert them for the screen, and input comes from
+// an event script instead of the user, so the whole render loop runs without a window system.
+//
+// it is used for displays opened with Output::Offscreen, and for every display when the
+// PIXELTOASTER_OFFSCREEN environment variable is set. the value of the variable may name the
+// format of the buffer (xrgb8888, xbgr8888, rgb888, bgr888, rgb565, bgr565, xrgb1555, xbgr1555
+// or xbgrffff), anything else converts to xrgb8888. an empty variable counts as not set.
+//
+// PIXELTOASTER_OFFSCREEN_SCRIPT names the event script. each line is a frame number followed by
+// an event, which is sent to the listener right after that update. frames count from 1, and
+// count every update, including those with no dirty boxes that present nothing.
+//
+//     # frame  event
+//     1        activate 1
+//     5        visible 1
+//     10       keydown space
+//     12       keyup space
+//     20       mousemove 320 200
+//     20       mousedown 320 200 left
+//     25       mouseup 320 200 left
+//     600      close
+//
+// keys are a single character, a key code number, or one of enter, escape, space, tab,
+// backspace, shift, control, alt, left, right, up and down. without a script (or a close
+// event) the display stays open until the application closes it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+namespace PixelToaster
+{
+	class OffscreenDisplay : public DisplayAdapter
+	{
+	public:
+
+		OffscreenDisplay()
+		{
+			buffer_ = 0;
+			events_ = 0;
+			eventCount_ = 0;
+			frame_ = 0;
+			presented_ = 0;
+			defaults();
+		}
+
+		~OffscreenDisplay()
+		{
+			close();
+		}
+
+		bool open( const char title[], int width, int height, Output output, Mode mode )
+		{
+			close();
+			DisplayAdapter::open( title, width, height, output, mode );
+			frame_ = 0;
+			presented_ = 0;
+
+			format_ = findFormat( getenv( "PIXELTOASTER_OFFSCREEN" ) );
+			pixelSize_ = format_ == Format::XBGRFFFF ? 16 : ( format_ == Format::XRGB8888 || format_ == Format::XBGR8888 ) ? 4 :
+				( format_ == Format::RGB888 || format_ == Format::BGR888 ) ? 3 : 2;
+
+			floatingPointConverter_ = requestConverter( Format::XBGRFFFF, format_ );
+			trueColorConverter_ = requestConverter( Format::XRGB8888, format_ );
+			buffer_ = (char*) allocatePixels( (size_t) width * height * pixelSize_ );
+
+			if ( !floatingPointConverter_ || !trueColorConverter_ || !buffer_ )
+			{
+				close();
+				return false;
+			}
+
+			const char * script = getenv( "PIXELTOASTER_OFFSCREEN_SCRIPT" );
+			if ( script && *script && !loadScript( script ) )
+			{
+				close();
+				return false;
+			}
+
+			if ( listener() )
+				listener()->onOpen( wrapper() ? *wrapper() : *(DisplayInterface*)this );
+
+			return true;
+		}
+
+		void close()
+		{
+			freePixels( buffer_ );
+			buffer_ = 0;
+			free( events_ );
+			events_ = 0;
+			eventCount_ = 0;
+			DisplayAdapter::close();
+		}
+
+		// offscreen displays report their output even when closed, so Display can tell them apart
+
+		Output output() const
+		{
+			return Output::Offscreen;
+		}
+
+		// every update with dirty boxes is presented as soon as it is converted.
+		// the frame count survives closing, so it can still be read once the script closed the display.
+
+		PresentStatistics presentStatistics() const
+		{
+			PresentStatistics statistics;
+			statistics.framesQueued = presented_;
+			statistics.framesPresented = presented_;
+			return statistics;
+		}
+
+	protected:
+
+		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle * dirtyBox )
+		{
+			const Rectangle everything( 0, width(), 0, height() );
+			return update( trueColorPixels, floatingPointPixels, dirtyBox ? dirtyBox : &everything, 1 );
+		}
+
+		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle dirtyBoxes[], int dirtyBoxCount )
+		{
+			if ( !buffer_ )
+				return false;
+
+			// nothing has changed: no conversion and no presented frame, the script still moves on
+
+			if ( dirtyBoxCount > 0 )
+				present( trueColorPixels, floatingPointPixels, dirtyBoxes, dirtyBoxCount );
+
+			frame_++;
+
+			while ( nextEvent_ < eventCount_ && events_[nextEvent_].frame <= frame_ )
+				dispatch( events_[nextEvent_++] );
+
+			if ( closing_ )
+			{
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void present( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle dirtyBoxes[], int dirtyBoxCount )
+		{
+			DisplayInterface & display = wrapper() ? *wrapper() : *(DisplayInterface*)this;
+			if ( listener() )
+				listener()->onConvertBegin( display );
+
+			int pixels = 0;
+			for ( int i = 0; i < dirtyBoxCount; ++i )
+			{
+				Rectangle box = dirtyBoxes[i];
+				if ( !clipRectangle( box, width(), height() ) )
+					continue;
+
+				if ( trueColorPixels )
+					convertRectangle( trueColorConverter_, trueColorPixels, sizeof(TrueColorPixel), buffer_, pixelSize_, width(), box );
+				else
+					convertRectangle( floatingPointConverter_, floatingPointPixels, sizeof(FloatingPointPixel), buffer_, pixelSize_, width(), box );
+				pixels += ( box.xEnd - box.xBegin ) * ( box.yEnd - box.yBegin );
+			}
+
+			if ( listener() )
+				listener()->onConvertEnd( display, pixels );
+
+			presented_++;
+		}
+
+		void defaults()
+		{
+			DisplayAdapter::defaults();
+			format_ = Format::XRGB8888;
+			pixelSize_ = 4;
+			floatingPointConverter_ = 0;
+			trueColorConverter_ = 0;
+			nextEvent_ = 0;
+			closing_ = false;
+		}
+
+	private:
+
+		struct Event
+		{
+			enum Type { KeyDown, KeyUp, MouseDown, MouseUp, MouseMove, Activate, Visible, Close };
+
+			unsigned int frame;
+			Type type;
+			Key key;
+			Mouse mouse;
+			bool active;					///< activate and visible events
+		};
+
+		static Format findFormat( const char * name )
+		{
+			if ( !name ) return Format::XRGB8888;
+			if ( strcmp( name, "xbgr8888" ) == 0 ) return Format::XBGR8888;
+			if ( strcmp( name, "rgb888" ) == 0 ) return Format::RGB888;
+			if ( strcmp( name, "bgr888" ) == 0 ) return Format::BGR888;
+			if ( strcmp( name, "rgb565" ) == 0 ) return Format::RGB565;
+			if ( strcmp( name, "bgr565" ) == 0 ) return Format::BGR565;
+			if ( strcmp( name, "xrgb1555" ) == 0 ) return Format::XRGB1555;
+			if ( strcmp( name, "xbgr1555" ) == 0 ) return Format::XBGR1555;
+			if ( strcmp( name, "xbgrffff" ) == 0 ) return Format::XBGRFFFF;
+			return Format::XRGB8888;
+		}
+
+		static bool findKey( const char * name, Key & key )
+		{
+			static const struct { const char * name; Key::Code code; } names[] =
+			{
+				{ "enter", Key::Enter }, { "escape", Key::Escape }, { "space", Key::Space }, { "tab", Key::Tab },
+				{ "backspace", Key::BackSpace }, { "shift", Key::Shift }, { "control", Key::Control }, { "alt", Key::Alt },
+				{ "left", Key::Left }, { "right", Key::Right }, { "up", Key::Up }, { "down", Key::Down }
+			};
+
+			for ( unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i )
+			{
+				if ( strcmp( name, names[i].name ) == 0 )
+				{
+					key = names[i].code;
+					return true;
+				}
+			}
+
+			if ( isdigit( (unsigned char) name[0] ) )
+				key = (Key::Code) atoi( name );
+			else if ( name[0] && !name[1] )
+				key = (Key::Code) toupper( (unsigned char) name[0] );
+			else
+				return false;
+
+			return true;
+		}
+
+		static bool parseMouse( const char * arguments, Mouse & mouse )
+		{
+			char button[16] = "";
+			if ( sscanf( arguments, "%f %f %15s", &mouse.x, &mouse.y, button ) < 2 )
+				return false;
+
+			mouse.buttons.left = strcmp( button, "left" ) == 0;
+			mouse.buttons.middle = strcmp( button, "middle" ) == 0;
+			mouse.buttons.right = strcmp( button, "right" ) == 0;
+			return true;
+		}
+
+		// read the whole script up front, so no file access happens between frames.
+		// the events are sorted by frame, keeping the order of events on the same frame.
+
+		bool loadScript( const char * filename )
+		{
+			FILE * file = fopen( filename, "r" );
+			if ( !file )
+			{
+				fprintf( stderr, "PixelToaster: could not open event script %s\n", filename );
+				return false;
+			}
+
+			int capacity = 0;
+			int lineNumber = 0;
+			char line[256];
+
+			while ( fgets( line, sizeof(line), file ) )
+			{
+				lineNumber++;
+
+				unsigned int frame;
+				char type[16];
+				int consumed = 0;
+
+				const char * start = line;
+				while ( isspace( (unsigned char) *start ) )
+					start++;
+				if ( *start == 0 || *start == '#' )
+					continue;
+
+				Event event;
+				event.active = true;
+
+				bool valid = sscanf( start, "%u %15s %n", &frame, type, &consumed ) >= 2;
+				const char * arguments = start + consumed;
+
+				if ( valid )
+				{
+					char name[32] = "";
+					int active = 1;
+
+					event.frame = frame;
+
+					if ( strcmp( type, "keydown" ) == 0 || strcmp( type, "keyup" ) == 0 )
+					{
+						event.type = type[3] == 'd' ? Event::KeyDown : Event::KeyUp;
+						valid = sscanf( arguments, "%31s", name ) == 1 && findKey( name, event.key );
+					}
+					else if ( strcmp( type, "mousedown" ) == 0 )
+					{
+						event.type = Event::MouseDown;
+						valid = parseMouse( arguments, event.mouse );
+					}
+					else if ( strcmp( type, "mouseup" ) == 0 )
+					{
+						event.type = Event::MouseUp;
+						valid = parseMouse( arguments, event.mouse );
+					}
+					else if ( strcmp( type, "mousemove" ) == 0 )
+					{
+						event.type = Event::MouseMove;
+						valid = parseMouse( arguments, event.mouse );
+					}
+					else if ( strcmp( type, "activate" ) == 0 || strcmp( type, "visible" ) == 0 )
+					{
+						event.type = type[0] == 'a' ? Event::Activate : Event::Visible;
+						sscanf( arguments, "%d", &active );
+						event.active = active != 0;
+					}
+					else if ( strcmp( type, "close" ) == 0 )
+					{
+						event.type = Event::Close;
+					}
+					else
+					{
+						valid = false;
+					}
+				}
+
+				if ( !valid )
+				{
+					fprintf( stderr, "PixelToaster: bad event on line %d of %s\n", lineNumber, filename );
+					fclose( file );
+					return false;
+				}
+
+				if ( eventCount_ == capacity )
+				{
+					capacity = capacity ? capacity * 2 : 64;
+					Event * events = (Event*) realloc( events_, capacity * sizeof(Event) );
+					if ( !events )
+					{
+						fclose( file );
+						return false;
+					}
+					events_ = events;
+				}
+
+				int i = eventCount_++;
+				while ( i > 0 && events_[i-1].frame > event.frame )
+				{
+					events_[i] = events_[i-1];
+					i--;
+				}
+				events_[i] = event;
+			}
+
+			fclose( file );
+			return true;
+		}
+
+		void dispatch( const Event & event )
+		{
+			DisplayInterface & display = wrapper() ? *wrapper() : *(DisplayInterface*)this;
+
+			switch ( event.type )
+			{
+				case Event::KeyDown:
+				{
+					bool defaultKeyHandlers = true;
+					if ( listener() )
+					{
+						listener()->onKeyDown( display, event.key );
+						listener()->onKeyPressed( display, event.key );
+						defaultKeyHandlers = listener()->defaultKeyHandlers();
+					}
+					if ( defaultKeyHandlers && event.key == Key::Escape )
+						closing_ = true;
+					break;
+				}
+
+				case Event::KeyUp:
+					if ( listener() ) listener()->onKeyUp( display, event.key );
+					break;
+
+				case Event::MouseDown:
+					if ( listener() ) listener()->onMouseButtonDown( display, event.mouse );
+					break;
+
+				case Event::MouseUp:
+					if ( listener() ) listener()->onMouseButtonUp( display, event.mouse );
+					break;
+
+				case Event::MouseMove:
+					if ( listener() ) listener()->onMouseMove( display, event.mouse );
+					break;
+
+				case Event::Activate:
+					if ( listener() ) listener()->onActivate( display, event.active );
+					break;
+
+				case Event::Visible:
+					if ( listener() ) listener()->onVisible( display, event.active );
+					break;
+
+				case Event::Close:
+					if ( !listener() || listener()->onClose( display ) )
+						closing_ = true;
+					break;
+			}
+		}
+
+		Format format_;
+		int pixelSize_;
+		Converter * floatingPointConverter_;
+		Converter * trueColorConverter_;
+		char * buffer_;					///< converted pixels, width x height in format_
+		Event * events_;				///< the event script sorted by frame
+		int eventCount_;
+		int nextEvent_;
+		unsigned int frame_;			///< updates since the display was opened
+		unsigned int presented_;		///< updates that had dirty boxes, so were converted
+		bool closing_;
+	};
+}
@@ -11,9 +11,27 @@
 #define XK_MISCELLANY
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/XKBlib.h>
 #include <X11/keysymdef.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// define this to leave out the MIT-SHM present path (and the -lXext dependency)
+//#define PIXELTOASTER_NO_SHM
+#ifndef PIXELTOASTER_NO_SHM
+#	include <sys/ipc.h>
+#	include <sys/shm.h>
+#	include <X11/extensions/XShm.h>
+#endif
 
 namespace PixelToaster
 {
@@ -21,8 +39,8 @@ namespace PixelToaster
 	class DirtyVector
 	{
 	public:
-		explicit DirtyVector(size_t size = 0) { data_ = size == 0 ? NULL : (static_cast<T*>(malloc(size * sizeof(T)))); }
-		~DirtyVector() { if (data_!=NULL) { free(data_); data_ = NULL; } }
+		explicit DirtyVector(size_t size = 0) { data_ = size == 0 ? NULL : (static_cast<T*>(allocatePixels(size * sizeof(T)))); }
+		~DirtyVector() { if (data_!=NULL) { freePixels(data_); data_ = NULL; } }
 		void reset(size_t size = 0) { DirtyVector<T> temp(size); swap(temp); }
 		T& operator[](size_t i) { assert(data_); return data_[i]; }
 		T* get() { return data_; }
@@ -62,22 +80,163 @@ namespace PixelToaster
 		return Format::Unknown;
 	}
 
+	// copy only the pixels inside a (clipped) box from one linear width x height image into another of the same format.
+
+	inline void copyRectangle( const void * source, void * destination, int pixelSize, int width, const Rectangle & box )
+	{
+		const char * src = static_cast<const char*>(source);
+		char * dst = static_cast<char*>(destination);
+
+		if ( box.xBegin == 0 && box.xEnd == width )
+		{
+			const int offset = box.yBegin * width;
+			memcpy( dst + offset * pixelSize, src + offset * pixelSize, ( box.yEnd - box.yBegin ) * width * pixelSize );
+			return;
+		}
+
+		for ( int y = box.yBegin; y < box.yEnd; ++y )
+		{
+			const int offset = y * width + box.xBegin;
+			memcpy( dst + offset * pixelSize, src + offset * pixelSize, ( box.xEnd - box.xBegin ) * pixelSize );
+		}
+	}
+
+	class UnixDisplay;
+
+	// the X connection shared by every display of the application. a connection per display costs as
+	// many connections, flushes and reads of the socket per frame as there are windows. instead each
+	// display registers its window here, events are read once for all of them and handed to the display
+	// owning the window they are for, and between beginUpdates and endUpdates the requests of all the
+	// displays go to the server with a single flush.
+	// the connection belongs to whichever thread updates the displays, so displays have to be updated
+	// from one thread at a time. presentation and input threads keep connections of their own.
+
+	class UnixConnection
+	{
+	public:
+
+		// open the connection for a display, or take another reference to it.
+		// returns null if there is no X server.
+
+		static ::Display* acquire()
+		{
+			if (!display_)
+				display_ = ::XOpenDisplay(0);
+			if (display_)
+				++references_;
+			return display_;
+		}
+
+		static void release()
+		{
+			if (!display_ || --references_ > 0)
+				return;
+
+			::XCloseDisplay(display_);
+			display_ = 0;
+			flushPending_ = false;
+		}
+
+		// events for the window go to the display from now on
+
+		static void attach(::Window window, UnixDisplay* display)
+		{
+			Owner owner;
+			owner.window = window;
+			owner.display = display;
+			owners_.push_back(owner);
+		}
+
+		static void detach(::Window window)
+		{
+			for (size_t i = 0; i < owners_.size(); ++i)
+			{
+				if (owners_[i].window == window)
+				{
+					owners_.erase(owners_.begin() + i);
+					return;
+				}
+			}
+		}
+
+		// take in whatever the server has sent, without flushing requests or waiting for more, and pass
+		// each event to the display of its window. events for windows nobody owns anymore are dropped.
+
+		static void read();
+
+		// send the requests made so far. while updates are batched this only takes note, and endUpdates flushes.
+
+		static void flush()
+		{
+			if (!display_)
+				return;
+			if (batching_)
+				flushPending_ = true;
+			else
+				::XFlush(display_);
+		}
+
+		static void beginUpdates()
+		{
+			batching_ = true;
+		}
+
+		static bool batching()
+		{
+			return batching_;
+		}
+
+		// flush once for every display updated since beginUpdates, then wait until the server has read
+		// the shared memory images, so they can be drawn into again.
+
+		static void endUpdates();
+
+	private:
+
+		struct Owner
+		{
+			::Window window;
+			UnixDisplay* display;
+		};
+
+		static ::Display* display_;
+		static int references_;
+		static std::vector<Owner> owners_;
+		static bool batching_;
+		static bool flushPending_;
+	};
+
 	class UnixDisplay : public DisplayAdapter
 	{
 	public:
 	
 		UnixDisplay()
 		{
+			presentation_ = Presentation::Synchronous;
+			input_ = Input::Synchronous;
+			queueLength_ = 2;
+			totalLatency_ = 0;
+			::pthread_mutex_init(&queueMutex_, 0);
+			::pthread_cond_init(&frameQueued_, 0);
+			::pthread_cond_init(&frameDone_, 0);
 			defaults();
 		}
 
+		~UnixDisplay()
+		{
+			close();
+			::pthread_cond_destroy(&frameDone_);
+			::pthread_cond_destroy(&frameQueued_);
+			::pthread_mutex_destroy(&queueMutex_);
+		}
+
 		bool open( const char title[], int width, int height, Output output, Mode mode )
 		{
 			DisplayAdapter::open( title, width, height, output, mode );
 
-			// let's open a display
+			// let's open a display (or share the one the application's other displays have open)
 		
-			display_ = ::XOpenDisplay(0);
+			display_ = UnixConnection::acquire();
 			if (!display_)
 			{
 				close();
@@ -113,6 +272,7 @@ namespace PixelToaster
 				return false;
 			}
 
+			bytesPerPixel_ = bytesPerPixel;
 			destFormat_ = findFormat(bufferDepth,
 				visual->red_mask, visual->green_mask, visual->blue_mask);
 			floatingPointConverter_ = requestConverter(Format::XBGRFFFF, destFormat_);
@@ -139,6 +299,7 @@ namespace PixelToaster
 			window_ = ::XCreateWindow(display_, root, left, top, width, height, 0,
 				displayDepth, InputOutput, visual, 
 				CWBackPixel | CWBorderPixel | CWBackingStore, &attributes);
+			UnixConnection::attach(window_, this);
 
 		
 			::XStoreName(display_, window_, title);
@@ -165,33 +326,18 @@ namespace PixelToaster
 			::XClearWindow(display_, window_);
 			::XSelectInput(display_, window_, eventMask_);
 
-			// create (image) buffer
-
-			buffer_.reset(width * height * bytesPerPixel);
-			if (buffer_.isEmpty())
+			if (!startPresentation())
 			{
 				close();
 				return false;
 			}
 
-			gc_ = DefaultGC(display_, screen);
-			image_ = ::XCreateImage(display_, CopyFromParent, displayDepth, ZPixmap, 0, 0,
-				width, height, bitsPerPixel, width * bytesPerPixel);
-	#if defined(PIXELTOASTER_LITTLE_ENDIAN)
-			image_->byte_order = LSBFirst;
-	#else
-			image_->byte_order = MSBFirst;
-	#endif	
-			if (!image_)
-			{
-				close();
-				return false;
-			}
-		
+			startInput();
+
 			// we have a winner!
 
 			::XMapRaised(display_, window_);
-			::XFlush(display_);
+			UnixConnection::flush();
 
 			if ( DisplayAdapter::listener() )
 				DisplayAdapter::listener()->onOpen(wrapper() ? *wrapper() : *(DisplayInterface*)this);
@@ -201,28 +347,34 @@ namespace PixelToaster
 	
 		void close()
 		{	
-			if (image_)
-			{
-				XDestroyImage(image_);
-				image_ = 0;
-			}
+			stopInput();
+			stopPresentation();
 
 			if (display_ && window_)
 			{
+				UnixConnection::detach(window_);
 				XDestroyWindow(display_, window_);
 				window_ = 0;
+				UnixConnection::flush();
 			}
 			
 			if (display_)
 			{
-				XCloseDisplay(display_);
+				UnixConnection::release();
 				display_ = 0;
 			}
+			events_.clear();
 
 			DisplayAdapter::close();			// note: this calls our virtual defaults method
 		}
 
 		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle * dirtyBox )
+		{
+			const Rectangle everything(0, width(), 0, height());
+			return update(trueColorPixels, floatingPointPixels, dirtyBox ? dirtyBox : &everything, 1);
+		}
+
+		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle dirtyBoxes[], int dirtyBoxCount )
 		{
 			if (isShuttingDown_)
 			{
@@ -233,36 +385,67 @@ namespace PixelToaster
 			if (!display_ || !window_ || !image_)
 				return false;
 
+			if (presentation_ == Presentation::External)
+			{
+				// the application draws the window's contents itself
+				pumpEvents();
+				return true;
+			}
+
+			if (!trueColorPixels && !floatingPointPixels)
+				return false;
+
 			const int w = width();
 			const int h = height();
-			const int size = w * h;
 
-			const bool shortcut = trueColorPixels != NULL && destFormat_ == Format::XRGB8888;
-		
-			if ( !shortcut )
+			// the window lost its contents (or has never seen any), so the dirty boxes are not enough
+
+			const Rectangle everything(0, w, 0, h);
+			if (fullUpdatePending_)
+			{
+				dirtyBoxes = &everything;
+				dirtyBoxCount = 1;
+				fullUpdatePending_ = false;
+			}
+
+			if (presenterRunning_)
 			{
-				// extra conversion step: copy pixels to buffer
+				// the presentation thread takes it from here
 
 				if (trueColorPixels)
-					trueColorConverter_->convert(trueColorPixels, buffer_.get(), size);
-				else if (floatingPointPixels)
-					floatingPointConverter_->convert(floatingPointPixels, buffer_.get(), size);
+					queueFrame(trueColorPixels, false, dirtyBoxes, dirtyBoxCount);
 				else
-					return false;
-
-				image_->data = buffer_.get();
+					queueFrame(floatingPointPixels, true, dirtyBoxes, dirtyBoxCount);
 			}
 			else
 			{
-				// shortcut: avoid extra copy - only works for truecolor pixels
-			
-				image_->data = (char*) trueColorPixels;			
+				// with shared memory, the image is the buffer. the only way to skip the copy is
+				// to render straight into it (see buffer), otherwise the pixels are copied in.
+				// the server may still be reading the last batched frame out of it.
+
+				waitForShm();
+				char* const destination = shm_ ? image_->data : buffer_.get();
+				const bool shortcut = trueColorPixels != NULL && destFormat_ == Format::XRGB8888 &&
+					(!shm_ || trueColorPixels == (const TrueColorPixel*) image_->data);
+
+				if ( !shortcut )
+				{
+					// extra conversion step: copy dirty pixels to buffer, the rest of it is still valid from last time
+
+					if (trueColorPixels)
+						convertBoxes(trueColorConverter_, trueColorPixels, sizeof(TrueColorPixel), destination, dirtyBoxes, dirtyBoxCount);
+					else
+						convertBoxes(floatingPointConverter_, floatingPointPixels, sizeof(FloatingPointPixel), destination, dirtyBoxes, dirtyBoxCount);
+
+					putImage(destination, dirtyBoxes, dirtyBoxCount);
+				}
+				else
+				{
+					// shortcut: avoid extra copy - only works for truecolor pixels
+
+					putImage((char*) trueColorPixels, dirtyBoxes, dirtyBoxCount);
+				}
 			}
-		
-			::XPutImage(display_, window_, gc_, image_, 0, 0, 0, 0, w, h);
-			::XFlush(display_);
-		
-			image_->data = NULL;
 
 			pumpEvents();
 
@@ -277,6 +460,87 @@ namespace PixelToaster
 				::XStoreName(display_, window_, title);
 		}
 
+		TrueColorPixel * buffer()
+		{
+			// only hand out the shared image when it is in the native truecolor format,
+			// and nobody else is reading from it
+			if (shm_ && !presenterRunning_ && destFormat_ == Format::XRGB8888)
+				return (TrueColorPixel*) image_->data;
+			return 0;
+		}
+
+		bool presentation(Presentation presentation, int queueLength)
+		{
+			if (queueLength < 1 || queueLength > maxQueueLength_)
+				return false;
+
+			// switching between the two asynchronous modes doesn't need a restart, neither does switching
+			// between synchronous and external presentation
+			const bool wasAsynchronous = asynchronous(presentation_);
+			const bool isAsynchronous = asynchronous(presentation);
+			const bool restart = display_ && (wasAsynchronous != isAsynchronous || (isAsynchronous && queueLength != queueLength_));
+
+			if (restart)
+				stopPresentation();
+
+			presentation_ = presentation;
+			queueLength_ = queueLength;
+
+			if (restart && !startPresentation())
+			{
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		Presentation presentation() const
+		{
+			if (display_ && !presenterRunning_ && presentation_ != Presentation::External)
+				return Presentation::Synchronous;
+			return presentation_;
+		}
+
+		void * handle() const
+		{
+			if (!display_)
+				return 0;
+
+			// the handle is for another connection, the window has to exist on the server by the time that uses it
+			::XSync(display_, False);
+			return (void*) window_;
+		}
+
+		PresentStatistics presentStatistics() const
+		{
+			::pthread_mutex_lock(&queueMutex_);
+			const PresentStatistics stats = stats_;
+			::pthread_mutex_unlock(&queueMutex_);
+			return stats;
+		}
+
+		bool input(Input input)
+		{
+			const bool restart = display_ && input != input_;
+
+			if (restart)
+				stopInput();
+
+			input_ = input;
+
+			if (restart)
+				startInput();
+			return true;
+
+		}
+
+		Input input() const
+		{
+			if (display_ && !inputRunning_)
+				return Input::Synchronous;
+			return input_;
+		}
+
 	protected:
 
 		void defaults()
@@ -284,6 +548,8 @@ namespace PixelToaster
 			DisplayAdapter::defaults();
 		
 			display_ = 0;
+			presentDisplay_ = 0;
+			imageDisplay_ = 0;
 			window_ = 0;
 			gc_ = 0;
 			image_ = 0;
@@ -291,39 +557,793 @@ namespace PixelToaster
 			trueColorConverter_ = 0;
 			floatingPointConverter_ = 0;
 			isShuttingDown_ = false;
-			Format destFormat_ = Format::Unknown;		
+			fullUpdatePending_ = false;
+			mapped_ = true;
+			obscured_ = false;
+			visible_ = true;
+			active_ = false;
+			bytesPerPixel_ = 0;
+			destFormat_ = Format::Unknown;
+			shm_ = false;
+			shmPending_ = false;
+			presenterRunning_ = false;
+			presenterQuit_ = false;
+			presenting_ = false;
+			inputDisplay_ = 0;
+			inputRunning_ = false;
+			inputWake_[0] = inputWake_[1] = -1;
+			queueHead_ = 0;
+			queueCount_ = 0;
+	#ifndef PIXELTOASTER_NO_SHM
+			shmInfo_.shmid = -1;
+			shmInfo_.shmaddr = 0;
+			shmCompletionType_ = 0;
+	#endif
+			for (int i = 0; i < keyMapSize_; ++i)
+			{
+				keyIsPressed_[i] = false;
+				keyIsReleased_[i] = false;
+			}
+		}
+
+	private:
+
+		enum 
+		{ 
+			eventMask_ = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ButtonMotionMask | ExposureMask |
+				VisibilityChangeMask | StructureNotifyMask | FocusChangeMask,
+			inputMask_ = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ButtonMotionMask,
+			keyMapSize_ = 256,
+			maxQueueLength_ = 4,
+			maxFrameBoxes_ = 64
+		};
+
+		typedef DirtyVector<char> TBuffer;
+		typedef Key::Code TKeyMap[keyMapSize_];
+		typedef bool TKeyFlags[keyMapSize_];
+
+		// a queued frame: the pixels of its dirty boxes, in the format they were passed to update
+
+		struct Frame
+		{
+			TBuffer pixels;
+			size_t size;
+			bool floatingPoint;
+			Rectangle boxes[maxFrameBoxes_];
+			int boxCount;
+			double queueTime;
+			Frame(): size(0), floatingPoint(false), boxCount(0), queueTime(0) {}
+		};
+
+		static bool asynchronous(Presentation presentation)
+		{
+			return presentation == Presentation::Asynchronous || presentation == Presentation::AsynchronousBlocking;
+		}
+
+		// set up presenting for the current presentation mode. asynchronous presentation uses an
+		// X connection of its own, so the presentation thread never shares xlib state with the
+		// thread calling update. falls back to synchronous presentation if that can't be done.
+
+		bool startPresentation()
+		{
+			imageDisplay_ = display_;
+			stats_ = PresentStatistics();
+			totalLatency_ = 0;
+
+			if (asynchronous(presentation_))
+			{
+				// the window has to exist on the server before another connection can draw to it
+				::XSync(display_, False);
+				presentDisplay_ = ::XOpenDisplay(::XDisplayString(display_));
+				if (presentDisplay_)
+					imageDisplay_ = presentDisplay_;
+			}
+
+			if (!openImage())
+				return false;
+
+			if (presentDisplay_ && !startPresenter())
+			{
+				stopPresentation();
+				if (!openImage())
+					return false;
+			}
+
+			// the window is new, or the frames that were queued are gone
+			fullUpdatePending_ = true;
+			return true;
+		}
+
+		void stopPresentation()
+		{
+			stopPresenter();
+			closeImage();
+
+			if (presentDisplay_)
+			{
+				::XCloseDisplay(presentDisplay_);
+				presentDisplay_ = 0;
+			}
+			imageDisplay_ = display_;
+		}
+
+		// create the image on the connection that presents it.
+		// prefer a shared memory image, which the server reads without the pixels
+		// going through the socket. if that doesn't work out (remote display, no
+		// extension), fall back to a client side buffer and XPutImage.
+
+		bool openImage()
+		{
+			const int screen = DefaultScreen(imageDisplay_);
+			::Visual* visual = DefaultVisual(imageDisplay_, screen);
+			const int displayDepth = DefaultDepth(imageDisplay_, screen);
+			const int w = width();
+			const int h = height();
+
+			gc_ = DefaultGC(imageDisplay_, screen);
+
+			if (openShm(visual, displayDepth, w, h, bytesPerPixel_))
+				return true;
+
+			buffer_.reset(w * h * bytesPerPixel_);
+			if (buffer_.isEmpty())
+				return false;
+
+			image_ = ::XCreateImage(imageDisplay_, CopyFromParent, displayDepth, ZPixmap, 0, 0,
+				w, h, 8 * bytesPerPixel_, w * bytesPerPixel_);
+			if (!image_)
+				return false;
+	#if defined(PIXELTOASTER_LITTLE_ENDIAN)
+			image_->byte_order = LSBFirst;
+	#else
+			image_->byte_order = MSBFirst;
+	#endif	
+			return true;
+		}
+
+		void closeImage()
+		{
+			closeShm();
+
+			if (image_)
+			{
+				XDestroyImage(image_);
+				image_ = 0;
+			}
+			buffer_.reset();
+		}
+
+		void convertBoxes(Converter* converter, const void* source, int sourcePixelSize, char* destination, const Rectangle dirtyBoxes[], int dirtyBoxCount)
+		{
+			const int w = width();
+			const int h = height();
+			DisplayInterface& display = wrapper() ? *wrapper() : *(DisplayInterface*)this;
+
+			if (listener()) listener()->onConvertBegin(display);
+
+			int pixels = 0;
+			for (int i = 0; i < dirtyBoxCount; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (clipRectangle(box, w, h))
+				{
+					convertRectangle(converter, source, sourcePixelSize, destination, bytesPerPixel_, w, box);
+					pixels += (box.xEnd - box.xBegin) * (box.yEnd - box.yBegin);
+				}
+			}
+
+			if (listener()) listener()->onConvertEnd(display, pixels);
+		}
+
+		// copy the dirty boxes of the image to the window. data is where the image reads its pixels from,
+		// unless it is a shared memory image.
+
+		void putImage(char* data, const Rectangle dirtyBoxes[], int dirtyBoxCount)
+		{
+			if (shm_)
+			{
+				presentShm(dirtyBoxes, dirtyBoxCount);
+				return;
+			}
+
+			const int w = width();
+			const int h = height();
+
+			// only the dirty boxes go over the wire
+
+			image_->data = data;
+			for (int i = 0; i < dirtyBoxCount; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (clipRectangle(box, w, h))
+					::XPutImage(imageDisplay_, window_, gc_, image_, box.xBegin, box.yBegin, box.xBegin, box.yBegin,
+						box.xEnd - box.xBegin, box.yEnd - box.yBegin);
+			}
+			flush(imageDisplay_);
+			image_->data = NULL;
+		}
+
+		// the shared connection flushes once for a batch of updates, the presentation thread's right away
+
+		void flush(::Display* display)
+		{
+			if (display == display_)
+				UnixConnection::flush();
+			else
+				::XFlush(display);
+		}
+
+		// asynchronous presentation: update copies the dirty pixels into the next free frame of a ring
+		// and returns. the presentation thread takes frames from the head of the ring, converts and
+		// presents them. frames_[queueHead_] and the queueCount_ frames after it are waiting, the one
+		// before the head is being presented if presenting_ is set.
+
+		bool startPresenter()
+		{
+			queueHead_ = 0;
+			queueCount_ = 0;
+			presenting_ = false;
+			presenterQuit_ = false;
+			stats_.queueLength = queueLength_;
+
+			if (::pthread_create(&presenter_, 0, presenterThread, this) != 0)
+				return false;
+
+			presenterRunning_ = true;
+			return true;
+		}
+
+		void stopPresenter()
+		{
+			if (!presenterRunning_)
+				return;
+
+			::pthread_mutex_lock(&queueMutex_);
+			presenterQuit_ = true;
+			::pthread_cond_signal(&frameQueued_);
+			::pthread_mutex_unlock(&queueMutex_);
+
+			::pthread_join(presenter_, 0);
+			presenterRunning_ = false;
+
+			// whatever was still waiting doesn't get presented
+			stats_.framesDropped += queueCount_;
+			stats_.queuedFrames = 0;
+			queueCount_ = 0;
+
+			for (int i = 0; i < maxQueueLength_; ++i)
+			{
+				frames_[i].pixels.reset();
+				frames_[i].size = 0;
+				frames_[i].boxCount = 0;
+			}
+		}
+
+		void queueFrame(const void* pixels, bool floatingPoint, const Rectangle dirtyBoxes[], int dirtyBoxCount)
+		{
+			const int w = width();
+			const int h = height();
+			const int pixelSize = floatingPoint ? sizeof(FloatingPointPixel) : sizeof(TrueColorPixel);
+
+			int boxCount = 0;
+			for (int i = 0; i < dirtyBoxCount; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (clipRectangle(box, w, h))
+					++boxCount;
+			}
+			if (boxCount == 0)
+				return;
+
+			const double updateTime = presentClock();
+
+			::pthread_mutex_lock(&queueMutex_);
+
+			Frame* frame;
+			bool stalled = false;
+			while (true)
+			{
+				if (queueCount_ + (presenting_ ? 1 : 0) < queueLength_)
+				{
+					frame = &frames_[(queueHead_ + queueCount_) % queueLength_];
+					frame->boxCount = 0;
+					break;
+				}
+
+				if (presentation_ == Presentation::Asynchronous && queueCount_ > 0)
+				{
+					// take back the newest waiting frame. it keeps its boxes, they are presented with the new pixels
+					--queueCount_;
+					++stats_.framesDropped;
+					frame = &frames_[(queueHead_ + queueCount_) % queueLength_];
+					break;
+				}
+
+				stalled = true;
+				::pthread_cond_wait(&frameDone_, &queueMutex_);
+			}
+
+			if (stalled)
+			{
+				++stats_.stalls;
+				stats_.stallTime += presentClock() - updateTime;
+			}
+
+			::pthread_mutex_unlock(&queueMutex_);
+
+			// the frame is ours until it is queued, so copy without holding the lock
+
+			for (int i = 0; i < dirtyBoxCount; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (!clipRectangle(box, w, h))
+					continue;
+
+				if (frame->boxCount == maxFrameBoxes_)
+				{
+					// too many boxes to keep track of, present their bounds instead
+					for (int j = 1; j < frame->boxCount; ++j)
+						mergeRectangle(frame->boxes[0], frame->boxes[j]);
+					frame->boxCount = 1;
+				}
+				frame->boxes[frame->boxCount++] = box;
+			}
+
+			const size_t size = size_t(w) * h * pixelSize;
+			if (frame->size < size)
+			{
+				frame->pixels.reset(size);
+				frame->size = frame->pixels.isEmpty() ? 0 : size;
+			}
+
+			if (frame->size == 0)
+			{
+				// out of memory, so this frame is lost. repaint everything next time
+				frame->boxCount = 0;
+				fullUpdatePending_ = true;
+				return;
+			}
+
+			for (int i = 0; i < frame->boxCount; ++i)
+				copyRectangle(pixels, frame->pixels.get(), pixelSize, w, frame->boxes[i]);
+			frame->floatingPoint = floatingPoint;
+			frame->queueTime = updateTime;
+
+			::pthread_mutex_lock(&queueMutex_);
+			++queueCount_;
+			++stats_.framesQueued;
+			stats_.queuedFrames = queueCount_;
+			if (queueCount_ > stats_.maxQueuedFrames)
+				stats_.maxQueuedFrames = queueCount_;
+			::pthread_cond_signal(&frameQueued_);
+			::pthread_mutex_unlock(&queueMutex_);
+		}
+
+		static void* presenterThread(void* self)
+		{
+			static_cast<UnixDisplay*>(self)->presentFrames();
+			return 0;
+		}
+
+		void presentFrames()
+		{
+			::pthread_mutex_lock(&queueMutex_);
+
+			while (true)
+			{
+				while (queueCount_ == 0 && !presenterQuit_)
+					::pthread_cond_wait(&frameQueued_, &queueMutex_);
+
+				if (presenterQuit_)
+					break;
+
+				Frame& frame = frames_[queueHead_];
+				queueHead_ = (queueHead_ + 1) % queueLength_;
+				--queueCount_;
+				stats_.queuedFrames = queueCount_;
+				presenting_ = true;
+
+				::pthread_mutex_unlock(&queueMutex_);
+
+				if (!frame.floatingPoint && !shm_ && destFormat_ == Format::XRGB8888)
+				{
+					// shortcut: the frame is in the window's format already
+					putImage(frame.pixels.get(), frame.boxes, frame.boxCount);
+				}
+				else
+				{
+					char* const destination = shm_ ? image_->data : buffer_.get();
+					if (frame.floatingPoint)
+						convertBoxes(floatingPointConverter_, frame.pixels.get(), sizeof(FloatingPointPixel), destination, frame.boxes, frame.boxCount);
+					else
+						convertBoxes(trueColorConverter_, frame.pixels.get(), sizeof(TrueColorPixel), destination, frame.boxes, frame.boxCount);
+					putImage(destination, frame.boxes, frame.boxCount);
+				}
+
+				const double latency = presentClock() - frame.queueTime;
+
+				::pthread_mutex_lock(&queueMutex_);
+
+				presenting_ = false;
+				++stats_.framesPresented;
+				stats_.lastLatency = latency;
+				totalLatency_ += latency;
+				stats_.averageLatency = totalLatency_ / stats_.framesPresented;
+				if (latency > stats_.maxLatency)
+					stats_.maxLatency = latency;
+				::pthread_cond_signal(&frameDone_);
+			}
+
+			::pthread_mutex_unlock(&queueMutex_);
+		}
+
+		static double presentClock()
+		{
+			timespec now;
+			::clock_gettime(CLOCK_MONOTONIC, &now);
+			return now.tv_sec + now.tv_nsec * 1e-9;
+		}
+
+	#ifndef PIXELTOASTER_NO_SHM
+
+		bool openShm(::Visual* visual, int displayDepth, int width, int height, int bytesPerPixel)
+		{
+			if (getenv("PIXELTOASTER_NO_SHM") || !::XShmQueryExtension(imageDisplay_))
+				return false;
+
+			image_ = ::XShmCreateImage(imageDisplay_, visual, displayDepth, ZPixmap, 0, &shmInfo_, width, height);
+			if (!image_)
+				return false;
+
+			// the rest of the library assumes tightly packed rows
+			if (image_->bytes_per_line != width * bytesPerPixel)
+			{
+				XDestroyImage(image_);
+				image_ = 0;
+				return false;
+			}
+
+			shmInfo_.shmid = ::shmget(IPC_PRIVATE, image_->bytes_per_line * image_->height, IPC_CREAT | 0600);
+			if (shmInfo_.shmid == -1)
+			{
+				XDestroyImage(image_);
+				image_ = 0;
+				return false;
+			}
+
+			shmInfo_.shmaddr = image_->data = (char*) ::shmat(shmInfo_.shmid, 0, 0);
+			shmInfo_.readOnly = False;
+
+			// attaching fails asynchronously (eg. for a remote server), so sync up and catch the error
+			bool attached = false;
+			if (shmInfo_.shmaddr != (char*) -1)
+			{
+				shmError_ = false;
+				XErrorHandler previousHandler = ::XSetErrorHandler(shmErrorHandler);
+				attached = ::XShmAttach(imageDisplay_, &shmInfo_) && (::XSync(imageDisplay_, False), !shmError_);
+				::XSetErrorHandler(previousHandler);
+			}
+
+			// the segment goes away by itself once both we and the server have detached
+			::shmctl(shmInfo_.shmid, IPC_RMID, 0);
+
+			if (!attached)
+			{
+				if (shmInfo_.shmaddr != (char*) -1)
+					::shmdt(shmInfo_.shmaddr);
+				shmInfo_.shmaddr = 0;
+				shmInfo_.shmid = -1;
+				image_->data = NULL;
+				XDestroyImage(image_);
+				image_ = 0;
+				return false;
+			}
+
+			shmCompletionType_ = ::XShmGetEventBase(imageDisplay_) + ShmCompletion;
+			shm_ = true;
+			return true;
+		}
+
+		void closeShm()
+		{
+			if (!shm_)
+				return;
+
+			::XShmDetach(imageDisplay_, &shmInfo_);
+			::XSync(imageDisplay_, False);
+			::shmdt(shmInfo_.shmaddr);
+			shmInfo_.shmaddr = 0;
+			shmInfo_.shmid = -1;
+			if (image_)
+				image_->data = NULL;
+			shm_ = false;
+			shmPending_ = false;
+		}
+
+		void presentShm(const Rectangle dirtyBoxes[], int dirtyBoxCount)
+		{
+			const int w = width();
+			const int h = height();
+
+			int last = -1;
+			for (int i = 0; i < dirtyBoxCount; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (clipRectangle(box, w, h))
+					last = i;
+			}
+			if (last < 0)
+				return;
+
+			// ask for a completion event on the last put only. requests are handled in order,
+			// so when it arrives the server is done reading every box.
+
+			for (int i = 0; i <= last; ++i)
+			{
+				Rectangle box = dirtyBoxes[i];
+				if (clipRectangle(box, w, h))
+					::XShmPutImage(imageDisplay_, window_, gc_, image_, box.xBegin, box.yBegin, box.xBegin, box.yBegin,
+						box.xEnd - box.xBegin, box.yEnd - box.yBegin, i == last ? True : False);
+			}
+			shmPending_ = true;
+			flush(imageDisplay_);
+
+			// the caller is free to draw into the image as soon as we return, so wait for the server.
+			// a batch of updates waits in UnixConnection::endUpdates instead, after its one flush.
+
+			if (imageDisplay_ != display_ || !UnixConnection::batching())
+				waitForShm();
+		}
+
+		// the completion event may have been read already and handed to us by the shared connection (see receive)
+
+		void waitForShm()
+		{
+			if (!shmPending_)
+				return;
+
+			::XEvent event;
+			::XIfEvent(imageDisplay_, &event, isShmCompletion, (XPointer) this);
+			shmPending_ = false;
+		}
+
+		static int shmErrorHandler(::Display*, ::XErrorEvent*)
+		{
+			shmError_ = true;
+			return 0;
+		}
+
+		static Bool isShmCompletion(::Display*, ::XEvent* event, XPointer arg)
+		{
+			const UnixDisplay* self = (const UnixDisplay*) arg;
+			return event->type == self->shmCompletionType_ &&
+				((::XShmCompletionEvent*) event)->drawable == self->window_;
+		}
+
+	#else
+
+		bool openShm(::Visual*, int, int, int, int) { return false; }
+		void closeShm() {}
+		void presentShm(const Rectangle[], int) {}
+		void waitForShm() {}
+
+	#endif
+
+		// threaded input: the input thread reads keyboard and mouse events from an X connection of its
+		// own, and sends them to the listener as soon as they arrive. the window's connection keeps
+		// the events that update has to see (expose and the close request). only one client may
+		// select button presses on a window, so the window's connection lets go of the input events
+		// before the input connection selects them, and takes them back once it is closed.
+		// falls back to synchronous input if the thread can't be started.
+
+		void startInput()
+		{
+			if (input_ != Input::Threaded || !display_ || !window_)
+				return;
+
+			::XSync(display_, False);
+			inputDisplay_ = ::XOpenDisplay(::XDisplayString(display_));
+			if (!inputDisplay_ || ::pipe(inputWake_) != 0)
+			{
+				stopInput();
+				return;
+			}
+
+			// without detectable auto repeat, held keys send release and press pairs, see isAutoRepeat
+			Bool detectable = False;
+			::XkbSetDetectableAutoRepeat(inputDisplay_, True, &detectable);
+
+			::XSelectInput(display_, window_, eventMask_ & ~inputMask_);
+			::XSync(display_, False);
+			::XSelectInput(inputDisplay_, window_, inputMask_);
+			::XSync(inputDisplay_, False);
+
+			for (int i = 0; i < keyMapSize_; ++i)
+			{
+				keyIsPressed_[i] = false;
+				keyIsReleased_[i] = false;
+			}
+
+			if (::pthread_create(&inputThread_, 0, inputThread, this) != 0)
+			{
+				stopInput();
+				return;
+			}
+			inputRunning_ = true;
+		}
+
+		void stopInput()
+		{
+			if (inputRunning_)
+			{
+				const char wake = 0;
+				while (::write(inputWake_[1], &wake, 1) < 0 && errno == EINTR) {}
+				::pthread_join(inputThread_, 0);
+				inputRunning_ = false;
+			}
+
+			for (int i = 0; i < 2; ++i)
+			{
+				if (inputWake_[i] >= 0)
+					::close(inputWake_[i]);
+				inputWake_[i] = -1;
+			}
+
+			if (inputDisplay_)
+			{
+				::XCloseDisplay(inputDisplay_);
+				inputDisplay_ = 0;
+				if (display_ && window_)
+					::XSelectInput(display_, window_, eventMask_);
+			}
+
+			// the input thread owned the key states, nothing is known to be held anymore
+			for (int i = 0; i < keyMapSize_; ++i)
+			{
+				keyIsPressed_[i] = false;
+				keyIsReleased_[i] = false;
+			}
+		}
+
+		static void* inputThread(void* self)
+		{
+			static_cast<UnixDisplay*>(self)->readInput();
+			return 0;
+		}
+
+		// wait on both the X connection and the wake pipe, so stopInput never waits for the next event.
+		// events xlib has already read off the socket have to be handled before blocking again.
+
+		void readInput()
+		{
+			::pollfd descriptors[2];
+			descriptors[0].fd = ConnectionNumber(inputDisplay_);
+			descriptors[0].events = POLLIN;
+			descriptors[1].fd = inputWake_[0];
+			descriptors[1].events = POLLIN;
+
+			while (true)
+			{
+				while (::XPending(inputDisplay_))
+				{
+					::XEvent event;
+					::XNextEvent(inputDisplay_, &event);
+					handleInputEvent(event);
+				}
+
+				descriptors[0].revents = 0;
+				descriptors[1].revents = 0;
+				if (::poll(descriptors, 2, -1) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return;
+				}
+
+				if (descriptors[1].revents || (descriptors[0].revents & (POLLERR | POLLHUP)))
+					return;
+			}
+		}
+
+		// called on the input thread. keys are sent as they happen: down and pressed on the first
+		// press, pressed again on every auto repeat, up on the release.
+
+		void handleInputEvent(const ::XEvent& event)
+		{
+			if (event.type != KeyPress && event.type != KeyRelease)
+			{
+				handleEvent(event);
+				return;
+			}
+
+			DisplayInterface& display = wrapper() ? *wrapper() : *(DisplayInterface*)this;
+			const Key key = findKey(event.xkey);
+
+			if (event.type == KeyPress)
+			{
+				if (!keyIsPressed_[key])
+				{
+					keyIsPressed_[key] = true;
+
+					bool defaultKeyHandlers = true;
+					if (listener())
+					{
+						listener()->onKeyDown(display, key);
+						defaultKeyHandlers = listener()->defaultKeyHandlers();
+					}
+					if (defaultKeyHandlers && key == Key::Escape)
+						isShuttingDown_ = true;
+				}
+				if (listener()) listener()->onKeyPressed(display, key);
+			}
+			else if (keyIsPressed_[key] && !isAutoRepeat(event.xkey))
+			{
+				keyIsPressed_[key] = false;
+				if (listener()) listener()->onKeyUp(display, key);
+			}
+		}
+
+		// an auto repeated release is followed by a press of the same key with the same time stamp.
+		// the server sends both together, so the press is already there or arrives with the next read.
+
+		bool isAutoRepeat(const ::XKeyEvent& release)
+		{
+			::XEvent next;
+			if (release.display == display_)
+			{
+				// the shared connection has already passed the window's events on to us
+				if (events_.empty())
+					UnixConnection::read();
+				if (events_.empty())
+					return false;
+				next = events_.front();
+			}
+			else
+			{
+				if (::XEventsQueued(release.display, QueuedAfterReading) == 0)
+					return false;
+				::XPeekEvent(release.display, &next);
+			}
+			return next.type == KeyPress && next.xkey.keycode == release.keycode && next.xkey.time == release.time;
 		}
 
-	private:
+		// called by the shared connection at the end of a batch of updates. the presentation thread waits
+		// for its own puts
 
-		enum 
-		{ 
-			eventMask_ = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ButtonMotionMask,
-			keyMapSize_ = 256
-		};
+		void finishUpdates()
+		{
+			if (imageDisplay_ == display_)
+				waitForShm();
+		}
 
-		typedef DirtyVector<char> TBuffer;
-		typedef Key::Code TKeyMap[keyMapSize_];
-		typedef bool TKeyFlags[keyMapSize_];
+		// called by the shared connection with each event for the window
+
+		void receive(const ::XEvent& event)
+		{
+	#ifndef PIXELTOASTER_NO_SHM
+			if (shm_ && event.type == shmCompletionType_)
+			{
+				shmPending_ = false;
+				return;
+			}
+	#endif
+			events_.push_back(event);
+		}
 
 		void pumpEvents()
 		{
-			::XEvent event;
-			while (true)
-			{		
-				if (::XCheckWindowEvent(display_, window_, -1, &event))
-				{
-					handleEvent(event);
-				}
-				else if (::XCheckTypedEvent(display_, ClientMessage, &event))
-				{
-					handleEvent(event);
-				}
-				else
-				{
-					break;
-				}
+			UnixConnection::read();
+			while (!events_.empty())
+			{
+				// handling an event may read more of them
+				const ::XEvent event = events_.front();
+				events_.pop_front();
+				handleEvent(event);
 			}
+
+			// the input thread sends its own key events
+			if (inputRunning_)
+				return;
 		
 			// send key press and up events
 		
@@ -342,6 +1362,24 @@ namespace PixelToaster
 			}		
 		}
 
+		// the key sym is looked up on the connection the event came from
+
+		static Key findKey(const ::XKeyEvent& event)
+		{
+			const KeySym keySym = ::XKeycodeToKeysym(event.display, event.keycode, 0);
+			const int hiSym = (keySym & 0xff00) >> 8;
+			const int loSym = keySym & 0xff;
+
+			switch (hiSym)
+			{
+				case 0x00:
+					return normalKeys_[loSym];
+				case 0xff:
+					return functionKeys_[loSym];
+			}
+			return Key::Undefined;
+		}
+
 		void handleEvent(const ::XEvent& event)
 		{
 			switch (event.type)
@@ -349,20 +1387,7 @@ namespace PixelToaster
 				case KeyPress:
 				case KeyRelease:
 				{
-					const KeySym keySym = ::XKeycodeToKeysym(display_, event.xkey.keycode, 0);
-					const int hiSym = (keySym & 0xff00) >> 8;
-					const int loSym = keySym & 0xff;
-
-					Key key = Key::Undefined;
-					switch (hiSym)
-					{
-						case 0x00:
-							key = normalKeys_[loSym];
-							break;
-						case 0xff:
-							key = functionKeys_[loSym];
-							break;
-					}
+					const Key key = findKey(event.xkey);
 
 					if (event.type == KeyPress)
 					{
@@ -422,6 +1447,40 @@ namespace PixelToaster
 					if (listener()) listener()->onMouseMove(wrapper() ? *wrapper() : *(DisplayInterface*)this,mouse);
 					break;
 				}
+				case Expose:
+				{
+					// there's no backing store, so the next update has to redraw everything
+					fullUpdatePending_ = true;
+					break;
+				}
+				case MapNotify:
+				case UnmapNotify:
+				{
+					mapped_ = event.type == MapNotify;
+					visibilityChanged();
+					break;
+				}
+				case VisibilityNotify:
+				{
+					obscured_ = event.xvisibility.state == VisibilityFullyObscured;
+					visibilityChanged();
+					break;
+				}
+				case FocusIn:
+				case FocusOut:
+				{
+					// focus moving to a grab (a window manager menu, say) and back is not a change of the active window
+					if (event.xfocus.mode == NotifyGrab || event.xfocus.mode == NotifyUngrab)
+						break;
+
+					const bool active = event.type == FocusIn;
+					if (active != active_)
+					{
+						active_ = active;
+						if (listener()) listener()->onActivate(wrapper() ? *wrapper() : *(DisplayInterface*)this, active);
+					}
+					break;
+				}
 				case ClientMessage:
 				{
 					if (event.xclient.message_type == wmProtocols_ && 
@@ -443,14 +1502,24 @@ namespace PixelToaster
 			}
 		}
 
+		// the window is visible while it is mapped and not fully covered by other windows
+
+		void visibilityChanged()
+		{
+			const bool visible = mapped_ && !obscured_;
+			if (visible == visible_)
+				return;
+
+			visible_ = visible;
+			if (listener()) listener()->onVisible(wrapper() ? *wrapper() : *(DisplayInterface*)this, visible);
+		}
+
 		static bool initializeKeyMaps()
 		{
 			for (int i = 0; i < keyMapSize_; ++i)
 			{
 				normalKeys_[i] = Key::Undefined;
 				functionKeys_[i] = Key::Undefined;
-				keyIsPressed_[i] = false;
-				keyIsReleased_[i] = false;
 			}
 		
 			normalKeys_[XK_space] = Key::Space;
@@ -597,29 +1666,115 @@ namespace PixelToaster
 		}
 
 		::Display* display_;
+		::Display* presentDisplay_;		// connection of the presentation thread
+		::Display* imageDisplay_;		// connection the image belongs to: one of the above
 		::Window window_;
 		::GC gc_;
 		::XImage* image_;
 		TBuffer buffer_;
 		Converter* trueColorConverter_;
 		Converter* floatingPointConverter_;
-		bool isShuttingDown_;
+		std::atomic<bool> isShuttingDown_;	// also set by the input thread
+		bool fullUpdatePending_;
+		bool mapped_;
+		bool obscured_;
+		bool visible_;
+		bool active_;
+
+		int bytesPerPixel_;
 		Format destFormat_;
+
 		Atom wmProtocols_;
 		Atom wmDeleteWindow_;
+		bool shm_;
+		bool shmPending_;				// a shared memory put hasn't completed yet
+		std::deque< ::XEvent > events_;	// events for the window, from the shared connection
+
+		Presentation presentation_;
+		int queueLength_;
+		Frame frames_[maxQueueLength_];
+		int queueHead_;
+		int queueCount_;
+		bool presenting_;
+		bool presenterQuit_;
+		bool presenterRunning_;
+		pthread_t presenter_;
+		mutable pthread_mutex_t queueMutex_;
+		pthread_cond_t frameQueued_;
+		pthread_cond_t frameDone_;
+		PresentStatistics stats_;
+		double totalLatency_;
+
+		Input input_;
+		::Display* inputDisplay_;		// connection of the input thread
+		int inputWake_[2];				// pipe to wake the input thread when it has to stop
+		bool inputRunning_;
+		pthread_t inputThread_;
+
+	#ifndef PIXELTOASTER_NO_SHM
+		::XShmSegmentInfo shmInfo_;
+		int shmCompletionType_;
+		static bool shmError_;
+	#endif
 	
 		static TKeyMap normalKeys_;
 		static TKeyMap functionKeys_;
-		static TKeyFlags keyIsPressed_;
-		static TKeyFlags keyIsReleased_;
 		static bool keyMapsInitialized_;
+		// key state of this display, written by the input thread while it runs
+		TKeyFlags keyIsPressed_;
+		TKeyFlags keyIsReleased_;
+
+		friend class UnixConnection;
 	};
 
 	UnixDisplay::TKeyMap UnixDisplay::normalKeys_;
 	UnixDisplay::TKeyMap UnixDisplay::functionKeys_;
-	UnixDisplay::TKeyFlags UnixDisplay::keyIsPressed_;
-	UnixDisplay::TKeyFlags UnixDisplay::keyIsReleased_;
 	bool UnixDisplay::keyMapsInitialized_ = UnixDisplay::initializeKeyMaps();
+	#ifndef PIXELTOASTER_NO_SHM
+	bool UnixDisplay::shmError_ = false;
+	#endif
+
+	void UnixConnection::read()
+	{
+		if (!display_)
+			return;
+
+		// QueuedAfterReading reads what has arrived without flushing, and XNextEvent doesn't flush while
+		// there are events queued
+
+		while (::XEventsQueued(display_, QueuedAfterReading) > 0)
+		{
+			::XEvent event;
+			::XNextEvent(display_, &event);
+			for (size_t i = 0; i < owners_.size(); ++i)
+			{
+				if (owners_[i].window == event.xany.window)
+				{
+					owners_[i].display->receive(event);
+					break;
+				}
+			}
+		}
+	}
+
+	void UnixConnection::endUpdates()
+	{
+		batching_ = false;
+		if (!display_ || !flushPending_)
+			return;
+
+		::XFlush(display_);
+		flushPending_ = false;
+
+		for (size_t i = 0; i < owners_.size(); ++i)
+			owners_[i].display->finishUpdates();
+	}
+
+	::Display* UnixConnection::display_ = 0;
+	int UnixConnection::references_ = 0;
+	std::vector<UnixConnection::Owner> UnixConnection::owners_;
+	bool UnixConnection::batching_ = false;
+	bool UnixConnection::flushPending_ = false;
 }
 
 // unix timer implementation
@@ -630,10 +1785,30 @@ namespace PixelToaster
 #include <errno.h>
 #include <math.h>
 
-//#define PIXELTOASTER_RDTSC
+// the timer reads the time stamp counter when the cpu says it is invariant (constant rate, keeps
+// counting in deep sleep states) and the kernel trusts it as its own clock source. it is calibrated
+// against CLOCK_MONOTONIC_RAW at startup and again every second. otherwise, or with
+// PIXELTOASTER_NO_RDTSC defined, the timer uses CLOCK_MONOTONIC, which the vdso serves without a system call.
+
+#if !defined(PIXELTOASTER_NO_RDTSC) && defined(__GNUC__) && ( defined(__i386__) || defined(__x86_64__) )
+#define PIXELTOASTER_RDTSC
+#endif
+
 #ifdef PIXELTOASTER_RDTSC
 #	include <stdint.h>
 #	include <stdio.h>
+#	include <string.h>
+#	include <cpuid.h>
+#endif
+
+#ifdef __linux__
+#	include <sys/prctl.h>
+#endif
+
+#ifdef CLOCK_MONOTONIC_RAW
+#	define PIXELTOASTER_CALIBRATION_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#	define PIXELTOASTER_CALIBRATION_CLOCK CLOCK_MONOTONIC
 #endif
 
 namespace PixelToaster
@@ -670,115 +1845,304 @@ namespace PixelToaster
 				}
 			}
 		}
-	}
-
-	#ifdef PIXELTOASTER_RDTSC
 
-	class UnixTimer : public TimerInterface
-	{
-	public:
-	
-		UnixTimer():
-			resolution_(determineResolution())
-		{
-			reset();
-		}
-	
-		void reset()
-		{
-			deltaStart_ = start_ = tick();
-		}
-	
-		double time()
-		{
-			const uint64_t now = tick();
-			return resolution_ * (now - start_);
-		}
-	
-		double delta()
-		{
-			const uint64_t now = tick();
-			const double dt = resolution_ * (now - deltaStart_);
-			deltaStart_ = now;
-			return dt;
-		}
-	
-		double resolution()
+		inline double clockSeconds(clockid_t clock)
 		{
-			return resolution_;
+			timespec time;
+			if (clock_gettime(clock, &time) != 0)
+			{
+				return 0.;
+			}
+			return time.tv_sec + time.tv_nsec * 1e-9;
 		}
-	
-		void wait( double seconds )
-		{
-			internal::wait(seconds);
-		}	
-	
-	private:
 
-		static inline uint64_t tick()
+		// sleep until the margin before the deadline, then spin the rest.
+		// sleeping to an absolute time means an interrupted sleep just goes back to sleep without drifting.
+
+		inline void preciseWait(double seconds, WaitMargin& margin)
 		{
-	#ifdef PIXELTOASTER_64BIT
-			uint32_t a, d;
-			__asm__ __volatile__("rdtsc": "=a"(a), "=d"(d));
-			return (static_cast<uint64_t>(d) << 32) | static_cast<uint64_t>(a);
-	#else
-			uint64_t val;
-			__asm__ __volatile__("rdtsc": "=A"(val));
-			return val;
+	#ifdef PR_SET_TIMERSLACK
+			// linux adds 50us of slack to every sleep by default. the setting is per thread, so do it once in each
+			static __thread bool slack = false;
+			if (!slack)
+			{
+				prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+				slack = true;
+			}
 	#endif
+
+			const double start = clockSeconds(CLOCK_MONOTONIC);
+			const double deadline = start + seconds;
+			const double wake = deadline - margin.margin();
+
+			if (wake > start)
+			{
+				const double floorWake = ::floor(wake);
+				timespec wakeTime;
+				wakeTime.tv_sec = static_cast<time_t>(floorWake);
+				wakeTime.tv_nsec = static_cast<long>((wake - floorWake) * 1e9);
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, 0) == EINTR)
+				{
+				}
+				margin.oversleep(clockSeconds(CLOCK_MONOTONIC) - wake);
+			}
+
+			while (clockSeconds(CLOCK_MONOTONIC) < deadline)
+			{
+				spinPause();
+			}
 		}
-	
-		static double determineResolution()
+
+		// seconds since the first timer was created, shared by all timers.
+
+		class Clock
 		{
-			FILE* f = fopen("/proc/cpuinfo", "r");
-			if (!f)
+		public:
+
+			static Clock& instance()
 			{
-				return 0.;
+				static Clock clock;
+				return clock;
+			}
+
+			// the time stamp counter path counts from the first calibration reading instead of origin_,
+			// which is the same time line as far as a timer can tell.
+			double now()
+			{
+	#ifdef PIXELTOASTER_RDTSC
+				if (tsc_)
+				{
+					const uint64_t ticks = tick();
+
+					// seqlock: retry if a calibration was published while reading
+					unsigned int sequence;
+					double seconds;
+					uint64_t nextCalibration;
+					do
+					{
+						sequence = __atomic_load_n(&sequence_, __ATOMIC_ACQUIRE);
+						seconds = baseSeconds_ + static_cast<int64_t>(ticks - baseTicks_) * secondsPerTick_;
+						nextCalibration = nextCalibration_;
+						__atomic_thread_fence(__ATOMIC_ACQUIRE);
+					}
+					while ((sequence & 1) || sequence != __atomic_load_n(&sequence_, __ATOMIC_RELAXED));
+
+					if (ticks >= nextCalibration)
+					{
+						calibrate();
+					}
+					return seconds;
+				}
+	#endif
+				return clockSeconds(CLOCK_MONOTONIC) - origin_;
+			}
+
+			double resolution() const
+			{
+	#ifdef PIXELTOASTER_RDTSC
+				if (tsc_)
+				{
+					return secondsPerTick_;
+				}
+	#endif
+				timespec res;
+				if (clock_getres(CLOCK_MONOTONIC, &res) != 0)
+				{
+					return 0.;
+				}
+				return res.tv_sec + res.tv_nsec * 1e-9;
+			}
+
+		private:
+
+			Clock()
+			{
+				origin_ = clockSeconds(CLOCK_MONOTONIC);
+
+	#ifdef PIXELTOASTER_RDTSC
+				tsc_ = invariantTsc();
+				if (!tsc_)
+				{
+					return;
+				}
+
+				// first estimate of the rate over a few milliseconds, refined by every later calibration
+				readPair(originTicks_, originSeconds_);
+				uint64_t ticks;
+				double seconds;
+				do
+				{
+					readPair(ticks, seconds);
+				}
+				while (seconds - originSeconds_ < initialCalibration);
+
+				sequence_ = 0;
+				calibrating_ = 0;
+				secondsPerTick_ = (seconds - originSeconds_) / static_cast<double>(ticks - originTicks_);
+				baseTicks_ = ticks;
+				baseSeconds_ = seconds - originSeconds_;
+				periodTicks_ = static_cast<uint64_t>(calibrationPeriod / secondsPerTick_);
+				nextCalibration_ = ticks + periodTicks_;
+	#endif
+			}
+
+	#ifdef PIXELTOASTER_RDTSC
+
+			static inline uint64_t tick()
+			{
+		#ifdef PIXELTOASTER_64BIT
+				uint32_t a, d;
+				__asm__ __volatile__("rdtsc": "=a"(a), "=d"(d));
+				return (static_cast<uint64_t>(d) << 32) | static_cast<uint64_t>(a);
+		#else
+				uint64_t val;
+				__asm__ __volatile__("rdtsc": "=A"(val));
+				return val;
+		#endif
 			}
-			const int bufferSize = 256;
-			char buffer[bufferSize];
-			while (fgets(buffer, bufferSize, f))
+
+			static bool invariantTsc()
 			{
-				float frequency;
-				if (sscanf(buffer, "cpu MHz         : %f", &frequency) == 1)
+				unsigned int a, b, c, d;
+				if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+				{
+					return false;
+				}
+				__get_cpuid(0x80000007, &a, &b, &c, &d);
+				if (!(d & (1 << 8)))
+				{
+					return false;
+				}
+
+				// the kernel stops using the tsc when it finds it unsynchronized between cores
+				FILE* f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+				if (f)
 				{
+					char source[32] = "";
+					const bool ok = fgets(source, sizeof(source), f) && strncmp(source, "tsc", 3) == 0;
 					fclose(f);
-					return 1e-6 / static_cast<double>(frequency);
+					return ok;
 				}
+				return true;
 			}
-			fclose(f);
-			return 0.;
-		}
 
-		uint64_t start_;
-		uint64_t deltaStart_;
-		double resolution_;
-	};
+			// a tsc reading and a calibration clock reading taken as close together as we can manage
+			static void readPair(uint64_t& ticks, double& seconds)
+			{
+				ticks = 0;
+				seconds = 0;
+				uint64_t bestGap = ~static_cast<uint64_t>(0);
+				for (int i = 0; i < 5; ++i)
+				{
+					const uint64_t before = tick();
+					const double now = clockSeconds(PIXELTOASTER_CALIBRATION_CLOCK);
+					const uint64_t after = tick();
+					if (after - before < bestGap)
+					{
+						bestGap = after - before;
+						ticks = before + (after - before) / 2;
+						seconds = now;
+					}
+				}
+			}
 
-	#else
+			// measure the rate over everything since the clock was created, then publish a mapping that
+			// continues from the current time and steers towards the calibration clock over the next period,
+			// so the time never jumps.
+			void calibrate()
+			{
+				if (!__sync_bool_compare_and_swap(&calibrating_, 0, 1))
+				{
+					return;
+				}
+
+				uint64_t ticks;
+				double seconds;
+				readPair(ticks, seconds);
+
+				const double rate = (seconds - originSeconds_) / static_cast<double>(ticks - originTicks_);
+				const double current = baseSeconds_ + static_cast<int64_t>(ticks - baseTicks_) * secondsPerTick_;
+				const double reference = seconds - originSeconds_;
+
+				// far off means the machine was suspended or the like: catch up at once, but never go back
+				double base = current;
+				double correction = (reference - current) / static_cast<double>(periodTicks_);
+				if (reference - current > maxDrift)
+				{
+					base = reference;
+					correction = 0;
+				}
+				if (correction < -0.5 * rate)
+				{
+					correction = -0.5 * rate;
+				}
+
+				__atomic_store_n(&sequence_, sequence_ + 1, __ATOMIC_RELAXED);
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+				baseTicks_ = ticks;
+				baseSeconds_ = base;
+				secondsPerTick_ = rate + correction;
+				nextCalibration_ = ticks + periodTicks_;
+				__atomic_store_n(&sequence_, sequence_ + 1, __ATOMIC_RELEASE);
+
+				__sync_lock_release(&calibrating_);
+			}
+
+	#endif
+
+			double origin_;							// CLOCK_MONOTONIC at creation
+
+	#ifdef PIXELTOASTER_RDTSC
+
+			static const double initialCalibration;	// seconds to measure the rate over at startup
+			static const double calibrationPeriod;	// seconds between calibrations
+			static const double maxDrift;			// seconds off the calibration clock before we jump instead of steer
+
+			bool tsc_;
+			uint64_t originTicks_;				// first calibration pair
+			double originSeconds_;
+			uint64_t periodTicks_;
+
+			unsigned int sequence_;				// odd while a calibration is being published
+			int calibrating_;
+			uint64_t baseTicks_;				// time = baseSeconds_ + (tsc - baseTicks_) * secondsPerTick_
+			double baseSeconds_;
+			double secondsPerTick_;
+			uint64_t nextCalibration_;
+
+	#endif
+		};
+
+	#ifdef PIXELTOASTER_RDTSC
+		const double Clock::initialCalibration = 0.002;
+		const double Clock::calibrationPeriod = 1.0;
+		const double Clock::maxDrift = 0.001;
+	#endif
+	}
 
 	class UnixTimer : public TimerInterface
 	{
 	public:
 	
-		UnixTimer()
+		UnixTimer():
+			margin_(0.0005, 0.00001, 0.005)
 		{
 			reset();
 		}
 	
 		void reset()
 		{
-			deltaStart_ = start_ = realTime();
+			deltaStart_ = start_ = internal::Clock::instance().now();
 		}
 	
 		double time()
 		{
-			return realTime() - start_;
+			return internal::Clock::instance().now() - start_;
 		}
 	
 		double delta()
 		{
-			const double now = realTime();
+			const double now = internal::Clock::instance().now();
 			const double dt = now - deltaStart_;
 			deltaStart_ = now;
 			return dt;
@@ -786,36 +2150,27 @@ namespace PixelToaster
 	
 		double resolution()
 		{
-			timespec res;
-			if (clock_getres(CLOCK_REALTIME, &res) != 0)
-			{
-				return 0.;
-			}
-			return res.tv_sec + res.tv_nsec * 1e-9;
-		}
-	
-		void wait( double seconds )
-		{
-			internal::wait(seconds);
+			return internal::Clock::instance().resolution();
 		}
 	
-	private:
-
-		static inline double realTime()
+		void wait( double seconds, bool precise )
 		{
-			timespec time;
-			if (clock_gettime(CLOCK_REALTIME, &time) != 0)
+			if (precise)
 			{
-				return 0.;
+				internal::preciseWait(seconds, margin_);
+			}
+			else
+			{
+				internal::wait(seconds);
 			}
-			return time.tv_sec + time.tv_nsec * 1e-9;		
 		}
 	
+	private:
+
 		double start_;
 		double deltaStart_;
+		WaitMargin margin_;					// how long before the deadline precise waits start spinning
 	};
 }
 
 #endif
-
-#endif
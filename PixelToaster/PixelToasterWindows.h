@@ -98,6 +98,7 @@ namespace PixelToaster
 			window = NULL;
 			systemMenu = NULL;
 			active = false;
+			visible = true;
 			_listener = NULL;
 			centered = false;
 			zoomLevel = ZOOM_ORIGINAL;
@@ -508,6 +509,12 @@ namespace PixelToaster
 					zoomLevel = ZOOM_RESIZED;
 				case WM_SIZE:
 					updateSystemMenu();
+					if ( uMsg == WM_SIZE && visible != ( wParam != SIZE_MINIMIZED ) )
+					{
+						visible = wParam != SIZE_MINIMIZED;
+						if ( _listener )
+							_listener->onVisible( display->wrapper() ? *display->wrapper() : *display, visible );
+					}
 					break;
 
 				case WM_CLOSE:
@@ -836,6 +843,7 @@ namespace PixelToaster
 		int width;						// natural window width
 		int height;						// natural window height
 		bool active;					// true if window is currently active
+		bool visible;					// false while the window is minimized
 
 		enum Mode
 		{
@@ -913,9 +921,10 @@ namespace PixelToaster
 		}
 
 		/// update the device pixels.
+		/// the listener (may be null) hears about the conversion, on behalf of display.
 		/// @returns true if the update succeeded, false otherwise.
 
-		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle * dirtyBox )
+		bool update( const TrueColorPixel * trueColorPixels, const FloatingPointPixel * floatingPointPixels, const Rectangle * dirtyBox, Listener * listener, DisplayInterface & display )
 		{
 			// handle device loss
 
@@ -972,6 +981,9 @@ namespace PixelToaster
 
 			if ( converter )
 			{
+				if ( listener )
+					listener->onConvertBegin( display );
+
 				converter->begin();
 
 				const Rectangle box = dirtyBox ? *dirtyBox : Rectangle(0, width, 0, height);
@@ -986,6 +998,9 @@ namespace PixelToaster
 				}
 
 				converter->end();
+
+				if ( listener )
+					listener->onConvertEnd( display, boxWidth * ( box.yEnd - box.yBegin ) );
 			}
 
 			primaryTexture->UnlockRect( 0 );
@@ -1377,7 +1392,7 @@ namespace PixelToaster
 				window->update();
 
 			if ( device )
-				device->update( trueColorPixels, floatingPointPixels, dirtyBox );
+				device->update( trueColorPixels, floatingPointPixels, dirtyBox, DisplayAdapter::listener(), wrapper() ? *wrapper() : *(DisplayInterface*)this );
 
 			if ( window && !window->visible() )
 			{
@@ -1487,6 +1502,11 @@ namespace PixelToaster
 			return true;
 		}
 
+		void * handle() const
+		{
+			return window ? window->handle() : NULL;
+		}
+
 		void toggle()
 		{
 			pendingToggle = true;
@@ -1523,7 +1543,7 @@ namespace PixelToaster
 	{
 	public:
 		
-		WindowsTimer()
+		WindowsTimer() : _margin( 0.002, 0.0005, 0.02 )
 		{
 			QueryPerformanceFrequency( (LARGE_INTEGER*) &_frequency );
 			reset();
@@ -1559,13 +1579,43 @@ namespace PixelToaster
 			return 1.0 / (double) _frequency;
 		}
 		
-		void wait( double seconds )
+		void wait( double seconds, bool precise )
 		{
-			Sleep( int(seconds*1000) );
+			if ( !precise )
+			{
+				Sleep( int(seconds*1000) );
+				return;
+			}
+
+			// sleep in whole milliseconds while that leaves the margin, then spin to the deadline
+
+			__int64 start;
+			QueryPerformanceCounter( (LARGE_INTEGER*) &start );
+			const __int64 deadline = start + __int64( seconds * _frequency );
+
+			const double sleep = seconds - _margin.margin();
+			if ( sleep >= 0.001 )
+			{
+				Sleep( int(sleep*1000) );
+				__int64 counter;
+				QueryPerformanceCounter( (LARGE_INTEGER*) &counter );
+				_margin.oversleep( ( counter - start ) / (double) _frequency - int(sleep*1000) / 1000.0 );
+			}
+
+			while ( true )
+			{
+				__int64 counter;
+				QueryPerformanceCounter( (LARGE_INTEGER*) &counter );
+				if ( counter >= deadline )
+					break;
+				spinPause();
+			}
 		}
 		
 	private:
 
+		WaitMargin _margin;			///< how long before the deadline precise waits start spinning
+
 		double _time;               ///< current time in seconds
 		__int64 _timeCounter;       ///< raw 64bit timer counter for time
 		__int64 _deltaCounter;      ///< raw 64bit timer counter for delta
@@ -1,10 +1,27 @@
-// Profile conversion routines
+// Profile conversion routines and display updates
 // Copyright  2004-2007 Glenn Fiedler
 // Part of the PixelToaster Framebuffer Library - http://www.pixeltoaster.com
 
+// usage: Profile [-quick] [-heap] [-json filename]
+//
+// times the converters across a range of resolutions with warm and cold caches, the thread scaling
+// of the parallel converters, and whole Display::update calls. every measurement is a number of
+// warm-up runs followed by repeated samples, reported as min / median / mean / standard deviation.
+// -json writes all results to a file as well, so they can be compared across builds.
+// -quick takes fewer, shorter samples at fewer resolutions.
+// -heap puts the pixels in plain heap memory, instead of the aligned huge page backed memory of
+// allocatePixels that the displays use, to compare the two. on linux every measurement also counts
+// data tlb load misses, which is where the huge pages should make the difference.
+//
+// the display updates go to a window when there is a window system (run it under Xvfb on a headless
+// machine), otherwise to the offscreen display. set PIXELTOASTER_OFFSCREEN to force offscreen.
+
 #include "PixelToaster.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
 
 using namespace PixelToaster;
 
@@ -25,114 +42,651 @@ const char * getFormatString( Format format )
     }
 }
 
-const float duration = 1.0f;
+const char * getInstructionSetString( InstructionSet instructionSet )
+{
+    switch ( instructionSet )
+    {
+        case InstructionSet::Scalar: 	return "scalar";
+        case InstructionSet::SSE2: 		return "sse2";
+        case InstructionSet::SSSE3: 	return "ssse3";
+        case InstructionSet::AVX2: 		return "avx2";
+        default: 						return "???";
+    }
+}
+
+int getPixelSize( Format format )
+{
+    switch ( format )
+    {
+        case Format::XBGRFFFF:  return 16;
+        case Format::XRGB8888:
+        case Format::XBGR8888:  return 4;
+        case Format::RGB888:
+        case Format::BGR888:    return 3;
+        default:                return 2;
+    }
+}
+
+// time stamp counter, for cycles per pixel. note that it counts reference cycles at the
+// nominal clock rate, which is not quite the core clock when the cpu boosts or throttles.
+
+#if defined(_MSC_VER) && ( defined(_M_IX86) || defined(_M_X64) )
+#include <intrin.h>
+#define PROFILE_CYCLES
+inline unsigned long long cycles() { return __rdtsc(); }
+#elif defined(__GNUC__) && ( defined(__i386__) || defined(__x86_64__) )
+#include <x86intrin.h>
+#define PROFILE_CYCLES
+inline unsigned long long cycles() { return __rdtsc(); }
+#else
+inline unsigned long long cycles() { return 0; }
+#endif
+
+// data tlb load misses, through the kernel's performance counters. only on linux, and only where the
+// kernel lets a process count its own events. misses on the parallel converters' worker threads
+// aren't counted, only the calling thread's.
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+int tlbCounter = -1;
+void openTlbCounter()
+{
+    perf_event_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    tlbCounter = (int) syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+bool hasTlbCounter() { return tlbCounter >= 0; }
+unsigned long long tlbMisses()
+{
+    unsigned long long value = 0;
+    if ( tlbCounter >= 0 && read( tlbCounter, &value, sizeof(value) ) != sizeof(value) )
+        value = 0;
+    return value;
+}
+#else
+void openTlbCounter() {}
+bool hasTlbCounter() { return false; }
+inline unsigned long long tlbMisses() { return 0; }
+#endif
 
 Timer timer;
 
-void profilePixelConverter( Format format, const Pixel * source, void * destination, int count )
+// how hard to try for each measurement
+
+struct Settings
 {
-    printf( "   floating point -> %s", getFormatString(format) );
+    int warmups;                ///< untimed runs before sampling
+    int samples;                ///< timed samples per measurement
+    double sampleTime;          ///< minimum length of a warm sample in seconds, short operations are repeated to fill it
+};
+
+Settings settings = { 3, 15, 0.01 };
+
+// large enough to push everything else out of the last level cache
+
+const int evictionSize = 64 * 1024 * 1024;
+vector<integer8> evictionBuffer;
+
+void evictCaches()
+{
+    if ( evictionBuffer.empty() )
+        evictionBuffer.resize( evictionSize );
+
+    for ( int i = 0; i < evictionSize; i += 64 )
+        evictionBuffer[i]++;
+}
+
+// something to benchmark. run is timed, prepare is not.
+
+class Operation
+{
+public:
+    virtual ~Operation() {}
+    virtual void prepare() {}
+    virtual void run() = 0;
+};
+
+struct Measurement
+{
+    int samples;
+    double minimum;             ///< seconds per run
+    double median;
+    double mean;
+    double deviation;           ///< standard deviation of the samples
+    double cyclesPerItem;       ///< median, zero without a cycle counter
+    double tlbMisses;           ///< median data tlb load misses per run, -1 without the counter
+};
+
+// a warm sample repeats the operation until it has run for settings.sampleTime and takes the average.
+// a cold sample evicts the caches first and times a single run. a run goes through items (pixels, calls)
+// for the cycles per item.
+
+Measurement measure( Operation & operation, int items, bool cold )
+{
+    for ( int i = 0; i < settings.warmups; ++i )
+    {
+        operation.prepare();
+        operation.run();
+    }
+
+    vector<double> times( settings.samples );
+    vector<double> cyclesPerItem( settings.samples );
+    vector<double> tlbMissesPerRun( settings.samples );
+
+    for ( int sample = 0; sample < settings.samples; ++sample )
+    {
+        int iterations = 0;
+        double time = 0.0;
+        unsigned long long sampleCycles = 0;
+        unsigned long long sampleTlbMisses = 0;
+
+        do
+        {
+            if ( cold )
+                evictCaches();
+
+            operation.prepare();
+
+            const double start = timer.time();
+            const unsigned long long startCycles = cycles();
+            const unsigned long long startTlbMisses = tlbMisses();
+            operation.run();
+            sampleTlbMisses += tlbMisses() - startTlbMisses;
+            sampleCycles += cycles() - startCycles;
+            time += timer.time() - start;
+            iterations++;
+        }
+        while ( !cold && time < settings.sampleTime );
+
+        times[sample] = time / iterations;
+        cyclesPerItem[sample] = (double) sampleCycles / iterations / items;
+        tlbMissesPerRun[sample] = (double) sampleTlbMisses / iterations;
+    }
+
+    Measurement measurement;
+    measurement.samples = settings.samples;
+
+    double sum = 0.0;
+    for ( int i = 0; i < settings.samples; ++i )
+        sum += times[i];
+    measurement.mean = sum / settings.samples;
+
+    double squares = 0.0;
+    for ( int i = 0; i < settings.samples; ++i )
+        squares += ( times[i] - measurement.mean ) * ( times[i] - measurement.mean );
+    measurement.deviation = settings.samples > 1 ? sqrt( squares / ( settings.samples - 1 ) ) : 0.0;
+
+    std::sort( times.begin(), times.end() );
+    std::sort( cyclesPerItem.begin(), cyclesPerItem.end() );
+    std::sort( tlbMissesPerRun.begin(), tlbMissesPerRun.end() );
+    measurement.minimum = times[0];
+    measurement.median = times[settings.samples / 2];
+    measurement.cyclesPerItem = cyclesPerItem[settings.samples / 2];
+    measurement.tlbMisses = hasTlbCounter() ? tlbMissesPerRun[settings.samples / 2] : -1.0;
+
+    return measurement;
+}
+
+// every measurement is kept for the json output
+
+struct Result
+{
+    const char * benchmark;     ///< "convert", "update", "timer" or "wait"
+    const char * source;        ///< converter source format, or display mode
+    const char * destination;   ///< converter destination format, or display output
+    const char * variant;       ///< instruction set, or update region
+    const char * cache;         ///< "warm" or "cold"
+    const char * item;          ///< what the cycles are counted per, "pixel", "call" or "wait"
+    int threads;
+    int width;
+    int height;
+    Measurement measurement;
+};
+
+vector<Result> results;
+
+void report( const Result & result )
+{
+    const Measurement & m = result.measurement;
+    printf( " = %.3f ms median, %.3f min, %.3f mean, %.3f sd", m.median * 1000, m.minimum * 1000, m.mean * 1000, m.deviation * 1000 );
+#ifdef PROFILE_CYCLES
+    printf( ", %.2f cycles/%s", m.cyclesPerItem, result.item );
+#endif
+    if ( m.tlbMisses >= 0.0 )
+        printf( ", %.0f dtlb misses", m.tlbMisses );
+    printf( "\n" );
+
+    results.push_back( result );
+}
+
+// ----------------------------------------------------------------------------------------
+
+// pixels, from allocatePixels or with -heap from new
+
+bool heapBuffers = false;
+
+template <typename T> class Buffer
+{
+public:
+
+    explicit Buffer( size_t size ) : data( heapBuffers ? new T[size] : static_cast<T*>( allocatePixels( size * sizeof(T) ) ) ) {}
+
+    ~Buffer()
+    {
+        if ( heapBuffers )
+            delete [] data;
+        else
+            freePixels( data );
+    }
+
+    T & operator[]( size_t i ) { return data[i]; }
+    const T & operator[]( size_t i ) const { return data[i]; }
+
+private:
+
+    Buffer( const Buffer & );
+    Buffer & operator = ( const Buffer & );
+
+    T * data;
+};
+
+// source images with a bit of everything in them: out of range floats, all byte values
+
+struct Sources
+{
+    Buffer<Pixel> floatingPoint;
+    Buffer<integer32> trueColor;
+
+    Sources( int pixels ) : floatingPoint( pixels ), trueColor( pixels )
+    {
+        for ( int i = 0; i < pixels; ++i )
+        {
+            floatingPoint[i].r = ( i % 397 ) / 256.0f - 0.25f;
+            floatingPoint[i].g = ( i % 251 ) / 200.0f;
+            floatingPoint[i].b = ( i % 13 ) / 8.0f;
+            floatingPoint[i].a = 0;
+            trueColor[i] = (integer32) i * 2654435761u;
+        }
+    }
+
+    const void * get( Format format ) const
+    {
+        return format == Format::XBGRFFFF ? (const void*) &floatingPoint[0] : (const void*) &trueColor[0];
+    }
+};
+
+class ConvertOperation : public Operation
+{
+public:
+
+    ConvertOperation( Converter * converter, const void * source, void * destination, int pixels )
+        : converter( converter ), source( source ), destination( destination ), pixels( pixels ) {}
+
+    void run()
+    {
+        converter->convert( source, destination, pixels );
+    }
+
+private:
+
+    Converter * converter;
+    const void * source;
+    void * destination;
+    int pixels;
+};
 
-    Converter * converter = requestConverter( Format::XBGRFFFF, format );
+bool profileConverter( Format source, Format destination, InstructionSet instructionSet, int threads,
+    const Sources & sources, void * destinationPixels, int width, int height, bool cold )
+{
+    Converter * converter = requestConverter( source, destination, instructionSet, threads );
 
     if ( !converter )
     {
-        printf( "\n     failed: null converter\n" );
+        printf( "   %s -> %s (%s): failed, null converter\n", getFormatString(source), getFormatString(destination), getInstructionSetString(instructionSet) );
         exit(1);
     }
 
-    double startTime = timer.time();
+    // every thread count past the processor count gives the same converter, skip those
+
+    if ( threads != 1 && converter == requestConverter( source, destination, instructionSet, threads - 1 ) )
+        return false;
+
+    printf( "   %s -> %s (%s", getFormatString(source), getFormatString(destination), getInstructionSetString(instructionSet) );
+    if ( threads != 1 )
+        printf( ", %d threads", threads );
+    printf( ", %dx%d, %s)", width, height, cold ? "cold" : "warm" );
+
+    ConvertOperation operation( converter, sources.get( source ), destinationPixels, width * height );
+
+    Result result;
+    result.benchmark = "convert";
+    result.source = getFormatString( source );
+    result.destination = getFormatString( destination );
+    result.variant = getInstructionSetString( instructionSet );
+    result.cache = cold ? "cold" : "warm";
+    result.item = "pixel";
+    result.threads = threads;
+    result.width = width;
+    result.height = height;
+    result.measurement = measure( operation, width * height, cold );
+    report( result );
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------
+
+class UpdateOperation : public Operation
+{
+public:
+
+    UpdateOperation( Display & display, const Sources & sources, const PixelToaster::Rectangle * box )
+        : display( display ), sources( sources ), box( box ) {}
+
+    void run()
+    {
+        const bool ok = display.mode() == Mode::TrueColor ?
+            display.update( (const TrueColorPixel*) &sources.trueColor[0], box ) :
+            display.update( &sources.floatingPoint[0], box );
+
+        if ( !ok )
+        {
+            printf( "\n     failed: update returned false\n" );
+            exit(1);
+        }
+    }
+
+private:
 
-    double time = 0.0;
+    Display & display;
+    const Sources & sources;
+    const PixelToaster::Rectangle * box;
+};
 
-    int iterations = 0;
+void profileUpdate( Mode mode, const Sources & sources, int width, int height )
+{
+    Display display;
 
-    while ( time < duration )
+    if ( !display.open( "PixelToaster Profile", width, height, Output::Windowed, mode ) &&
+         !display.open( "PixelToaster Profile", width, height, Output::Offscreen, mode ) )
     {
-        converter->convert( source, destination, count );
-        time = timer.time() - startTime;
-        iterations ++;
+        printf( "   failed: could not open a %dx%d display\n", width, height );
+        exit(1);
     }
 
-    printf( " = %f ms\n", (double) time / iterations * 1000 );
+    const char * output = display.output() == Output::Offscreen ? "offscreen" : "window";
+    const char * modeName = mode == Mode::TrueColor ? "truecolor" : "floating point";
+
+    // a full update, and a dirty box of a sixteenth of the display in the middle
+
+    const PixelToaster::Rectangle box( width * 3 / 8, width * 5 / 8, height * 3 / 8, height * 5 / 8 );
+    const PixelToaster::Rectangle * regions[] = { NULL, &box };
+    const char * regionNames[] = { "full", "box" };
+
+    for ( int region = 0; region < 2; ++region )
+    {
+        printf( "   %s update (%s, %s, %dx%d)", modeName, output, regionNames[region], width, height );
+
+        UpdateOperation operation( display, sources, regions[region] );
+
+        const int pixels = regions[region] ? ( box.xEnd - box.xBegin ) * ( box.yEnd - box.yBegin ) : width * height;
+
+        Result result;
+        result.benchmark = "update";
+        result.source = modeName;
+        result.destination = output;
+        result.variant = regionNames[region];
+        result.cache = "warm";
+        result.item = "pixel";
+        result.threads = 0;
+        result.width = width;
+        result.height = height;
+        result.measurement = measure( operation, pixels, false );
+        report( result );
+    }
 }
 
-void profileIntegerConverter( Format format, const integer32 *source, void *destination, int count )
+// ----------------------------------------------------------------------------------------
+
+// the render and simulation loops read the timer every frame, so it has to be cheap
+
+class TimerOperation : public Operation
 {
-    printf( "   truecolor -> %s", getFormatString(format) );
+public:
 
-    Converter * converter = requestConverter( Format::XRGB8888, format );
+    enum { calls = 1000 };
 
-    if ( !converter )
+    TimerOperation() : sum( 0 ) {}
+
+    void run()
     {
-        printf( "\n     failed: null converter\n" );
-        exit(1);
+        for ( int i = 0; i < calls; ++i )
+            sum += timer.time();
     }
 
-    double startTime = timer.time();
+    double sum;
+};
 
-    double time = 0.0;
+void profileTimer()
+{
+    printf( "   %d x Timer::time", (int) TimerOperation::calls );
+
+    TimerOperation operation;
+
+    Result result;
+    result.benchmark = "timer";
+    result.source = "time";
+    result.destination = "";
+    result.variant = "";
+    result.cache = "warm";
+    result.item = "call";
+    result.threads = 1;
+    result.width = TimerOperation::calls;
+    result.height = 1;
+    result.measurement = measure( operation, TimerOperation::calls, false );
+    report( result );
+}
 
-    int iterations = 0;
+// how late waits return. the result is the whole wait, subtract the millisecond asked for to get the oversleep.
 
-    while ( time < duration )
+class WaitOperation : public Operation
+{
+public:
+
+    WaitOperation( bool precise ) : precise( precise ) {}
+
+    void run()
     {
-        converter->convert( source, destination, count );
-        time = timer.time() - startTime;
-        iterations ++;
+        timer.wait( 0.001, precise );
     }
 
-    printf( " = %f ms\n", (double) time / iterations * 1000 );
+private:
+
+    bool precise;
+};
+
+void profileWait( bool precise )
+{
+    printf( "   %s wait of 1 ms", precise ? "precise" : "plain" );
+
+    WaitOperation operation( precise );
+
+    Result result;
+    result.benchmark = "wait";
+    result.source = "1ms";
+    result.destination = "";
+    result.variant = precise ? "precise" : "plain";
+    result.cache = "warm";
+    result.item = "wait";
+    result.threads = 1;
+    result.width = 1;
+    result.height = 1;
+
+    // one wait per sample, the point is the spread
+    const double sampleTime = settings.sampleTime;
+    settings.sampleTime = 0;
+    result.measurement = measure( operation, 1, false );
+    settings.sampleTime = sampleTime;
+
+    report( result );
 }
 
+// ----------------------------------------------------------------------------------------
 
-int main()
+void writeJson( const char * filename )
 {
-    const int width = 256;
-    const int height = 256;
+    FILE * file = fopen( filename, "w" );
+    if ( !file )
+    {
+        printf( "failed: could not write %s\n", filename );
+        exit(1);
+    }
 
-	vector<Pixel> pixelSource( width * height );
+    fprintf( file, "{\n" );
+#ifdef __VERSION__
+    fprintf( file, "  \"compiler\": \"%s\",\n", __VERSION__ );
+#endif
+    fprintf( file, "  \"built\": \"%s %s\",\n", __DATE__, __TIME__ );
+    fprintf( file, "  \"instructionSet\": \"%s\",\n", getInstructionSetString( detectInstructionSet() ) );
+    fprintf( file, "  \"warmups\": %d,\n", settings.warmups );
+    fprintf( file, "  \"samples\": %d,\n", settings.samples );
+    fprintf( file, "  \"results\": [\n" );
+
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const Result & r = results[i];
+        const Measurement & m = r.measurement;
+
+        fprintf( file, "    { \"benchmark\": \"%s\", \"source\": \"%s\", \"destination\": \"%s\", \"variant\": \"%s\", \"cache\": \"%s\", "
+            "\"item\": \"%s\", \"threads\": %d, \"width\": %d, \"height\": %d, \"samples\": %d, "
+            "\"minMs\": %.6f, \"medianMs\": %.6f, \"meanMs\": %.6f, \"deviationMs\": %.6f, \"cyclesPerItem\": %.4f, "
+            "\"dtlbMisses\": %.1f }%s\n",
+            r.benchmark, r.source, r.destination, r.variant, r.cache, r.item, r.threads, r.width, r.height, m.samples,
+            m.minimum * 1000, m.median * 1000, m.mean * 1000, m.deviation * 1000, m.cyclesPerItem, m.tlbMisses,
+            i + 1 < results.size() ? "," : "" );
+    }
+
+    fprintf( file, "  ]\n}\n" );
+    fclose( file );
+
+    printf( "results written to %s\n\n", filename );
+}
+
+int main( int argc, char * argv[] )
+{
+    bool quick = false;
+    const char * json = NULL;
 
-    for ( unsigned int i = 0; i < pixelSource.size(); ++i )
+    for ( int i = 1; i < argc; ++i )
     {
-        pixelSource[i].r = 1.5;
-        pixelSource[i].g = 0.5;
-        pixelSource[i].b = 0.25;
-        pixelSource[i].a = 0;
+        if ( strcmp( argv[i], "-quick" ) == 0 )
+            quick = true;
+        else if ( strcmp( argv[i], "-heap" ) == 0 )
+            heapBuffers = true;
+        else if ( strcmp( argv[i], "-json" ) == 0 && i + 1 < argc )
+            json = argv[++i];
+        else
+        {
+            printf( "usage: %s [-quick] [-heap] [-json filename]\n", argv[0] );
+            return 1;
+        }
     }
 
-    vector<integer32> integerSource( width * height );
+    if ( quick )
+    {
+        settings.warmups = 1;
+        settings.samples = 5;
+        settings.sampleTime = 0.002;
+    }
+
+    struct Resolution { int width, height; };
+
+    const Resolution resolutions[] = { { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 2560, 1600 }, { 3840, 2160 } };
+    const Resolution quickResolutions[] = { { 320, 240 }, { 1920, 1080 } };
 
-    for ( unsigned int i = 0; i < integerSource.size(); ++i )
-        integerSource[i] = 0x00FF6677;
+    const Resolution * sizes = quick ? quickResolutions : resolutions;
+    const int sizeCount = quick ? 2 : sizeof(resolutions) / sizeof(resolutions[0]);
 
-    integer8 * destination = new integer8[width*height*16];
+    const int largest = sizes[sizeCount - 1].width * sizes[sizeCount - 1].height;
+
+    Sources sources( largest );
+    Buffer<integer8> destination( largest * 16 );
+
+    const Format destinations[] = { Format::XBGRFFFF, Format::XRGB8888, Format::XBGR8888, Format::RGB888, Format::BGR888,
+        Format::RGB565, Format::BGR565, Format::XRGB1555, Format::XBGR1555 };
+
+    const InstructionSet best = detectInstructionSet();
 
 	printf( "\n[ PixelToaster Profiling Suite ]\n\n" );
 
-	printf( "floating point color conversion routines:\n\n" );
-
-    profilePixelConverter( Format::XBGRFFFF, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::XRGB8888, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::XBGR8888, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::RGB888, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::BGR888, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::RGB565, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::BGR565, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::XRGB1555, &pixelSource[0], destination, (int) pixelSource.size() );
-    profilePixelConverter( Format::XBGR1555, &pixelSource[0], destination, (int) pixelSource.size() );
-
-	printf( "\ntruecolor conversion routines:\n\n" );
-
-    profileIntegerConverter( Format::XBGRFFFF, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::XRGB8888, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::XBGR8888, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::RGB888, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::BGR888, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::RGB565, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::BGR565, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::XRGB1555, &integerSource[0], destination, (int) integerSource.size() );
-    profileIntegerConverter( Format::XBGR1555, &integerSource[0], destination, (int) integerSource.size() );
+	printf( "pixels in %s\n", heapBuffers ? "heap memory" : "allocatePixels memory" );
+
+    openTlbCounter();
+    printf( "%s\n\n", hasTlbCounter() ? "counting data tlb load misses" : "data tlb miss counter not available" );
+
+    // every converter on every instruction set, on a small image that stays in cache
+
+	printf( "conversion routines:\n\n" );
+
+    for ( int s = 0; s < 2; ++s )
+    {
+        const Format source = s ? Format::XRGB8888 : Format::XBGRFFFF;
+
+        for ( int d = 0; d < 9; ++d )
+            for ( int isa = InstructionSet::Scalar; isa <= best; ++isa )
+                profileConverter( source, destinations[d], (InstructionSet::Enumeration) isa, 1, sources, &destination[0], 256, 256, false );
+    }
+
+    // the converters displays actually use, from small windows up to 4K
+
+	printf( "\nconversion across resolutions:\n\n" );
+
+    const Format pairs[][2] = { { Format::XBGRFFFF, Format::XRGB8888 }, { Format::XBGRFFFF, Format::RGB565 },
+        { Format::XRGB8888, Format::XRGB8888 }, { Format::XRGB8888, Format::RGB565 } };
+
+    for ( int r = 0; r < sizeCount; ++r )
+        for ( int p = 0; p < 4; ++p )
+            for ( int cold = 0; cold < 2; ++cold )
+                profileConverter( pairs[p][0], pairs[p][1], best, 1, sources, &destination[0], sizes[r].width, sizes[r].height, cold != 0 );
+
+    // parallel conversion of a large frame on 1 to N threads
+
+	printf( "\nparallel conversion:\n\n" );
+
+    const Resolution & frame = sizes[sizeCount - 1];
+
+    for ( int p = 0; p < 4; ++p )
+    {
+        int threads = 1;
+        while ( profileConverter( pairs[p][0], pairs[p][1], best, threads, sources, &destination[0], frame.width, frame.height, false ) )
+            threads++;
+    }
+
+	printf( "\ntimer:\n\n" );
+
+    profileTimer();
+    profileWait( false );
+    profileWait( true );
+
+    // end to end display updates
+
+	printf( "\ndisplay updates:\n\n" );
+
+    for ( int r = 0; r < sizeCount; ++r )
+    {
+        profileUpdate( Mode::TrueColor, sources, sizes[r].width, sizes[r].height );
+        profileUpdate( Mode::FloatingPoint, sources, sizes[r].width, sizes[r].height );
+    }
 
 	printf( "\n" );
+
+    if ( json )
+        writeJson( json );
 }
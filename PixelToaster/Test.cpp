@@ -6,6 +6,8 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include "PixelToaster.h"
 #include "PixelToasterConversion.h"
 
@@ -3799,6 +3801,645 @@ void test_conversion()
 
 // ----------------------------------------------------------------------------------------
 
+// the simd converters must produce exactly the same bits as the scalar ones, for any input
+// (negative, denormal, infinite and nan components included), for pixel counts that are not
+// a multiple of their block size, and without touching the alpha of floating point pixels.
+
+const char * formatName( Format format )
+{
+    switch ( format )
+    {
+        case Format::XRGB8888: 	return "truecolor";
+        case Format::XBGR8888: 	return "xbgr8888";
+        case Format::RGB888: 	return "rgb888";
+        case Format::BGR888: 	return "bgr888";
+        case Format::RGB565: 	return "rgb565";
+        case Format::BGR565: 	return "bgr565";
+        case Format::XRGB1555: 	return "xrgb1555";
+        case Format::XBGR1555: 	return "xbgr1555";
+        case Format::XBGRFFFF: 	return "floating point";
+        default: 				return "???";
+    }
+}
+
+const char * instructionSetName( InstructionSet instructionSet )
+{
+    switch ( instructionSet )
+    {
+        case InstructionSet::Scalar: 	return "scalar";
+        case InstructionSet::SSE2: 		return "sse2";
+        case InstructionSet::SSSE3: 	return "ssse3";
+        case InstructionSet::AVX2: 		return "avx2";
+        default: 						return "???";
+    }
+}
+
+integer8 randomByte()
+{
+	return (integer8) ( rand() >> 4 );
+}
+
+float randomFloat()
+{
+	static const integer32 special[] =
+	{
+		0x00000000, 0x80000000,				// +0, -0
+		0x3F800000, 0xBF800000,				// 1, -1
+		0x3F7FFFFF, 0x3F7FFFFE, 0x3F800001,	// around 1
+		0x3F7F0000, 0x3F7EFFFF, 0x3B800000,	// 255/256, just below it, 1/256
+		0x00000001, 0x807FFFFF,				// denormals
+		0x7F7FFFFF, 0xFF7FFFFF,				// huge
+		0x7F800000, 0xFF800000,				// infinities
+		0x7FC00000, 0xFFC00000, 0x7F800001,	// nans
+	};
+
+	FloatInteger value;
+	switch ( rand() % 4 )
+	{
+		case 0:
+			value.i = special[ rand() % ( sizeof(special) / sizeof(special[0]) ) ];
+			break;
+		case 1:
+			value.i = randomByte() | ( randomByte() << 8 ) | ( randomByte() << 16 ) | ( randomByte() << 24 );
+			break;
+		default:
+			value.f = rand() * 1.5f / RAND_MAX - 0.25f;
+			break;
+	}
+	return value.f;
+}
+
+void test_simd_converters()
+{
+	printf( "testing simd converters:\n\n" );
+
+	const InstructionSet best = detectInstructionSet();
+
+	if ( best == InstructionSet::Scalar )
+	{
+		printf( "   skipped: no simd instruction sets available\n\n" );
+		return;
+	}
+
+	if ( best != InstructionSet::AVX2 && requestConverter( Format::XRGB8888, Format::RGB565, InstructionSet::AVX2 ) )
+	{
+		printf( "   failed: got a converter for an unsupported instruction set\n" );
+		exit( 1 );
+	}
+
+	const int maxCount = 1037;
+	const int counts[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 48, 100, maxCount };
+	const int countCount = sizeof(counts) / sizeof(counts[0]);
+
+	srand( 1 );
+
+	vector<Pixel> floatingPointSource( maxCount + 1 );
+	for ( int i = 0; i <= maxCount; ++i )
+		floatingPointSource[i] = Pixel( randomFloat(), randomFloat(), randomFloat(), randomFloat() );
+
+	vector<integer32> trueColorSource( maxCount + 1 );
+	for ( int i = 0; i <= maxCount; ++i )
+		trueColorSource[i] = randomByte() | ( randomByte() << 8 ) | ( randomByte() << 16 ) | ( randomByte() << 24 );
+
+	// room for the largest format plus a guard band to catch writes past the end
+
+	const int size = ( maxCount + 4 ) * sizeof(Pixel);
+	vector<integer8> expected( size );
+	vector<integer8> actual( size );
+
+	const Format sources[] = { Format::XBGRFFFF, Format::XRGB8888 };
+	const Format destinations[] = { Format::XRGB8888, Format::XBGR8888, Format::RGB888, Format::BGR888, Format::RGB565,
+		Format::BGR565, Format::XRGB1555, Format::XBGR1555, Format::XBGRFFFF };
+
+	for ( int isa = InstructionSet::SSE2; isa <= best; ++isa )
+	{
+		const InstructionSet instructionSet = (InstructionSet::Enumeration) isa;
+
+		printf( "   %s\n", instructionSetName( instructionSet ) );
+
+		for ( int s = 0; s < 2; ++s )
+		{
+			for ( int d = 0; d < 9; ++d )
+			{
+				Converter * scalar = requestConverter( sources[s], destinations[d], InstructionSet::Scalar );
+				Converter * simd = requestConverter( sources[s], destinations[d], instructionSet );
+
+				if ( !scalar || !simd )
+				{
+					printf( "     failed: null converter for %s -> %s\n", formatName( sources[s] ), formatName( destinations[d] ) );
+					exit( 1 );
+				}
+
+				for ( int c = 0; c < countCount; ++c )
+				{
+					// odd counts start one pixel in, so the loads are unaligned too
+					const int offset = counts[c] & 1;
+					const void * source = ( sources[s] == Format::XBGRFFFF ) ? (const void*) &floatingPointSource[offset] : (const void*) &trueColorSource[offset];
+
+					for ( int i = 0; i < size; ++i )
+						expected[i] = actual[i] = (integer8) ( i * 7 + 3 );
+
+					scalar->convert( source, &expected[0], counts[c] );
+					simd->convert( source, &actual[0], counts[c] );
+
+					if ( memcmp( &expected[0], &actual[0], size ) != 0 )
+					{
+						printf( "     failed: %s -> %s differs from scalar for %d pixels\n", formatName( sources[s] ), formatName( destinations[d] ), counts[c] );
+						exit( 1 );
+					}
+				}
+			}
+		}
+	}
+
+	printf( "     passed.\n\n" );
+}
+
+// ----------------------------------------------------------------------------------------
+
+// the timer must never run backwards, and agree with the operating system about how long a wait took
+
+void test_timer()
+{
+	printf( "testing timer:\n\n" );
+
+	Timer timer;
+
+	printf( "   resolution\n" );
+	if ( timer.resolution() <= 0.0 || timer.resolution() > 0.001 )
+	{
+		printf( "     failed: resolution is %g seconds\n", timer.resolution() );
+		exit( 1 );
+	}
+
+	printf( "   monotonic\n" );
+	double last = timer.time();
+	for ( int i = 0; i < 1000000; ++i )
+	{
+		const double time = timer.time();
+		if ( time < last )
+		{
+			printf( "     failed: time went back from %.9f to %.9f\n", last, time );
+			exit( 1 );
+		}
+		last = time;
+	}
+
+	printf( "   wait\n" );
+	const double start = timer.time();
+	timer.wait( 0.05 );
+	const double elapsed = timer.time() - start;
+	if ( elapsed < 0.049 || elapsed > 0.5 )
+	{
+		printf( "     failed: waiting 0.05 seconds took %g\n", elapsed );
+		exit( 1 );
+	}
+
+	// precise waits must never return early. how late they are depends on the machine's load,
+	// so only look for something badly wrong here, Profile measures it properly
+
+	printf( "   precise wait\n" );
+	double late[20];
+	for ( int i = 0; i < 20; ++i )
+	{
+		const double start = timer.time();
+		timer.wait( 0.002, true );
+		late[i] = timer.time() - start - 0.002;
+		if ( late[i] < -1e-6 )
+		{
+			printf( "     failed: precise wait returned %g seconds early\n", -late[i] );
+			exit( 1 );
+		}
+	}
+	std::sort( late, late + 20 );
+	if ( late[10] > 0.001 )
+	{
+		printf( "     failed: precise waits were %g seconds late\n", late[10] );
+		exit( 1 );
+	}
+
+	printf( "     passed.\n\n" );
+}
+
+// ----------------------------------------------------------------------------------------
+
+// parallel converters must give the same result as the single threaded converter they wrap,
+// wherever the bands happen to be cut
+
+void test_parallel_converters()
+{
+	printf( "testing parallel converters:\n\n" );
+
+	const InstructionSet best = detectInstructionSet();
+
+	if ( requestConverter( Format::XBGRFFFF, Format::XRGB8888, best, 1 ) != requestConverter( Format::XBGRFFFF, Format::XRGB8888, best ) )
+	{
+		printf( "   failed: one thread should give the single threaded converter\n" );
+		exit( 1 );
+	}
+
+	// large enough to be split for every source format, and not a whole number of bands
+
+	const int maxCount = 300017;
+	const int counts[] = { 1037, 131071, maxCount };
+	const int countCount = sizeof(counts) / sizeof(counts[0]);
+	const int threads[] = { 2, 3, 0 };
+	const int threadCount = sizeof(threads) / sizeof(threads[0]);
+
+	srand( 2 );
+
+	vector<Pixel> floatingPointSource( maxCount );
+	for ( int i = 0; i < maxCount; ++i )
+		floatingPointSource[i] = Pixel( randomFloat(), randomFloat(), randomFloat(), randomFloat() );
+
+	vector<integer32> trueColorSource( maxCount );
+	for ( int i = 0; i < maxCount; ++i )
+		trueColorSource[i] = randomByte() | ( randomByte() << 8 ) | ( randomByte() << 16 ) | ( randomByte() << 24 );
+
+	const int size = ( maxCount + 4 ) * sizeof(Pixel);
+	vector<integer8> expected( size );
+	vector<integer8> actual( size );
+
+	const Format sources[] = { Format::XBGRFFFF, Format::XRGB8888 };
+	const Format destinations[] = { Format::XRGB8888, Format::XBGR8888, Format::RGB888, Format::BGR888, Format::RGB565,
+		Format::BGR565, Format::XRGB1555, Format::XBGR1555, Format::XBGRFFFF };
+
+	for ( int t = 0; t < threadCount; ++t )
+	{
+		if ( threads[t] )
+			printf( "   %d threads\n", threads[t] );
+		else
+			printf( "   all processors\n" );
+
+		for ( int s = 0; s < 2; ++s )
+		{
+			const void * source = ( sources[s] == Format::XBGRFFFF ) ? (const void*) &floatingPointSource[0] : (const void*) &trueColorSource[0];
+
+			for ( int d = 0; d < 9; ++d )
+			{
+				Converter * serial = requestConverter( sources[s], destinations[d], best, 1 );
+				Converter * parallel = requestConverter( sources[s], destinations[d], best, threads[t] );
+
+				if ( !serial || !parallel )
+				{
+					printf( "     failed: null converter for %s -> %s\n", formatName( sources[s] ), formatName( destinations[d] ) );
+					exit( 1 );
+				}
+
+				for ( int c = 0; c < countCount; ++c )
+				{
+					for ( int i = 0; i < size; ++i )
+						expected[i] = actual[i] = (integer8) ( i * 7 + 3 );
+
+					serial->convert( source, &expected[0], counts[c] );
+					parallel->convert( source, &actual[0], counts[c] );
+
+					if ( memcmp( &expected[0], &actual[0], size ) != 0 )
+					{
+						printf( "     failed: %s -> %s differs from serial for %d pixels\n", formatName( sources[s] ), formatName( destinations[d] ), counts[c] );
+						exit( 1 );
+					}
+				}
+			}
+		}
+	}
+
+	printf( "     passed.\n\n" );
+}
+
+// ----------------------------------------------------------------------------------------
+
+// exercises the display update paths. this needs a window system to talk to,
+// on X11 run it under Xvfb to get both the MIT-SHM and XPutImage paths:
+//
+//     xvfb-run ./Test
+//     PIXELTOASTER_NO_SHM=1 xvfb-run ./Test
+
+void test_display()
+{
+	printf( "testing display:\n\n" );
+
+	const int width = 64;
+	const int height = 48;
+
+	Display display;
+
+	if ( !display.open( "PixelToaster Test", width, height, Output::Windowed, Mode::TrueColor ) )
+	{
+		printf( "   skipped: could not open display\n\n" );
+		return;
+	}
+
+	vector<TrueColorPixel> pixels( width * height );
+	for ( int i = 0; i < width * height; ++i )
+		pixels[i] = TrueColorPixel( (integer8) i, (integer8) ( i >> 8 ), 0xFF );
+
+	printf( "   full update\n" );
+	if ( !display.update( pixels ) )
+	{
+		printf( "     failed: update returned false\n" );
+		exit( 1 );
+	}
+
+	printf( "   dirty box update\n" );
+	{
+		const Rectangle boxes[] = 
+		{ 
+			Rectangle( 0, 8, 0, 8 ),
+			Rectangle( 60, 80, 40, 60 ),		// partially outside
+			Rectangle( 10, 10, 10, 20 ),		// empty
+		};
+
+		if ( !display.update( &pixels[0], boxes, 3 ) || !display.update( &pixels[0], boxes, 0 ) )
+		{
+			printf( "     failed: update returned false\n" );
+			exit( 1 );
+		}
+	}
+
+	printf( "   floating point update\n" );
+	{
+		vector<FloatingPointPixel> floatingPointPixels( width * height, FloatingPointPixel( 0.25f, 0.5f, 1.5f ) );
+
+		const Rectangle box( 16, 32, 16, 32 );
+
+		if ( !display.update( floatingPointPixels ) || !display.update( floatingPointPixels, &box ) )
+		{
+			printf( "     failed: update returned false\n" );
+			exit( 1 );
+		}
+	}
+
+	TrueColorPixel * buffer = display.buffer();
+	if ( buffer )
+	{
+		printf( "   shared buffer update\n" );
+
+		for ( int i = 0; i < width * height; ++i )
+			buffer[i] = pixels[width * height - 1 - i];
+
+		const Rectangle box( 8, 24, 4, 12 );
+
+		if ( !display.update( buffer ) || !display.update( buffer, &box ) )
+		{
+			printf( "     failed: update returned false\n" );
+			exit( 1 );
+		}
+
+		for ( int i = 0; i < width * height; ++i )
+		{
+			if ( buffer[i].integer != pixels[width * height - 1 - i].integer )
+			{
+				printf( "     failed: buffer contents changed by update\n" );
+				exit( 1 );
+			}
+		}
+	}
+	else
+	{
+		printf( "   shared buffer not available\n" );
+	}
+
+	if ( display.presentation( Presentation::Asynchronous, 0 ) )
+	{
+		printf( "     failed: presentation accepted an empty queue\n" );
+		exit( 1 );
+	}
+
+	if ( display.presentation( Presentation::AsynchronousBlocking, 2 ) && display.presentation() == Presentation::AsynchronousBlocking )
+	{
+		printf( "   asynchronous presentation\n" );
+
+		if ( display.buffer() )
+		{
+			printf( "     failed: shared buffer available during asynchronous presentation\n" );
+			exit( 1 );
+		}
+
+		vector<FloatingPointPixel> floatingPointPixels( width * height, FloatingPointPixel( 1.0f, 0.5f, 0.25f ) );
+		const Rectangle box( 4, 20, 8, 40 );
+
+		for ( int i = 0; i < 20; ++i )
+		{
+			const bool updated = ( i % 2 ) ? display.update( floatingPointPixels, &box ) : display.update( &pixels[0], &box, 1 );
+			if ( !updated )
+			{
+				printf( "     failed: update returned false\n" );
+				exit( 1 );
+			}
+		}
+
+		PresentStatistics stats = display.presentStatistics();
+		if ( stats.queueLength != 2 || stats.framesQueued != 20 || stats.framesDropped != 0 || stats.maxQueuedFrames > 2 )
+		{
+			printf( "     failed: unexpected statistics in blocking mode\n" );
+			exit( 1 );
+		}
+
+		// switching the queue length restarts presentation and the statistics
+
+		if ( !display.presentation( Presentation::Asynchronous, 3 ) )
+		{
+			printf( "     failed: could not switch to triple buffering\n" );
+			exit( 1 );
+		}
+
+		for ( int i = 0; i < 20; ++i )
+		{
+			if ( !display.update( &pixels[0], &box, 1 ) )
+			{
+				printf( "     failed: update returned false\n" );
+				exit( 1 );
+			}
+		}
+
+		stats = display.presentStatistics();
+		if ( stats.queueLength != 3 || stats.framesQueued != 20 || stats.framesPresented + stats.framesDropped > stats.framesQueued )
+		{
+			printf( "     failed: unexpected statistics in dropping mode\n" );
+			exit( 1 );
+		}
+
+		if ( !display.presentation( Presentation::Synchronous ) || display.presentation() != Presentation::Synchronous || !display.update( pixels ) )
+		{
+			printf( "     failed: could not switch back to synchronous presentation\n" );
+			exit( 1 );
+		}
+	}
+	else
+	{
+		printf( "   asynchronous presentation not available\n" );
+	}
+
+	if ( display.presentation( Presentation::External ) )
+	{
+		printf( "   external presentation\n" );
+
+		if ( !display.handle() || display.presentation() != Presentation::External || !display.update( pixels ) )
+		{
+			printf( "     failed: external presentation without a window\n" );
+			exit( 1 );
+		}
+
+		if ( !display.presentation( Presentation::Synchronous ) || display.presentation() != Presentation::Synchronous || !display.update( pixels ) )
+		{
+			printf( "     failed: could not switch back from external presentation\n" );
+			exit( 1 );
+		}
+	}
+	else
+	{
+		printf( "   external presentation not available\n" );
+	}
+
+	// starting and stopping the input thread must leave the display working
+
+	if ( display.input( Input::Threaded ) && display.input() == Input::Threaded )
+	{
+		printf( "   threaded input\n" );
+
+		for ( int i = 0; i < 10; ++i )
+		{
+			if ( !display.update( pixels ) )
+			{
+				printf( "     failed: update with threaded input\n" );
+				exit( 1 );
+			}
+		}
+
+		if ( !display.input( Input::Synchronous ) || display.input() != Input::Synchronous || !display.update( pixels ) )
+		{
+			printf( "     failed: could not switch back to synchronous input\n" );
+			exit( 1 );
+		}
+	}
+	else
+	{
+		printf( "   threaded input not available\n" );
+	}
+
+	display.close();
+
+	if ( display.open() || display.buffer() )
+	{
+		printf( "     failed: display still open after close\n" );
+		exit( 1 );
+	}
+
+	printf( "     passed.\n\n" );
+}
+
+// ----------------------------------------------------------------------------------------
+
+// the offscreen display needs no window system, so this always runs.
+// it replays a small event script and checks every event arrives after the right update.
+
+class ScriptListener : public Listener
+{
+public:
+
+	ScriptListener() : frame( 0 ), opened( 0 ), activated( 0 ), hidden( -1 ), shown( -1 ), keyDown( -1 ), keyUp( -1 ), mouseMove( -1 ), mouseDown( -1 ), mouseUp( -1 ), closed( -1 ), mouseX( 0 ), left( false ) {}
+
+	void onOpen( DisplayInterface & display ) { opened++; }
+	void onActivate( DisplayInterface & display, bool active ) { if ( active ) activated++; }
+	void onVisible( DisplayInterface & display, bool visible ) { if ( visible ) shown = frame; else hidden = frame; }
+	void onKeyDown( DisplayInterface & display, Key key ) { if ( key == Key::A ) keyDown = frame; }
+	void onKeyUp( DisplayInterface & display, Key key ) { if ( key == Key::A ) keyUp = frame; }
+	void onMouseMove( DisplayInterface & display, Mouse mouse ) { mouseMove = frame; mouseX = mouse.x; }
+	void onMouseButtonDown( DisplayInterface & display, Mouse mouse ) { mouseDown = frame; left = mouse.buttons.left; }
+	void onMouseButtonUp( DisplayInterface & display, Mouse mouse ) { mouseUp = frame; }
+	bool onClose( DisplayInterface & display ) { closed = frame; return true; }
+
+	int frame;
+	int opened, activated, hidden, shown;
+	int keyDown, keyUp, mouseMove, mouseDown, mouseUp, closed;
+	float mouseX;
+	bool left;
+};
+
+void test_offscreen_display()
+{
+	printf( "testing offscreen display:\n\n" );
+
+	const char * filename = "TestOffscreen.txt";
+
+	FILE * file = fopen( filename, "w" );
+	if ( !file )
+	{
+		printf( "   failed: could not write event script\n" );
+		exit( 1 );
+	}
+	fprintf( file, "# frame event\n1 activate 1\n2 keydown a\n3 keyup a\n3 mousemove 10 20\n5 close\n4 mousedown 10 20 left\n4 mouseup 10 20 left\n2 visible 0\n4 visible 1\n" );
+	fclose( file );
+
+	putenv( (char*) "PIXELTOASTER_OFFSCREEN_SCRIPT=TestOffscreen.txt" );
+
+	const int width = 64;
+	const int height = 48;
+
+	ScriptListener listener;
+	Display display;
+	display.listener( &listener );
+
+	printf( "   open\n" );
+	if ( !display.open( "PixelToaster Test", width, height, Output::Offscreen, Mode::FloatingPoint ) || display.output() != Output::Offscreen || listener.opened != 1 )
+	{
+		printf( "     failed: could not open offscreen display\n" );
+		exit( 1 );
+	}
+
+	// scripted events belong to updates, there is no input thread
+	if ( display.input( Input::Threaded ) || display.input() != Input::Synchronous )
+	{
+		printf( "     failed: offscreen display accepted threaded input\n" );
+		exit( 1 );
+	}
+
+	printf( "   scripted events\n" );
+
+	vector<FloatingPointPixel> pixels( width * height, FloatingPointPixel( 0.5f, 0.25f, 1.0f ) );
+	const PixelToaster::Rectangle box( 8, 24, 4, 12 );
+
+	while ( listener.frame < 10 )
+	{
+		listener.frame++;
+		if ( !( listener.frame & 1 ? display.update( pixels ) : display.update( pixels, &box ) ) )
+			break;
+	}
+
+	if ( listener.activated != 1 || listener.keyDown != 2 || listener.keyUp != 3 || listener.mouseMove != 3 ||
+		 listener.mouseX != 10 || listener.mouseDown != 4 || !listener.left || listener.mouseUp != 4 || listener.closed != 5 ||
+		 listener.hidden != 2 || listener.shown != 4 )
+
+	{
+		printf( "     failed: events were not delivered on the scripted frames\n" );
+		exit( 1 );
+	}
+
+	if ( display.open() || listener.frame != 5 || display.presentStatistics().framesPresented != 5 )
+	{
+		printf( "     failed: close event did not close the display\n" );
+		exit( 1 );
+	}
+
+	putenv( (char*) "PIXELTOASTER_OFFSCREEN_SCRIPT=" );
+	remove( filename );
+
+	printf( "   update with no dirty boxes\n" );
+
+	if ( !display.open( "PixelToaster Test", width, height, Output::Offscreen, Mode::FloatingPoint ) ||
+		 !display.update( pixels ) || !display.update( &pixels[0], &box, 0 ) ||
+		 display.presentStatistics().framesPresented != 1 )
+	{
+		printf( "     failed: an update with nothing changed was presented\n" );
+		exit( 1 );
+	}
+
+	printf( "     passed.\n\n" );
+}
+
+// ----------------------------------------------------------------------------------------
+
 
 int main()
 {
@@ -3806,6 +4447,11 @@ int main()
 	
 	test_conversion();
 	test_converter_objects();
+	test_simd_converters();
+	test_parallel_converters();
+	test_timer();
+	test_display();
+	test_offscreen_display();
 	
 	printf( "test completed successfully!\n\n" );
 
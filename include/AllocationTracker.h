@@ -0,0 +1,60 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef ALLOCATIONTRACKER_H_
+#define ALLOCATIONTRACKER_H_
+
+#include <ostream>
+#include <string>
+
+// counts heap allocations by the phase of the frame or sim step they happen in. a thread enters and leaves
+// phases around its work, phases nest, and an allocation counts toward the innermost phase of the thread
+// that made it. allocations outside any phase aren't counted.
+// the counting itself is only built in with CONKERS_TRACK_ALLOCATIONS defined, because it takes over the
+// allocator: malloc, calloc and realloc with glibc, which catches C++'s new and what chipmunk and cairo
+// allocate too, operator new elsewhere. otherwise phases cost a thread local store, and nothing is reported.
+// a phase marked allocation-free aborts the program at the first allocation made inside it, with the size
+// and the phase's name, to catch a hot path that starts allocating.
+class AllocationTracker {
+public:
+    static const int MAX_PHASES = 16;
+
+    // returns the phase's number for enter. phases are added before the threads using them start
+    static int addPhase(const char *name);
+
+    static void enter(int phase);
+    // leaves the phase entered last, and counts a run of it
+    static void leave();
+
+    // makes the phases named in the comma separated list allocation-free
+    static void setAllocationFree(const std::string &names);
+
+    static bool isBuiltIn();
+
+    // a line per phase that ran: allocations and bytes per run
+    static void report(std::ostream &out);
+};
+
+#endif /* ALLOCATIONTRACKER_H_ */
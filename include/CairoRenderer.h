@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef CAIRORENDERER_H_
+#define CAIRORENDERER_H_
+
+#include "RenderList.h"
+#include "PixelAllocator.h"
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <cairomm/cairomm.h>
+#include <pthread.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// draws recorded render lists with cairo. the frame is split into tiles, each with its own cairo surface over
+// its part of the pixels, and the tiles are drawn in parallel. a tile only draws the commands whose screen
+// bounds reach into it.
+// below a scale of 1, frames are drawn into a smaller buffer of the renderer's own and filtered up to the
+// frame's size afterwards.
+class CairoRenderer {
+protected:
+    struct Tile {
+        PixelToaster::Rectangle box;       // in the pixels drawn to
+        PixelToaster::Rectangle screenBox; // the same pixels in screen coordinates, for culling commands
+        Cairo::RefPtr<Cairo::ImageSurface> surface;
+        Cairo::RefPtr<Cairo::Context> cr;
+        std::vector<PixelToaster::Rectangle> clip; // parts of the dirty boxes inside the tile
+    };
+
+    unsigned char * const frame;
+    const int width;
+    const int height;
+    const int stride;
+    int tileSize;
+
+    double scale;
+    int scaledWidth;
+    int scaledHeight;
+    std::vector<unsigned char, PixelAllocator<unsigned char>> scaledPixels;
+    // first source column and weight of the second (of 256) for each column of the frame, same for rows
+    std::vector<int> columnIndex;
+    std::vector<int> columnWeight;
+    std::vector<int> rowIndex;
+    std::vector<int> rowWeight;
+    // the scaled buffer doesn't hold the last frame, the next one has to be drawn whole
+    bool repaintAll;
+    std::vector<PixelToaster::Rectangle> scaledDirty;
+
+    Cairo::RefPtr<Cairo::ToyFontFace> font;
+    std::vector<Tile> tiles;
+
+    // workers wait for the generation to change, then take tiles until there are none left
+    std::vector<pthread_t> workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t frameStarted;
+    pthread_cond_t frameDone;
+    unsigned int generation;
+    int busyWorkers;
+    bool quit;
+    std::atomic<size_t> nextTile;
+    const RenderList *list;
+    const std::vector<PixelToaster::Rectangle> *dirty;
+    // last opaque paint of the list, which tiles fill without cairo, or the list's size if there is none.
+    // nothing drawn before it would be seen
+    size_t clearIndex;
+    uint32_t clearPixel;
+
+    static void *worker(void *arg);
+    void work();
+    void createTiles(unsigned char *data, int width, int height);
+    void drawTiles();
+    void drawTile(Tile &tile);
+    void upscale(const PixelToaster::Rectangle &box);
+
+public:
+    static const int TILE_SIZE = 256;
+
+    // draws into width x height ARGB32 pixels. threads is the number of threads drawing, including the caller
+    // of draw. 0 uses one per processor
+    CairoRenderer(unsigned char *data, int width, int height, int stride, int threads = 0);
+    ~CairoRenderer();
+
+    // draws the list into the given screen regions only, leaving the rest of the pixels untouched.
+    // after a change of scale, the regions grow to the whole frame
+    void draw(const RenderList &list, std::vector<PixelToaster::Rectangle> &dirty);
+
+    double getScale() const {
+        return scale;
+    }
+    // fraction of the frame's width and height that is drawn, up to 1
+    void setScale(double scale);
+
+    // draws one command of a list's text with cr. scale is applied on top of every transform, to draw into a
+    // scaled down frame
+    static void replay(Cairo::RefPtr<Cairo::Context> cr, const RenderCommand &command, const std::string &text,
+            double scale = 1.0);
+};
+
+#endif /* CAIRORENDERER_H_ */
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef FRAMECAPTURE_H_
+#define FRAMECAPTURE_H_
+
+#include "PixelAllocator.h"
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// writes frames to a numbered sequence of PNG files without holding up the caller. each frame is copied into
+// one of a few buffers allocated up front, and encoder threads compress and write it in the background. when
+// every buffer is still waiting to be encoded, the frame is dropped rather than waiting for one to free up.
+class FrameCapture {
+public:
+    struct Stats {
+        unsigned int captured; // frames handed to the encoders
+        unsigned int dropped;  // frames skipped because no buffer was free
+        unsigned int written;
+        unsigned int failed;
+        double bytes;          // size of the files written
+        double encodeTime;     // seconds spent encoding and writing, summed over the threads
+        double elapsed;        // seconds from the first capture until the last file was written
+    };
+
+protected:
+    struct Buffer {
+        std::vector<uint32_t, PixelAllocator<uint32_t>> pixels;
+        unsigned int frame;
+    };
+
+    const std::string prefix;
+    const int width;
+    const int height;
+    const int compression;
+
+    std::vector<Buffer> buffers;
+    std::vector<Buffer *> freeBuffers;
+    std::deque<Buffer *> queue;
+    unsigned int nextFrame;
+
+    std::vector<pthread_t> encoders;
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;
+    pthread_cond_t idle;
+    int busyEncoders;
+    bool quit;
+    // only read, so the encoders share it
+    PixelToaster::Timer timer;
+    double startTime;
+    Stats stats;
+
+    static void *encoder(void *arg);
+    void encode();
+
+public:
+    // writes width x height XRGB32 pixels, packed, to a PNG file. compression is the zlib level. returns the
+    // size of the file, or 0 on failure
+    static long writePng(const std::string &path, const uint32_t *pixels, int width, int height, int compression);
+
+    // files are named prefix-000000.png and up. compression is the zlib level, the default favors speed
+    FrameCapture(const std::string &prefix, int width, int height, int buffers = 8, int threads = 2,
+            int compression = 2);
+    // writes the frames still waiting before returning
+    ~FrameCapture();
+
+    // copies width x height XRGB32 pixels, stride bytes apart, and queues them. returns false if the frame
+    // was dropped
+    bool capture(const uint32_t *pixels, int stride);
+
+    // waits for the frames captured so far to be written
+    void finish();
+    Stats getStats();
+};
+
+#endif /* FRAMECAPTURE_H_ */
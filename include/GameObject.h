@@ -26,8 +26,9 @@
 #ifndef GAMEOBJECT_H_
 #define GAMEOBJECT_H_
 
+#include "RenderList.h"
+
 #include <chipmunk.h>
-#include <cairomm/cairomm.h>
 
 #include <algorithm>
 
@@ -84,9 +85,13 @@ public:
         return maxHP;
     }
 
+    // radius around the body's position that contains everything render() draws
+    virtual cpFloat getBoundingRadius() const = 0;
+
     virtual void init(cpSpace *space) = 0;
     virtual void sim(double t, double dt) = 0;
-    virtual void render(Cairo::RefPtr<Cairo::Context> cr, double t, double dt) = 0;
+    // records the drawing commands of the object, in body coordinates
+    virtual void render(RenderList &list, double t, double dt) = 0;
 
     virtual void damagingHit(GameObject *other, const cpVect &relVel, double t) {
         if (!alive || (other != NULL && !other->isAlive()))
@@ -27,6 +27,10 @@
 #define GAMESYS_H_
 
 #include "GameObject.h"
+#include "InputQueue.h"
+#include "ParticleSystem.h"
+#include "PerfCounters.h"
+#include "RenderList.h"
 
 #include "../PixelToaster/PixelToaster.h"
 
@@ -35,8 +39,24 @@
 #include <vector>
 #include <memory>
 #include <random>
+#include <string>
 
 class GameSys: public PixelToaster::Listener {
+public:
+    // line of overlay text, in coordinates relative to the overlay transform
+    struct HudText {
+        std::string text;
+        double size;
+        double x;
+        double y;
+        bool centered;
+        double alpha;
+
+        HudText(const std::string &text, double size, double x, double y, bool centered = true, double alpha = 1.0) :
+                text(text), size(size), x(x), y(y), centered(centered), alpha(alpha) {
+        }
+    };
+
 protected:
     enum GameState {
         WAITING,
@@ -45,7 +65,6 @@ protected:
     };
 
     double t;
-    double bgColor[3];
     cpSpace *space;
 
     int screenWidth;
@@ -53,6 +72,9 @@ protected:
     Cairo::Matrix worldToScreen;
     Cairo::Matrix screenToWorld;
 
+    // input arrives on the display's thread and is applied by sim at step boundaries
+    InputQueue input;
+    PixelToaster::Timer *simClock;
     PixelToaster::Mouse mouse;
     cpBody *mouseBody;
     cpConstraint *mouseJoint;
@@ -64,22 +86,91 @@ protected:
     cpBB bounds;
     cpShape *walls[4];
 
+    ParticleSystem particles;
+
+    // hardware counters on the sim thread, around the objects' own sim and chipmunk's step
+    PerfCounters simCounters;
+    int objectSimSection;
+    int spaceStepSection;
+    // and around PixelToaster's conversion of each frame, on whichever thread the display converts on
+    PerfCounters convertCounters;
+    int convertSection;
+
     double damageTimer;
     uint64_t score;
     GameState state;
 
     std::mt19937_64 randomGenerator;
 
+    // screen regions drawn in the last frame, and the state that decides whether a full repaint is needed
+    std::vector<HudText> hudTexts;
+    std::vector<HudText> lastHudTexts;
+    std::vector<PixelToaster::Rectangle> objectBounds;
+    std::vector<PixelToaster::Rectangle> lastObjectBounds;
+    std::vector<PixelToaster::Rectangle> hudBounds;
+    std::vector<PixelToaster::Rectangle> lastHudBounds;
+    cpVect lastScreenCenter;
+    GameState lastState;
+    bool repaintAll;
+    bool visible;
+    bool perfHudShown;
+
+    PixelToaster::Rectangle screenBounds(const Cairo::Matrix &userToScreen, const cpBB &bb) const;
+    Cairo::Matrix layoutHud(double t, std::vector<HudText> &texts) const;
+    void findDirtyBoxes(const Cairo::Matrix &hudToScreen, double dt, const PixelToaster::Rectangle &particleBounds,
+            std::vector<PixelToaster::Rectangle> &dirty);
+    void queueInput(InputQueue::Event &event);
+    void keyUp(PixelToaster::Key key);
+
 public:
     GameSys(int screenWidth, int screenHeight, const Cairo::Matrix &screenToWorld);
 
+    // timer whose time is the sim time, used to timestamp input
+    void setSimClock(PixelToaster::Timer *simClock);
+
     void init();
+
     void sim(double t, double dt);
     void cleanup();
-    void render(Cairo::RefPtr<Cairo::Context> cr, double t, double dt);
+    // nothing is going on that needs a high sim or frame rate: the player is not in a game
+    bool isIdle() const {
+        return state != RUNNING;
+    }
+    // false while the display's window is hidden, there's no point rendering then
+    bool isVisible() const {
+        return visible;
+    }
+    size_t getObjectCount() const {
+        return gameObjects.size();
+    }
+    // pairs of shapes touching in the last step
+    size_t getPairCount() const;
+    // F3 toggles the performance overlay, which main draws
+    bool isPerfHudShown() const {
+        return perfHudShown;
+    }
+    // off until enabled. sim counts the thread it runs on
+    PerfCounters &getSimCounters() {
+        return simCounters;
+    }
+    // off until enabled. the display's presentation thread converts under asynchronous presentation, so only
+    // report after the display is closed
+    PerfCounters &getConvertCounters() {
+        return convertCounters;
+    }
+    // records the drawing commands and particles of the frame, and returns the screen regions that changed since
+    // the last call. only the drawing inside those regions has to reach the screen
+    void render(RenderList &list, ParticleSystem::Snapshot &particles, double t, double dt,
+            std::vector<PixelToaster::Rectangle> &dirty);
+    // strength of the red flash after the player takes damage at time t, from 0 to 1. the flash is drawn by
+    // post-processing, not by the render list
+    double getDamageFlash(double t) const;
 
     void onMouseMove(PixelToaster::DisplayInterface &display, PixelToaster::Mouse mouse);
     void onKeyUp(PixelToaster::DisplayInterface &display, PixelToaster::Key key);
+    void onVisible(PixelToaster::DisplayInterface &display, bool visible);
+    void onConvertBegin(PixelToaster::DisplayInterface &display);
+    void onConvertEnd(PixelToaster::DisplayInterface &display, int pixels);
 
     int playerEnemyCollision(cpArbiter *arb, struct cpSpace *space);
 };
@@ -45,7 +45,11 @@ public:
 
     void init(cpSpace *space);
     void sim(double t, double dt);
-    void render(Cairo::RefPtr<Cairo::Context> cr, double t, double dt);
+    void render(RenderList &list, double t, double dt);
+
+    cpFloat getBoundingRadius() const {
+        return cpfsqrt(width * width + height * height) * 0.5;
+    }
 
     void damagingHit(GameObject *other, const cpVect &relVel, double t) {
         // hammer doesn't take damage
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef INPUTQUEUE_H_
+#define INPUTQUEUE_H_
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <atomic>
+#include <cstddef>
+
+// queue of timestamped input events with a single producer (the display's input thread) and a single
+// consumer (the sim thread). neither side takes a lock or waits for the other.
+class InputQueue {
+public:
+    struct Event {
+        enum Type {
+            MOUSE_MOVE,
+            KEY_UP
+        };
+
+        Type type;
+        double time; // sim time at which the event arrived
+        PixelToaster::Mouse mouse;
+        PixelToaster::Key key;
+    };
+
+protected:
+    static const size_t CAPACITY = 256; // power of two, so the indices can wrap around freely
+
+    Event events[CAPACITY];
+    // head and tail on separate cache lines, so the producer and consumer don't invalidate each other's
+    std::atomic<size_t> head; // next event to pop, written by the consumer only
+    char padding[64];
+    std::atomic<size_t> tail; // next free slot, written by the producer only
+
+public:
+    InputQueue();
+
+    // returns false and drops the event if the consumer has fallen behind by the whole capacity
+    bool push(const Event &event);
+    // takes the oldest event if it arrived before the given time
+    bool pop(double before, Event &event);
+};
+
+#endif /* INPUTQUEUE_H_ */
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef PARTICLESYSTEM_H_
+#define PARTICLESYSTEM_H_
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <cairomm/cairomm.h>
+#include <chipmunk.h>
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+// sparks and debris. particles live in a ring of fixed size, one array per attribute, so the sim step runs
+// over each array with vector instructions and emitting never allocates. when the ring is full, new
+// particles take the place of the oldest.
+class ParticleSystem {
+public:
+    // the particles of one frame in screen coordinates, taken while the sim is held and drawn after
+    struct Snapshot {
+        std::vector<float> x;
+        std::vector<float> y;
+        // amount taken off each channel of the pixels under the particle, 0 to 255
+        std::vector<uint32_t> ink;
+        // pixels the particles draw into, empty if there are none
+        PixelToaster::Rectangle bounds;
+
+        Snapshot();
+
+        void clear();
+        // splats each particle over the 2 x 2 pixels around it. particles darken the pixels by their ink,
+        // so on the white background they show in their own color and overlapping ones build up
+        void draw(unsigned char *data, int width, int height, int stride) const;
+    };
+
+    static const size_t CAPACITY = 1 << 17;
+    static const float GRAVITY;
+    static const float DRAG; // fraction of velocity lost per second
+
+protected:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> expireTime;
+    std::vector<float> inverseLifetime;
+    std::vector<uint32_t> ink;
+    // the live particles are the count slots before head, oldest first
+    size_t head;
+    size_t count;
+
+    std::minstd_rand random;
+
+    void integrate(size_t begin, size_t end, float dt);
+
+public:
+    ParticleSystem();
+
+    // emits count particles from pos, moving at vel plus up to speed in a random direction. color is the
+    // particle's color as r, g, b from 0 to 1
+    void emit(const cpVect &pos, const cpVect &vel, double speed, int count, double lifetime, const double color[3],
+            double t);
+    // moves the particles ahead by dt and drops the ones that expired by t
+    void sim(double t, double dt);
+    // copies the particles live at time t + dt to the snapshot, transformed to the screen. t is the time of the
+    // last step, the particles are moved ahead from there at their velocity, like the game objects are drawn
+    void snapshot(const Cairo::Matrix &worldToScreen, double t, double dt, int screenWidth, int screenHeight,
+            Snapshot &out) const;
+
+    size_t size() const {
+        return count;
+    }
+};
+
+#endif /* PARTICLESYSTEM_H_ */
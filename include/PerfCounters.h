@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// hardware event counts for sections of code, from the processor's performance counters (perf_event_open on
+// linux). wall clock time says how long a section took, these say why: few instructions per cycle with many
+// cache misses is waiting on memory, many branch misses is mispredicting.
+// counters belong to a thread. they open on the first begin after counting is enabled and count the thread
+// that called it, so an object is used from that one thread only. the counts of each section add up over its
+// runs, along with the number of items (objects, pixels) it went through, for a report per item.
+// where the counters can't be opened (another system, perf_event_paranoid, a sandbox without the system call,
+// a virtual machine without a PMU) isAvailable is false and the sections aren't counted. events that the
+// processor lacks are left out of the report.
+class PerfCounters {
+public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        BRANCH_MISSES,
+        EVENT_COUNT
+    };
+
+protected:
+    struct Section {
+        std::string name;
+        std::string itemName;
+        uint64_t counts[EVENT_COUNT];
+        // nanoseconds the events were set up for and actually counted. they differ when the kernel
+        // multiplexes more events than the processor has counters
+        uint64_t enabledTime;
+        uint64_t runningTime;
+        unsigned int runs;
+        double items;
+    };
+
+    bool enabled;
+    bool opened;
+    int fds[EVENT_COUNT]; // -1 for events that didn't open. the cycles counter leads the group
+    std::vector<Section> sections;
+    int current;
+    uint64_t startCounts[EVENT_COUNT];
+    uint64_t startEnabledTime;
+    uint64_t startRunningTime;
+
+    void open();
+    void close();
+    bool read(uint64_t counts[EVENT_COUNT], uint64_t &enabledTime, uint64_t &runningTime) const;
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // returns the section's number for begin. items are what the section goes through, "object" or "pixel"
+    int addSection(const std::string &name, const std::string &itemName);
+
+    // nothing is counted until counting is enabled
+    void setEnabled(bool enabled);
+    bool isEnabled() const {
+        return enabled;
+    }
+    // false once counting was enabled and the counters couldn't be opened
+    bool isAvailable() const {
+        return !opened || fds[CYCLES] >= 0;
+    }
+
+    void begin(int section);
+    // ends the section begun last, which went through the given number of items
+    void end(double items = 1.0);
+
+    // a line per section that ran: instructions per cycle, and events per item
+    void report(std::ostream &out) const;
+};
+
+#endif /* PERFCOUNTERS_H_ */
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef PERFHUD_H_
+#define PERFHUD_H_
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <cairomm/cairomm.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// panel of rolling graphs of where each frame's time went, with a few counts, for watching the cost of the game
+// change while it plays. the graphs are written a pixel at a time into a buffer of the panel's own and the text is
+// drawn by cairo only a few times a second, so the panel costs about the same however busy the frame is. it's
+// opaque, and copied over the finished frame
+class PerfHud {
+public:
+    enum Graph {
+        SIM,
+        RENDER,
+        PRESENT,
+        LOCK_WAIT,
+        GRAPHS
+    };
+
+    // what one frame cost, times in seconds
+    struct Sample {
+        double times[GRAPHS];
+        unsigned int steps;
+        size_t objects;
+        size_t pairs;
+    };
+
+protected:
+    static const int HISTORY = 240; // frames shown, a pixel column each
+    static const int MARGIN = 6;
+    static const int LABEL_WIDTH = 136;
+    static const int ROW_HEIGHT = 30; // a graph and the gap under it
+    static const int ROW_GAP = 4;
+    static const int COUNTS_HEIGHT = 18;
+
+    const int width;
+    const int height;
+    std::vector<uint32_t> pixels;
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    Cairo::RefPtr<Cairo::Context> cr;
+
+    std::vector<Sample> history;
+    int newest;
+    // the text shows averages over the frames since it was last made, a line per graph and one of counts. it's
+    // made as samples come in and drawn when the panel is
+    Sample total;
+    unsigned int totalFrames;
+    double lastTextTime;
+    char lines[GRAPHS + 1][64];
+    bool textChanged;
+
+    void drawGraphs();
+    void drawText();
+
+public:
+    PerfHud();
+
+    // a frame finished at time
+    void addSample(const Sample &sample, double time);
+    // where draw puts the panel in a frame of this size: its bottom left corner
+    PixelToaster::Rectangle getBounds(int frameWidth, int frameHeight) const;
+    // brings the panel up to date and copies it into the frame
+    void draw(unsigned char *frame, int frameWidth, int frameHeight, int frameStride);
+};
+
+#endif /* PERFHUD_H_ */
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef PIXELALLOCATOR_H_
+#define PIXELALLOCATOR_H_
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <cstddef>
+#include <new>
+
+// allocator for vectors of pixels: cache line aligned, and on huge pages when large. see
+// PixelToaster::allocatePixels
+template<typename T>
+class PixelAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind {
+        typedef PixelAllocator<U> other;
+    };
+
+    PixelAllocator() {
+    }
+    template<typename U>
+    PixelAllocator(const PixelAllocator<U> &) {
+    }
+
+    pointer address(reference x) const {
+        return &x;
+    }
+    const_pointer address(const_reference x) const {
+        return &x;
+    }
+    size_type max_size() const {
+        return size_type(-1) / sizeof(T);
+    }
+
+    pointer allocate(size_type n, const void * = 0) {
+        void * const p = PixelToaster::allocatePixels(n * sizeof(T));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return static_cast<pointer>(p);
+    }
+    void deallocate(pointer p, size_type) {
+        PixelToaster::freePixels(p);
+    }
+
+    void construct(pointer p, const T &value) {
+        new (p) T(value);
+    }
+    void destroy(pointer p) {
+        p->~T();
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const PixelAllocator<T> &, const PixelAllocator<U> &) {
+    return true;
+}
+template<typename T, typename U>
+inline bool operator!=(const PixelAllocator<T> &, const PixelAllocator<U> &) {
+    return false;
+}
+
+// bytes from one row of width ARGB32 pixels to the next: whole cache lines, and an odd number of them. with
+// an even number, frame widths like 1024 or 1280 put the rows a multiple of 4KB apart, so a column of pixels
+// falls into the same few cache sets
+int paddedStride(int width);
+
+#endif /* PIXELALLOCATOR_H_ */
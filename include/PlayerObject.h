@@ -44,7 +44,11 @@ public:
 
     void init(cpSpace *space);
     void sim(double t, double dt);
-    void render(Cairo::RefPtr<Cairo::Context> cr, double t, double dt);
+    void render(RenderList &list, double t, double dt);
+
+    cpFloat getBoundingRadius() const {
+        return radius;
+    }
 };
 
 #endif /* PLAYEROBJECT_H_ */
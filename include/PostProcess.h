@@ -0,0 +1,99 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef POSTPROCESS_H_
+#define POSTPROCESS_H_
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+// turns the rendered frame into the displayed one in a single pass over its pixels: each pixel is widened to
+// floating point, exposed, vignetted and lit by the damage flash, then tonemapped back to 8 bits per channel.
+// the result goes to a separate buffer, so the rendered frame stays as it is for redrawing only what changed.
+class PostProcess {
+public:
+    // per frame constants of the kernels
+    struct Constants {
+        float pixelScale;
+        float vignette;
+        float flashCenter;
+        float glow[3];
+        float inverseWhiteSquared;
+    };
+
+protected:
+    // color of the damage flash at full strength, past white so it blooms through the tonemap
+    static const float FLASH_COLOR[3];
+    // fraction of the flash that reaches the center of the screen, it grows to all of it at the corners
+    static const float FLASH_CENTER;
+
+    const unsigned char * const source;
+    unsigned char * const target;
+    const int width;
+    const int height;
+    const int sourceStride;
+    const int targetStride;
+
+    double exposure;
+    double vignette;
+    double flash;
+    // settings changed since the last frame, which has to be processed whole
+    bool changed;
+
+    // squared distance from the screen's center, split in x and y parts. the corners are at 1
+    std::vector<float> columnRadius;
+    std::vector<float> rowRadius;
+
+    // processes a row from x on, as many pixels as fill its vectors, and returns where it stopped
+    typedef int (*RowKernel)(const uint32_t *in, uint32_t *out, const float *columnRadius, float rowRadius, int x,
+            int xEnd, const Constants &constants);
+
+    Constants constants;
+    // eight or four pixels at a time, picked for the processor. null without one, the plain loop does every pixel
+    RowKernel rowKernel;
+
+    void process(const PixelToaster::Rectangle &box);
+
+public:
+    // reads width x height ARGB32 pixels from source and writes XRGB32 to target, with rows the given strides
+    // in bytes apart
+    PostProcess(const unsigned char *source, unsigned char *target, int width, int height, int sourceStride,
+            int targetStride);
+
+    // multiplies the scene's brightness
+    void setExposure(double exposure);
+    // darkening of the corners, from 0 to 1
+    void setVignette(double vignette);
+    // strength of the damage flash, from 0 to 1
+    void setFlash(double flash);
+
+    // processes the given screen regions. when a setting changed, the regions grow to the whole frame
+    void apply(std::vector<PixelToaster::Rectangle> &dirty);
+};
+
+#endif /* POSTPROCESS_H_ */
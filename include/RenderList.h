@@ -0,0 +1,135 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef RENDERLIST_H_
+#define RENDERLIST_H_
+
+#include <cairomm/cairomm.h>
+
+#include <string>
+#include <vector>
+
+// one drawing operation in screen-independent form. commands are plain data, so a list of them can be
+// recorded quickly while the sim is locked and drawn later, or kept around and drawn again.
+struct RenderCommand {
+    // state commands first, then drawing commands
+    enum Type {
+        SET_MATRIX,     // user to screen transform of the commands that follow
+        SET_COLOR,
+        SET_LINE_WIDTH, // in user units, like cairo's
+        PAINT,          // fill everything with the current color
+        RECTANGLE,
+        ARC,
+        LINE,
+        TEXT
+    };
+
+    struct Color {
+        double r, g, b, a;
+    };
+    struct Rectangle {
+        double x, y, width, height;
+        bool fill;
+    };
+    struct Arc {
+        double x, y, radius, angle1, angle2;
+        bool negative; // sweep towards decreasing angles, like cairo's arc_negative
+        bool sector;   // close the arc through its center
+        bool fill;
+    };
+    struct Line {
+        double x0, y0, x1, y1;
+    };
+    struct Text {
+        size_t offset, length; // characters in the list's text buffer
+        double size, x, y;
+        bool centered;
+    };
+
+    // screen pixels the command may touch, drawing commands only
+    struct Bounds {
+        int xBegin, xEnd, yBegin, yEnd;
+    };
+
+    Type type;
+    Bounds bounds;
+    union {
+        cairo_matrix_t matrix;
+        Color color;
+        double lineWidth;
+        Rectangle rectangle;
+        Arc arc;
+        Line line;
+        Text text;
+    };
+};
+
+// records drawing commands. transforms work like cairo's, but only reach the list with the next drawing command.
+class RenderList {
+protected:
+    std::vector<RenderCommand> commands;
+    std::string text;
+    Cairo::Matrix matrix;
+    bool matrixChanged;
+    double lineWidth;
+
+    RenderCommand &add(RenderCommand::Type type);
+    RenderCommand &draw(RenderCommand::Type type, double x0, double y0, double x1, double y1, bool stroke);
+
+public:
+    RenderList();
+
+    void clear();
+    bool empty() const {
+        return commands.empty();
+    }
+    const std::vector<RenderCommand> &getCommands() const {
+        return commands;
+    }
+    // characters of all TEXT commands
+    const std::string &getText() const {
+        return text;
+    }
+
+    const Cairo::Matrix &getMatrix() const {
+        return matrix;
+    }
+    void setMatrix(const Cairo::Matrix &matrix);
+    void translate(double x, double y);
+    void rotate(double angle);
+
+    void setColor(double r, double g, double b, double a = 1.0);
+    void setLineWidth(double width);
+
+    void paint();
+    void rectangle(double x, double y, double width, double height, bool fill);
+    void circle(double x, double y, double radius, bool fill);
+    void arc(double x, double y, double radius, double angle1, double angle2, bool negative, bool sector, bool fill);
+    void line(double x0, double y0, double x1, double y1);
+    // centered text is centered on x, y. otherwise x, -y is the top left corner
+    void showText(const std::string &s, double size, double x, double y, bool centered = true);
+};
+
+#endif /* RENDERLIST_H_ */
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef REPLAYBUFFER_H_
+#define REPLAYBUFFER_H_
+
+#include "PixelAllocator.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// keeps the last few seconds of frames in memory, to save a clip after something happened. a frame is stored
+// as the XOR of it and the frame before, compressed with zlib, in an arena of fixed size that drops the oldest
+// frames to make room. every so often a frame is stored whole instead, so the oldest frame kept can always be
+// rebuilt. copying a frame in is the only work done on the caller's thread, compressing and saving happen
+// on threads of their own.
+class ReplayBuffer {
+public:
+    struct Stats {
+        unsigned int frames;      // frames held now
+        unsigned int dropped;     // frames skipped because the compressor was still busy
+        double storedBytes;       // compressed size of the frames held
+        double rawBytes;          // their size uncompressed
+        unsigned int saves;       // clips written
+    };
+
+protected:
+    struct Record {
+        size_t offset; // in the arena
+        size_t size;
+        bool key;      // stored whole rather than as a difference
+    };
+
+    const int width;
+    const int height;
+    const size_t maxFrames;
+    const int keyInterval;
+
+    // the copy of a frame waiting to be compressed. the caller fills it while it's empty, the compressor
+    // swaps it for its own buffer once it's full
+    std::vector<uint32_t, PixelAllocator<uint32_t>> pending;
+    bool pendingFull;
+
+    // only touched by the compressor thread
+    std::vector<uint32_t, PixelAllocator<uint32_t>> current;
+    std::vector<uint32_t, PixelAllocator<uint32_t>> previous;
+    std::vector<uint32_t, PixelAllocator<uint32_t>> delta;
+    std::vector<unsigned char> compressed;
+    z_stream stream;
+    std::vector<unsigned char> arena;
+    std::deque<Record> records;
+    size_t writeOffset;
+    size_t storedBytes;
+    // frames stored since the last whole one. past keyInterval, the next frame is stored whole
+    int framesSinceKey;
+
+    // the frames being saved, copied out of the arena so compressing goes on meanwhile
+    std::vector<unsigned char> clip;
+    std::vector<Record> clipRecords;
+    std::string clipPrefix;
+
+    pthread_t compressor;
+    pthread_t saver;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t clipCond;
+    bool clipRequested; // the compressor is to copy the frames held to the clip
+    bool clipReady;     // the saver is to write the clip
+    bool saving;        // from the request until the clip is written
+    bool quit;
+    bool stopSaver;
+    Stats stats;
+
+    static void *compressorMain(void *arg);
+    static void *saverMain(void *arg);
+    void compressFrames();
+    void saveClips();
+    void compressFrame();
+    void store(bool key);
+    void copyClip();
+    void writeClip();
+    void dropOldest();
+
+public:
+    // holds up to maxFrames frames of width x height, in arenaBytes of compressed data
+    ReplayBuffer(int width, int height, size_t maxFrames, size_t arenaBytes = 64 << 20, int keyInterval = 120);
+    ~ReplayBuffer();
+
+    // copies width x height XRGB32 pixels, stride bytes apart. returns false if the frame was dropped
+    bool record(const uint32_t *pixels, int stride);
+    // writes the frames held now to prefix-000000.png and up, oldest first, in the background. returns false
+    // if the last clip is still being written
+    bool saveClip(const std::string &prefix);
+
+    Stats getStats();
+};
+
+#endif /* REPLAYBUFFER_H_ */
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef RESOLUTIONSCALER_H_
+#define RESOLUTIONSCALER_H_
+
+// picks the render scale that keeps frames within a target time. drawing cost goes with the number of pixels,
+// so with the square of the scale. the scale steps down only after frames were slow for a while, and steps back
+// up only once the bigger scale is predicted to fit comfortably, so it doesn't flip back and forth.
+class ResolutionScaler {
+public:
+    struct Stats {
+        double scale;
+        double lowestScale;
+        double averageFrameTime;
+        unsigned int scaleChanges;
+        unsigned int frames;
+    };
+
+protected:
+    static const int HOLD_FRAMES = 30; // frames to wait after a change before judging the new scale
+
+    const double targetFrameTime;
+    const double minScale;
+    double scale;
+    double averageFrameTime;
+    int framesSinceChange;
+    Stats stats;
+
+    void changeScale(double newScale);
+
+public:
+    // scales are multiples of 1 / STEPS between minScale and 1
+    static const int STEPS = 16;
+
+    ResolutionScaler(double targetFrameTime, double minScale = 0.5);
+
+    // feeds the time the last frame took to draw at the current scale, upscaling included. only time that goes
+    // with the number of pixels drawn belongs here. returns true if the scale changed
+    bool frameDone(double frameTime);
+
+    double getScale() const {
+        return scale;
+    }
+    const Stats &getStats() const {
+        return stats;
+    }
+};
+
+#endif /* RESOLUTIONSCALER_H_ */
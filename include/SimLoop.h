@@ -38,8 +38,13 @@ class SimLoop {
 protected:
     GameSys *gameSys;
     const double dt;
+    const double idleDt;
     volatile double t;
     volatile bool simRun;
+    volatile bool hidden;
+    // time spent in steps and steps taken since start, changed only while the sim lock is held
+    double stepTime;
+    unsigned int steps;
     std::atomic<int> simLock;
     std::atomic<int> simLockReaders;
     pthread_t simThread;
@@ -51,18 +56,30 @@ protected:
     void releaseSimLock();
 
 public:
-    SimLoop(GameSys *gameSys, double dt);
+    // while the game is idle or hidden, the loop wakes up only every idleDt and catches up on the steps it missed
+    SimLoop(GameSys *gameSys, double dt, double idleDt = 1.0 / 30);
 
     void start();
     void stop();
     void acquireRenderLock();
     void releaseRenderLock();
+    void setHidden(bool hidden) {
+        this->hidden = hidden;
+    }
+
     double getLastSimTime() const {
         return t;
     }
     double getRealTime() {
         return timer.time();
     }
+    // read while holding the render lock; the differences between two frames are what the frame cost the sim
+    double getStepTime() const {
+        return stepTime;
+    }
+    unsigned int getSteps() const {
+        return steps;
+    }
 };
 
 #endif /* SIMLOOP_H_ */
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#ifndef XLIBRENDERER_H_
+#define XLIBRENDERER_H_
+
+#include "RenderList.h"
+
+#include "../PixelToaster/PixelToaster.h"
+
+#include <cairomm/cairomm.h>
+
+#include <vector>
+
+// xlib's Display, without the X headers and their macros
+struct _XDisplay;
+
+// draws recorded render lists with cairo's xlib backend instead of into memory. the frame is drawn into a pixmap
+// on the X server, which keeps it for redrawing only what changed, and the dirty boxes are copied from there to
+// the display's window. with the RENDER extension the server does the drawing itself, so no pixels go through
+// the connection. the renderer has an X connection of its own, and the display has to present externally (see
+// PixelToaster::Presentation) or it paints over the window.
+// only works where cairo was built with its xlib surface, see isSupported. the cairo in extern/ wasn't, so built
+// against it this class is a stub and the game always draws in memory.
+class XlibRenderer {
+protected:
+    const int width;
+    const int height;
+
+    _XDisplay *connection;
+    unsigned long window;
+    unsigned long pixmap;
+    Cairo::RefPtr<Cairo::Surface> surface;
+    Cairo::RefPtr<Cairo::Context> cr;
+    // draws the pixmap into the window
+    Cairo::RefPtr<Cairo::Surface> windowSurface;
+    Cairo::RefPtr<Cairo::Context> windowCr;
+    // parts of the window the server cleared, which are copied again
+    std::vector<PixelToaster::Rectangle> exposed;
+
+    void handleEvents();
+
+public:
+    // draws into the window with the given native handle (see PixelToaster::Display::handle)
+    XlibRenderer(void *handle, int width, int height);
+    ~XlibRenderer();
+
+    // false if the X server couldn't be reached or the window is gone
+    bool isValid() const {
+        return connection != NULL;
+    }
+
+    // draws the list into the given screen regions and shows them, along with whatever the window lost. returns
+    // once the server is done, which paces frames like blocking presentation does
+    void draw(const RenderList &list, const std::vector<PixelToaster::Rectangle> &dirty);
+
+    // whether cairo has the xlib surface in this build
+    static bool isSupported();
+};
+
+#endif /* XLIBRENDERER_H_ */
@@ -0,0 +1,211 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "AllocationTracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+struct Phase {
+    const char *name;
+    atomic<bool> allocationFree;
+    atomic<unsigned long long> allocations;
+    atomic<unsigned long long> bytes;
+    atomic<unsigned long long> runs;
+};
+
+// static storage with constant initialization, ready before the first allocation of the program
+static Phase phases[AllocationTracker::MAX_PHASES];
+static atomic<int> phaseCount(0);
+
+static const int MAX_DEPTH = 8;
+static __thread int phaseStack[MAX_DEPTH];
+static __thread int depth;
+
+int AllocationTracker::addPhase(const char *name) {
+    const int phase = phaseCount.load();
+    if (phase >= MAX_PHASES) {
+        return -1;
+    }
+    phases[phase].name = name;
+    phaseCount.store(phase + 1);
+    return phase;
+}
+
+void AllocationTracker::enter(int phase) {
+    // phases nested deeper than the stack count toward the deepest one it holds
+    if (depth < MAX_DEPTH) {
+        phaseStack[depth] = phase;
+    }
+    depth++;
+}
+
+void AllocationTracker::leave() {
+    if (depth == 0) {
+        return;
+    }
+    depth--;
+    if (depth < MAX_DEPTH && phaseStack[depth] >= 0) {
+        phases[phaseStack[depth]].runs.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void AllocationTracker::setAllocationFree(const string &names) {
+    size_t begin = 0;
+    while (begin <= names.size()) {
+        const size_t end = min(names.find(',', begin), names.size());
+        const string name = names.substr(begin, end - begin);
+        for (int i = 0; i < phaseCount.load(); i++) {
+            if (name == phases[i].name) {
+                phases[i].allocationFree.store(true);
+            }
+        }
+        begin = end + 1;
+    }
+}
+
+void AllocationTracker::report(ostream &out) {
+    if (!isBuiltIn()) {
+        return;
+    }
+    for (int i = 0; i < phaseCount.load(); i++) {
+        const Phase &phase = phases[i];
+        const unsigned long long runs = phase.runs.load();
+        if (runs == 0) {
+            continue;
+        }
+        out << "allocations in " << phase.name << ": " << double(phase.allocations.load()) / runs << " per run, "
+                << double(phase.bytes.load()) / runs << " bytes per run (" << runs << " runs)" << endl;
+    }
+}
+
+#ifdef CONKERS_TRACK_ALLOCATIONS
+
+bool AllocationTracker::isBuiltIn() {
+    return true;
+}
+
+// set while an allocation is being reported, which may allocate in turn
+static __thread bool reporting;
+
+static void track(size_t size) {
+    if (depth == 0 || reporting) {
+        return;
+    }
+    const int index = phaseStack[min(depth, MAX_DEPTH) - 1];
+    if (index < 0) {
+        return;
+    }
+    Phase &phase = phases[index];
+    phase.allocations.fetch_add(1, memory_order_relaxed);
+    phase.bytes.fetch_add(size, memory_order_relaxed);
+    if (phase.allocationFree.load(memory_order_relaxed)) {
+        reporting = true;
+        fprintf(stderr, "allocation of %lu bytes in allocation-free phase %s\n", (unsigned long) size, phase.name);
+        abort();
+    }
+}
+
+#ifdef __GLIBC__
+
+// the program's own malloc takes the place of the C library's for every library it loads. glibc keeps its
+// allocator under these names
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+    track(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    track(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size) {
+    track(size);
+    return __libc_realloc(p, size);
+}
+}
+
+#else
+
+// without a way into the C library's malloc, only C++ allocations are seen
+
+void *operator new(size_t size) {
+    track(size);
+    void * const p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept {
+    track(size);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept {
+    return operator new(size, nothrow);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, const nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, const nothrow_t &) noexcept {
+    free(p);
+}
+
+#endif
+
+#else
+
+bool AllocationTracker::isBuiltIn() {
+    return false;
+}
+
+#endif
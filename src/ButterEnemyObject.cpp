@@ -26,7 +26,6 @@
 #include "ButterEnemyObject.h"
 
 using namespace std;
-using namespace Cairo;
 
 ButterEnemyObject::ButterEnemyObject(shared_ptr<GameObject> player, cpFloat mass, cpFloat size, const cpVect &pos) :
         GameObject(mass, cpMomentForBox(mass, size, size), pos), width(size), height(size), player(player) {
@@ -52,16 +51,16 @@ void ButterEnemyObject::sim(double t, double dt) {
     cpBodyApplyForce(body, rocketAccel, cpvzero);
 }
 
-void ButterEnemyObject::render(RefPtr<Context> cr, double t, double dt) {
+void ButterEnemyObject::render(RenderList &list, double t, double dt) {
     const double alpha = cpflerp(0.0, 0.6, cpfclamp01(expireTime - t));
-    cr->set_source_rgba(0.0, 0.0, 0.0, alpha);
+    list.setColor(0.0, 0.0, 0.0, alpha);
     const double lineWidth = 1.5;
-    cr->set_line_width(lineWidth);
-    cr->rectangle(-width * 0.5 + lineWidth * 0.5,
+    list.setLineWidth(lineWidth);
+    list.rectangle(-width * 0.5 + lineWidth * 0.5,
             -height * 0.5 + lineWidth * 0.5,
             width - lineWidth,
-            height - lineWidth);
-    cr->stroke();
+            height - lineWidth,
+            false);
 }
 
 void ButterEnemyObject::damagingHit(GameObject *other, const cpVect &relVel, double t) {
@@ -0,0 +1,517 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "CairoRenderer.h"
+#include "AllocationTracker.h"
+
+// the streaming fills are built for their instruction sets whatever the compiler targets, and picked at run time.
+// the attribute also realigns the stack, which 32 bit windows keeps only 4 byte aligned
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define TARGET(instructionSet) __attribute__((target(instructionSet), force_align_arg_pointer))
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Cairo;
+
+static const int DRAW_PHASE = AllocationTracker::addPhase("cairo tiles");
+
+static bool overlaps(const RenderCommand::Bounds &a, const PixelToaster::Rectangle &b) {
+    return a.xBegin < b.xEnd && b.xBegin < a.xEnd && a.yBegin < b.yEnd && b.yBegin < a.yEnd;
+}
+
+// opaque ARGB32 pixel of a color, rounded the way cairo does it through 16 bits per channel
+static uint32_t toPixel(const RenderCommand::Color &color) {
+    const double channels[] = { color.r, color.g, color.b };
+    uint32_t pixel = 0xff000000;
+    for (int i = 0; i < 3; i++) {
+        const uint32_t channel = uint32_t(min(max(channels[i], 0.0), 1.0) * 65535.0 + 0.5) >> 8;
+        pixel |= channel << (16 - 8 * i);
+    }
+    return pixel;
+}
+
+// sets a box of ARGB32 pixels to one value. the stores bypass the cache: most of a cleared frame is
+// background that isn't touched again, and it shouldn't push out what the tiles are drawing with
+typedef void (*FillFunction)(unsigned char *data, int stride, const PixelToaster::Rectangle &box, uint32_t pixel);
+
+static void fillScalar(unsigned char *data, int stride, const PixelToaster::Rectangle &box, uint32_t pixel) {
+    for (int y = box.yBegin; y < box.yEnd; y++) {
+        uint32_t * const row = (uint32_t *) (data + y * stride);
+        fill(row + box.xBegin, row + box.xEnd, pixel);
+    }
+}
+
+#ifdef TARGET
+
+TARGET("avx2") static void fillAvx2(unsigned char *data, int stride, const PixelToaster::Rectangle &box,
+        uint32_t pixel) {
+    const __m256i value = _mm256_set1_epi32(int(pixel));
+    for (int y = box.yBegin; y < box.yEnd; y++) {
+        uint32_t *p = (uint32_t *) (data + y * stride) + box.xBegin;
+        uint32_t * const end = (uint32_t *) (data + y * stride) + box.xEnd;
+        for (; p < end && (uintptr_t(p) & 31) != 0; p++) {
+            *p = pixel;
+        }
+        for (; end - p >= 8; p += 8) {
+            _mm256_stream_si256((__m256i *) p, value);
+        }
+        for (; p < end; p++) {
+            *p = pixel;
+        }
+    }
+    // streaming stores are weakly ordered, cairo must see them before it draws over them
+    _mm_sfence();
+}
+
+TARGET("sse2") static void fillSse2(unsigned char *data, int stride, const PixelToaster::Rectangle &box,
+        uint32_t pixel) {
+    const __m128i value = _mm_set1_epi32(int(pixel));
+    for (int y = box.yBegin; y < box.yEnd; y++) {
+        uint32_t *p = (uint32_t *) (data + y * stride) + box.xBegin;
+        uint32_t * const end = (uint32_t *) (data + y * stride) + box.xEnd;
+        for (; p < end && (uintptr_t(p) & 15) != 0; p++) {
+            *p = pixel;
+        }
+        for (; end - p >= 4; p += 4) {
+            _mm_stream_si128((__m128i *) p, value);
+        }
+        for (; p < end; p++) {
+            *p = pixel;
+        }
+    }
+    _mm_sfence();
+}
+
+#endif
+
+static FillFunction pickFill() {
+    switch (PixelToaster::detectInstructionSet()) {
+#ifdef TARGET
+    case PixelToaster::InstructionSet::AVX2:
+        return fillAvx2;
+    case PixelToaster::InstructionSet::SSSE3:
+    case PixelToaster::InstructionSet::SSE2:
+        return fillSse2;
+#endif
+    default:
+        return fillScalar;
+    }
+}
+
+static const FillFunction fillKernel = pickFill();
+
+void CairoRenderer::replay(RefPtr<Context> cr, const RenderCommand &command, const string &text, double scale) {
+    switch (command.type) {
+    case RenderCommand::SET_MATRIX: {
+        cairo_matrix_t matrix = command.matrix;
+        if (scale != 1.0) {
+            matrix.xx *= scale;
+            matrix.yx *= scale;
+            matrix.xy *= scale;
+            matrix.yy *= scale;
+            matrix.x0 *= scale;
+            matrix.y0 *= scale;
+        }
+        cr->set_matrix(matrix);
+        break;
+    }
+
+    case RenderCommand::SET_COLOR:
+        cr->set_source_rgba(command.color.r, command.color.g, command.color.b, command.color.a);
+        break;
+
+    case RenderCommand::SET_LINE_WIDTH:
+        cr->set_line_width(command.lineWidth);
+        break;
+
+    case RenderCommand::PAINT:
+        cr->paint();
+        break;
+
+    case RenderCommand::RECTANGLE: {
+        const RenderCommand::Rectangle &rectangle = command.rectangle;
+        cr->rectangle(rectangle.x, rectangle.y, rectangle.width, rectangle.height);
+        if (rectangle.fill) {
+            cr->fill();
+        } else {
+            cr->stroke();
+        }
+        break;
+    }
+
+    case RenderCommand::ARC: {
+        const RenderCommand::Arc &arc = command.arc;
+        if (arc.sector) {
+            cr->move_to(arc.x, arc.y);
+        }
+        if (arc.negative) {
+            cr->arc_negative(arc.x, arc.y, arc.radius, arc.angle1, arc.angle2);
+        } else {
+            cr->arc(arc.x, arc.y, arc.radius, arc.angle1, arc.angle2);
+        }
+        if (arc.fill) {
+            cr->fill();
+        } else {
+            cr->stroke();
+        }
+        break;
+    }
+
+    case RenderCommand::LINE:
+        cr->move_to(command.line.x0, command.line.y0);
+        cr->line_to(command.line.x1, command.line.y1);
+        cr->stroke();
+        break;
+
+    case RenderCommand::TEXT: {
+        const RenderCommand::Text &t = command.text;
+        const string s = text.substr(t.offset, t.length);
+        cr->set_font_size(t.size);
+        TextExtents te;
+        cr->get_text_extents(s, te);
+        if (t.centered) {
+            cr->move_to(t.x - te.width / 2 - te.x_bearing, t.y - te.height / 2 - te.y_bearing);
+        } else {
+            cr->move_to(t.x - te.x_bearing, -t.y - te.y_bearing);
+        }
+        cr->show_text(s);
+        break;
+    }
+    }
+}
+
+CairoRenderer::CairoRenderer(unsigned char *data, int width, int height, int stride, int threads) :
+        frame(data),
+                width(width),
+                height(height),
+                stride(stride),
+                tileSize(TILE_SIZE),
+                scale(1.0),
+                scaledWidth(width),
+                scaledHeight(height),
+                repaintAll(false),
+                font(ToyFontFace::create("Gotham Rounded Bold", FONT_SLANT_NORMAL, FONT_WEIGHT_NORMAL)),
+                generation(0),
+                busyWorkers(0),
+                quit(false),
+                nextTile(0),
+                list(NULL),
+                dirty(NULL),
+                clearIndex(0),
+                clearPixel(0) {
+    if (threads <= 0) {
+        threads = PixelToaster::processorCount();
+    }
+
+    // a single thread gains nothing from tiles, it draws the frame in one piece
+    if (threads == 1) {
+        tileSize = max(width, height);
+    }
+    createTiles(frame, width, height);
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&frameStarted, NULL);
+    pthread_cond_init(&frameDone, NULL);
+
+    threads = min(threads, int(tiles.size()));
+    for (int i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, this) != 0)
+            break;
+        workers.push_back(thread);
+    }
+}
+
+CairoRenderer::~CairoRenderer() {
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_broadcast(&frameStarted);
+    pthread_mutex_unlock(&mutex);
+    for (pthread_t thread : workers) {
+        pthread_join(thread, NULL);
+    }
+
+    pthread_cond_destroy(&frameDone);
+    pthread_cond_destroy(&frameStarted);
+    pthread_mutex_destroy(&mutex);
+}
+
+void *CairoRenderer::worker(void *arg) {
+    static_cast<CairoRenderer *>(arg)->work();
+    return NULL;
+}
+
+void CairoRenderer::work() {
+    unsigned int seen = 0;
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        while (!quit && generation == seen)
+            pthread_cond_wait(&frameStarted, &mutex);
+        if (quit)
+            break;
+        seen = generation;
+        pthread_mutex_unlock(&mutex);
+
+        drawTiles();
+
+        pthread_mutex_lock(&mutex);
+        if (--busyWorkers == 0)
+            pthread_cond_signal(&frameDone);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void CairoRenderer::createTiles(unsigned char *data, int width, int height) {
+    tiles.clear();
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            Tile tile;
+            tile.box = PixelToaster::Rectangle(x, min(x + tileSize, width), y, min(y + tileSize, height));
+            tile.screenBox = PixelToaster::Rectangle(int(floor(tile.box.xBegin / scale)) - 1,
+                    int(ceil(tile.box.xEnd / scale)) + 1,
+                    int(floor(tile.box.yBegin / scale)) - 1,
+                    int(ceil(tile.box.yEnd / scale)) + 1);
+            tile.surface = ImageSurface::create(data + y * stride + x * 4,
+                    FORMAT_ARGB32,
+                    tile.box.xEnd - tile.box.xBegin,
+                    tile.box.yEnd - tile.box.yBegin,
+                    stride);
+            // the tile's surface is addressed like the whole buffer, so commands replay unchanged
+            tile.surface->set_device_offset(-x, -y);
+            tile.cr = Context::create(tile.surface);
+            tile.cr->set_font_face(font);
+            tiles.push_back(tile);
+        }
+    }
+}
+
+void CairoRenderer::setScale(double scale) {
+    scale = min(scale, 1.0);
+    const int newWidth = max(int(ceil(width * scale)), 2);
+    const int newHeight = max(int(ceil(height * scale)), 2);
+    if (newWidth == scaledWidth && newHeight == scaledHeight) {
+        return;
+    }
+
+    this->scale = scale;
+    scaledWidth = newWidth;
+    scaledHeight = newHeight;
+    repaintAll = true;
+
+    if (scale == 1.0) {
+        scaledPixels.clear();
+        createTiles(frame, width, height);
+        return;
+    }
+
+    // same stride as the frame, so the buffer never has to grow
+    scaledPixels.resize(size_t(stride) * height);
+    createTiles(&scaledPixels[0], scaledWidth, scaledHeight);
+
+    // sample the scaled buffer at the centers of the frame's pixels. the last source column or row is
+    // reached as the second of a pair, so the filter never reads past the buffer
+    const double xRatio = double(scaledWidth) / width;
+    const double yRatio = double(scaledHeight) / height;
+    columnIndex.resize(width);
+    columnWeight.resize(width);
+    for (int x = 0; x < width; x++) {
+        const double u = min(max((x + 0.5) * xRatio - 0.5, 0.0), scaledWidth - 1.0);
+        columnIndex[x] = min(int(u), scaledWidth - 2);
+        columnWeight[x] = int((u - columnIndex[x]) * 256 + 0.5);
+    }
+    rowIndex.resize(height);
+    rowWeight.resize(height);
+    for (int y = 0; y < height; y++) {
+        const double v = min(max((y + 0.5) * yRatio - 0.5, 0.0), scaledHeight - 1.0);
+        rowIndex[y] = min(int(v), scaledHeight - 2);
+        rowWeight[y] = int((v - rowIndex[y]) * 256 + 0.5);
+    }
+}
+
+// bilinear filter of the scaled buffer into a box of the frame, in 8 bit fixed point per channel
+void CairoRenderer::upscale(const PixelToaster::Rectangle &box) {
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+#endif
+    for (int y = box.yBegin; y < box.yEnd; y++) {
+        const uint32_t * const row0 = (const uint32_t *) (&scaledPixels[0] + rowIndex[y] * stride);
+        const uint32_t * const row1 = (const uint32_t *) ((const unsigned char *) row0 + stride);
+        uint32_t * const out = (uint32_t *) (frame + y * stride);
+        const int wy = rowWeight[y];
+#ifdef __SSE2__
+        const __m128i wy0 = _mm_set1_epi16(short(256 - wy));
+        const __m128i wy1 = _mm_set1_epi16(short(wy));
+        for (int x = box.xBegin; x < box.xEnd; x++) {
+            const int i = columnIndex[x];
+            const int wx = columnWeight[x];
+            // the two pixels of each row side by side, one channel per 16 bit lane
+            const __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (row0 + i)), zero);
+            const __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (row1 + i)), zero);
+            const __m128i column = _mm_srli_epi16(
+                    _mm_add_epi16(_mm_mullo_epi16(top, wy0), _mm_mullo_epi16(bottom, wy1)), 8);
+            __m128i blend = _mm_mullo_epi16(column, _mm_set_epi16(wx, wx, wx, wx, 256 - wx, 256 - wx, 256 - wx, 256 - wx));
+            blend = _mm_srli_epi16(_mm_add_epi16(blend, _mm_srli_si128(blend, 8)), 8);
+            out[x] = uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(blend, blend)));
+        }
+#else
+        for (int x = box.xBegin; x < box.xEnd; x++) {
+            const int i = columnIndex[x];
+            const int wx = columnWeight[x];
+            uint32_t pixel = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                const uint32_t left = (((row0[i] >> shift) & 0xff) * (256 - wy) + ((row1[i] >> shift) & 0xff) * wy) >> 8;
+                const uint32_t right = (((row0[i + 1] >> shift) & 0xff) * (256 - wy) + ((row1[i + 1] >> shift) & 0xff) * wy) >> 8;
+                pixel |= ((left * (256 - wx) + right * wx) >> 8) << shift;
+            }
+            out[x] = pixel;
+        }
+#endif
+    }
+}
+
+// a run of the allocation phase is one thread's share of a frame
+void CairoRenderer::drawTiles() {
+    AllocationTracker::enter(DRAW_PHASE);
+    for (size_t i = nextTile++; i < tiles.size(); i = nextTile++) {
+        drawTile(tiles[i]);
+    }
+    AllocationTracker::leave();
+}
+
+void CairoRenderer::drawTile(Tile &tile) {
+    RefPtr<Context> cr = tile.cr;
+
+    // only touch pixels inside the dirty boxes
+    tile.clip.clear();
+    for (const PixelToaster::Rectangle &box : *dirty) {
+        const int xBegin = max(box.xBegin, tile.box.xBegin);
+        const int xEnd = min(box.xEnd, tile.box.xEnd);
+        const int yBegin = max(box.yBegin, tile.box.yBegin);
+        const int yEnd = min(box.yEnd, tile.box.yEnd);
+        if (xBegin < xEnd && yBegin < yEnd) {
+            cr->rectangle(xBegin, yBegin, xEnd - xBegin, yEnd - yBegin);
+            tile.clip.push_back(PixelToaster::Rectangle(xBegin - tile.box.xBegin, xEnd - tile.box.xBegin,
+                    yBegin - tile.box.yBegin, yEnd - tile.box.yBegin));
+        }
+    }
+    if (tile.clip.empty()) {
+        return;
+    }
+
+    cr->save();
+    cr->clip();
+
+    const string &text = list->getText();
+    const vector<RenderCommand> &commands = list->getCommands();
+    const size_t firstDrawn = clearIndex < commands.size() ? clearIndex + 1 : 0;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const RenderCommand &command = commands[i];
+        const bool drawing = command.type >= RenderCommand::PAINT;
+        if (i == clearIndex) {
+            tile.surface->flush();
+            for (const PixelToaster::Rectangle &box : tile.clip) {
+                fillKernel(tile.surface->get_data(), stride, box, clearPixel);
+            }
+            tile.surface->mark_dirty();
+        } else if (!drawing || (i >= firstDrawn && overlaps(command.bounds, tile.screenBox))) {
+            replay(cr, command, text, scale);
+        }
+    }
+
+    cr->restore();
+}
+
+void CairoRenderer::draw(const RenderList &list, vector<PixelToaster::Rectangle> &dirty) {
+    if (dirty.empty()) {
+        return;
+    }
+    if (repaintAll) {
+        dirty.assign(1, PixelToaster::Rectangle(0, width, 0, height));
+        repaintAll = false;
+    }
+
+    // the scaled buffer is drawn wherever the filter reads from for the dirty boxes
+    if (scale < 1.0) {
+        scaledDirty.clear();
+        for (const PixelToaster::Rectangle &box : dirty) {
+            scaledDirty.push_back(PixelToaster::Rectangle(max(int(floor(box.xBegin * scale)) - 1, 0),
+                    min(int(ceil(box.xEnd * scale)) + 2, scaledWidth),
+                    max(int(floor(box.yBegin * scale)) - 1, 0),
+                    min(int(ceil(box.yEnd * scale)) + 2, scaledHeight)));
+        }
+    }
+
+    // an opaque paint covers everything drawn before it, so that is skipped and each background pixel
+    // is written once
+    const vector<RenderCommand> &commands = list.getCommands();
+    clearIndex = commands.size();
+    clearPixel = 0;
+    // cairo's default source is opaque black
+    RenderCommand::Color color = { 0.0, 0.0, 0.0, 1.0 };
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (commands[i].type == RenderCommand::SET_COLOR) {
+            color = commands[i].color;
+        } else if (commands[i].type == RenderCommand::PAINT && color.a >= 1.0) {
+            clearIndex = i;
+            clearPixel = toPixel(color);
+        }
+    }
+
+    this->list = &list;
+    this->dirty = scale < 1.0 ? &scaledDirty : &dirty;
+    nextTile = 0;
+
+    pthread_mutex_lock(&mutex);
+    generation++;
+    busyWorkers = int(workers.size());
+    pthread_cond_broadcast(&frameStarted);
+    pthread_mutex_unlock(&mutex);
+
+    drawTiles();
+
+    pthread_mutex_lock(&mutex);
+    while (busyWorkers > 0)
+        pthread_cond_wait(&frameDone, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    // the pixels are read next, make sure cairo is done with them
+    for (Tile &tile : tiles) {
+        tile.surface->flush();
+    }
+
+    if (scale < 1.0) {
+        for (PixelToaster::Rectangle box : dirty) {
+            box.xBegin = max(box.xBegin, 0);
+            box.xEnd = min(box.xEnd, width);
+            box.yBegin = max(box.yBegin, 0);
+            box.yEnd = min(box.yEnd, height);
+            upscale(box);
+        }
+    }
+}
@@ -0,0 +1,210 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "FrameCapture.h"
+
+#include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+FrameCapture::FrameCapture(const string &prefix, int width, int height, int buffers, int threads, int compression) :
+        prefix(prefix),
+                width(width),
+                height(height),
+                compression(compression),
+                buffers(max(buffers, 1)),
+                nextFrame(0),
+                busyEncoders(0),
+                quit(false),
+                startTime(-1.0) {
+    for (Buffer &buffer : this->buffers) {
+        buffer.pixels.resize(size_t(width) * height);
+        buffer.frame = 0;
+        freeBuffers.push_back(&buffer);
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&queued, NULL);
+    pthread_cond_init(&idle, NULL);
+
+    for (int i = 0; i < max(threads, 1); i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, encoder, this) != 0)
+            break;
+        encoders.push_back(thread);
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    finish();
+
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&mutex);
+    for (pthread_t thread : encoders) {
+        pthread_join(thread, NULL);
+    }
+
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&queued);
+    pthread_mutex_destroy(&mutex);
+}
+
+void *FrameCapture::encoder(void *arg) {
+    static_cast<FrameCapture *>(arg)->encode();
+    return NULL;
+}
+
+void FrameCapture::encode() {
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        while (!quit && queue.empty())
+            pthread_cond_wait(&queued, &mutex);
+        if (queue.empty())
+            break;
+        Buffer * const buffer = queue.front();
+        queue.pop_front();
+        busyEncoders++;
+        pthread_mutex_unlock(&mutex);
+
+        char name[32];
+        snprintf(name, sizeof(name), "-%06u.png", buffer->frame);
+        const double start = timer.time();
+        const long size = writePng(prefix + name, &buffer->pixels[0], width, height, compression);
+        const double end = timer.time();
+
+        pthread_mutex_lock(&mutex);
+        busyEncoders--;
+        freeBuffers.push_back(buffer);
+        if (size > 0) {
+            stats.written++;
+            stats.bytes += size;
+        } else {
+            stats.failed++;
+        }
+        stats.encodeTime += end - start;
+        stats.elapsed = end - startTime;
+        if (queue.empty() && busyEncoders == 0)
+            pthread_cond_broadcast(&idle);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+long FrameCapture::writePng(const string &path, const uint32_t *pixels, int width, int height, int compression) {
+    FILE * const file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return 0;
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        remove(path.c_str());
+        return 0;
+    }
+
+    png_init_io(png, file);
+    // frames are mostly flat color. the sub filter turns runs of it into zeros, which run length encoding
+    // packs about as well as a full search for matches, at a fraction of the time
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+    png_set_compression_level(png, compression);
+    png_set_compression_strategy(png, Z_RLE);
+    png_set_IHDR(png,
+            info,
+            width,
+            height,
+            8,
+            PNG_COLOR_TYPE_RGB,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_BASE,
+            PNG_FILTER_TYPE_BASE);
+    png_write_info(png, info);
+    // the pixels are B, G, R, X in memory
+    png_set_bgr(png);
+    png_set_filler(png, 0, PNG_FILLER_AFTER);
+
+    for (int y = 0; y < height; y++) {
+        png_write_row(png, (png_bytep) (pixels + size_t(y) * width));
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+
+    const long size = ftell(file);
+    return fclose(file) == 0 ? size : 0;
+}
+
+bool FrameCapture::capture(const uint32_t *pixels, int stride) {
+    pthread_mutex_lock(&mutex);
+    if (startTime < 0.0) {
+        startTime = timer.time();
+    }
+    const unsigned int frame = nextFrame++;
+    if (freeBuffers.empty()) {
+        stats.dropped++;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    Buffer * const buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    pthread_mutex_unlock(&mutex);
+
+    // the copy is the only work done on the caller's thread
+    for (int y = 0; y < height; y++) {
+        memcpy(&buffer->pixels[size_t(y) * width],
+                (const unsigned char *) pixels + size_t(y) * stride,
+                width * sizeof(uint32_t));
+    }
+    buffer->frame = frame;
+
+    pthread_mutex_lock(&mutex);
+    queue.push_back(buffer);
+    stats.captured++;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void FrameCapture::finish() {
+    pthread_mutex_lock(&mutex);
+    while (!encoders.empty() && (!queue.empty() || busyEncoders > 0))
+        pthread_cond_wait(&idle, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
+FrameCapture::Stats FrameCapture::getStats() {
+    pthread_mutex_lock(&mutex);
+    const Stats copy = stats;
+    pthread_mutex_unlock(&mutex);
+    return copy;
+}
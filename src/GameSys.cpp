@@ -24,6 +24,7 @@
  */
 
 #include "GameSys.h"
+#include "AllocationTracker.h"
 #include "PlayerObject.h"
 #include "HammerObject.h"
 #include "ButterEnemyObject.h"
@@ -37,19 +38,38 @@ using namespace std;
 using namespace Cairo;
 using namespace PixelToaster;
 
+static const int SIM_STEP_PHASE = AllocationTracker::addPhase("sim step");
+static const int OBJECT_SIM_PHASE = AllocationTracker::addPhase("object sim");
+static const int SPACE_STEP_PHASE = AllocationTracker::addPhase("cpSpaceStep");
+
+// the damage flash is drawn by post-processing, the background itself never changes
+static const double BACKGROUND_COLOR[3] = { 1.0, 1.0, 1.0 };
+static const double SPARK_COLOR[3] = { 1.0, 0.6, 0.1 };
+static const double DEBRIS_COLOR[3] = { 0.2, 0.2, 0.2 };
+
 GameSys::GameSys(int screenWidth, int screenHeight, const Matrix &worldToScreen) :
         t(0.0),
-                bgColor( { 1.0, 1.0, 1.0 }),
                 screenWidth(screenWidth),
                 screenHeight(screenHeight),
                 worldToScreen(worldToScreen),
                 screenToWorld(worldToScreen),
+                simClock(NULL),
                 screenCenter(cpvzero),
                 bounds(cpBBNew(-105, -90, 105, 90)),
+                objectSimSection(simCounters.addSection("object sim", "object")),
+                spaceStepSection(simCounters.addSection("cpSpaceStep", "object")),
+                convertSection(convertCounters.addSection("PixelToaster convert", "pixel")),
                 damageTimer(-INFINITY),
                 score(0),
-                state(WAITING) {
+                state(WAITING),
+                lastScreenCenter(cpvzero),
+                lastState(WAITING),
+                repaintAll(true),
+                visible(true),
+                perfHudShown(false) {
+
     screenToWorld.invert();
+
     mouse.x = screenWidth / 2;
     mouse.y = screenHeight / 2;
 }
@@ -61,6 +81,8 @@ static int playerEnemyCollision(cpArbiter *arb, struct cpSpace *space, void *dat
 void GameSys::init() {
     space = cpSpaceNew();
     cpSpaceSetDamping(space, 0.3);
+    // keeps a list of touching pairs on each body, for getPairCount
+    cpSpaceSetEnableContactGraph(space, cpTrue);
 
     shared_ptr<PlayerObject> player(new PlayerObject(10.0, 4.0));
     gameObjects.push_back(player);
@@ -139,9 +161,27 @@ void GameSys::cleanup() {
     cpBodyFree(mouseBody);
 }
 
+void GameSys::setSimClock(Timer *simClock) {
+    this->simClock = simClock;
+}
+
 void GameSys::sim(double t, double dt) {
+    AllocationTracker::enter(SIM_STEP_PHASE);
     this->t = t;
 
+    // apply the input that arrived before the end of this step, later input waits for its step
+    InputQueue::Event event;
+    while (input.pop(t + dt, event)) {
+        switch (event.type) {
+        case InputQueue::Event::MOUSE_MOVE:
+            mouse = event.mouse;
+            break;
+        case InputQueue::Event::KEY_UP:
+            keyUp(event.key);
+            break;
+        }
+    }
+
     size_t numEnemiesWanted = score / 1000 + (score % 100) / 10;
     numEnemiesWanted = min(numEnemiesWanted, size_t(100));
     numEnemiesWanted = max(numEnemiesWanted, size_t(1));
@@ -160,9 +200,13 @@ void GameSys::sim(double t, double dt) {
         }
     }
 
+    AllocationTracker::enter(OBJECT_SIM_PHASE);
+    simCounters.begin(objectSimSection);
     for (shared_ptr<GameObject> gameObject : gameObjects) {
         gameObject->sim(t, dt);
     }
+    simCounters.end(gameObjects.size());
+    AllocationTracker::leave();
 
     cpVect mousePos = cpv(mouse.x, mouse.y);
     screenToWorld.transform_point(mousePos.x, mousePos.y);
@@ -190,7 +234,12 @@ void GameSys::sim(double t, double dt) {
 
     screenCenter = screenCenter + screenError * (0.75 * dt);
 
+    particles.sim(t, dt);
+    AllocationTracker::enter(SPACE_STEP_PHASE);
+    simCounters.begin(spaceStepSection);
     cpSpaceStep(space, dt);
+    simCounters.end(gameObjects.size());
+    AllocationTracker::leave();
 
     vector<shared_ptr<GameObject>>::iterator newEnd = remove_if(gameObjects.begin() + 2,
             gameObjects.end(),
@@ -208,52 +257,207 @@ void GameSys::sim(double t, double dt) {
             cpBodyApplyForce(gameObjects[i]->body, gravity * cpBodyGetMass(gameObjects[i]->body), cpvzero);
         }
     }
+    AllocationTracker::leave();
+}
+
+// conservative estimate of the ink extents of a text command, so that dirty regions can be found without asking Cairo
+static cpBB textBounds(const GameSys::HudText &text) {
+    const double width = text.size * (0.8 * text.text.size() + 0.5);
+    if (text.centered) {
+        return cpBBNew(text.x - width / 2, text.y - text.size * 0.75, text.x + width / 2, text.y + text.size * 0.75);
+    }
+    return cpBBNew(text.x - text.size * 0.25, -text.y - text.size * 0.25, text.x + width, -text.y + text.size * 1.25);
+}
+
+static bool operator==(const GameSys::HudText &a, const GameSys::HudText &b) {
+    return a.text == b.text && a.size == b.size && a.x == b.x && a.y == b.y && a.centered == b.centered
+            && a.alpha == b.alpha;
+}
+
+static bool overlaps(const PixelToaster::Rectangle &a, const PixelToaster::Rectangle &b) {
+    return a.xBegin <= b.xEnd && b.xBegin <= a.xEnd && a.yBegin <= b.yEnd && b.yBegin <= a.yEnd;
+}
+
+// merge overlapping or touching boxes until the remaining ones are disjoint
+static void coalesce(vector<PixelToaster::Rectangle> &boxes) {
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            for (size_t j = i + 1; j < boxes.size();) {
+                if (overlaps(boxes[i], boxes[j])) {
+                    boxes[i].xBegin = min(boxes[i].xBegin, boxes[j].xBegin);
+                    boxes[i].xEnd = max(boxes[i].xEnd, boxes[j].xEnd);
+                    boxes[i].yBegin = min(boxes[i].yBegin, boxes[j].yBegin);
+                    boxes[i].yEnd = max(boxes[i].yEnd, boxes[j].yEnd);
+                    boxes[j] = boxes.back();
+                    boxes.pop_back();
+                    merged = true;
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+}
+
+PixelToaster::Rectangle GameSys::screenBounds(const Matrix &userToScreen, const cpBB &bb) const {
+    double xs[4] = { bb.l, bb.r, bb.l, bb.r };
+    double ys[4] = { bb.b, bb.b, bb.t, bb.t };
+    for (int i = 0; i < 4; i++) {
+        userToScreen.transform_point(xs[i], ys[i]);
+    }
+    // pad by a couple of pixels for antialiasing
+    PixelToaster::Rectangle box(int(floor(*min_element(xs, xs + 4))) - 2,
+            int(ceil(*max_element(xs, xs + 4))) + 2,
+            int(floor(*min_element(ys, ys + 4))) - 2,
+            int(ceil(*max_element(ys, ys + 4))) + 2);
+    box.xBegin = max(box.xBegin, 0);
+    box.yBegin = max(box.yBegin, 0);
+    box.xEnd = min(box.xEnd, screenWidth);
+    box.yEnd = min(box.yEnd, screenHeight);
+    return box;
 }
 
-static void renderText(RefPtr<Context> cr, const string &s, double size, double x, double y, bool centered = true) {
-    cr->select_font_face("Gotham Rounded Bold", FONT_SLANT_NORMAL, FONT_WEIGHT_NORMAL);
-    cr->set_font_size(size);
-    TextExtents te;
-    cr->get_text_extents(s, te);
-    if (centered) {
-        cr->move_to(x - te.width / 2 - te.x_bearing, y - te.height / 2 - te.y_bearing);
-    } else {
-        cr->move_to(x - te.x_bearing, -y - te.y_bearing);
+Matrix GameSys::layoutHud(double t, vector<HudText> &texts) const {
+    texts.clear();
+    Matrix hudToScreen = worldToScreen;
+    if (state == WAITING) {
+        hudToScreen.translate(-screenCenter.x, -screenCenter.y);
+        texts.push_back(HudText("Press SPACE to start", 10, 0, -30));
+        texts.push_back(HudText("CONKERS", 30, 0, 0));
+        texts.push_back(HudText("Xo Wang & Nathan Hays", 12, 0, 30));
+    } else if (state == RUNNING) {
+        double scoreLeft = 20;
+        double scoreTop = 20;
+        screenToWorld.transform_point(scoreLeft, scoreTop);
+        // show score
+        char scoreText[9];
+        snprintf(scoreText, 9, "%08ld", (long) score);
+        texts.push_back(HudText(scoreText, 7, scoreLeft, scoreTop, false));
+    } else if (state == TOPSCORE) {
+        char scoreText[9];
+        snprintf(scoreText, 9, "%08ld", (long) score);
+        texts.push_back(HudText("GAME OVER", 17, 0, -35));
+        texts.push_back(HudText("2. 00000000", 10, 0, 0));
+        texts.push_back(HudText("3. 00000000", 10, 0, 12));
+        texts.push_back(HudText("4. 00000000", 10, 0, 24));
+        texts.push_back(HudText("restart game to play again :(", 6, 0, 40));
+        texts.push_back(HudText(string("1. ") + scoreText, 10, 0, -12, true, 0.6 + 0.4 * sin(t * M_PI)));
+    }
+    hudToScreen.scale(1.0, -1.0);
+    return hudToScreen;
+}
+
+void GameSys::findDirtyBoxes(const Matrix &hudToScreen, double dt, const PixelToaster::Rectangle &particleBounds,
+        vector<PixelToaster::Rectangle> &dirty) {
+    Matrix cameraToScreen = worldToScreen;
+    cameraToScreen.translate(-screenCenter.x, -screenCenter.y);
+
+    // everything that moves gets repainted where it was last frame and where it is now
+    objectBounds.clear();
+    for (shared_ptr<GameObject> gameObject : gameObjects) {
+        const cpBody * const body = gameObject->getBody();
+        const cpVect pos = cpBodyGetPos(body) + cpBodyGetVel(body) * dt;
+        objectBounds.push_back(screenBounds(cameraToScreen, cpBBNewForCircle(pos, gameObject->getBoundingRadius())));
+    }
+    cpBody * const playerBody = hammerConstraint->a;
+    cpBody * const hammerBody = hammerConstraint->b;
+    const cpVect anchor1 = cpPinJointGetAnchr1(hammerConstraint);
+    const cpVect anchor2 = cpPinJointGetAnchr2(hammerConstraint);
+    const cpVect playerPos = cpBodyLocal2World(playerBody, anchor1)
+            + cpBodyGetVelAtLocalPoint(playerBody, anchor1) * dt;
+    const cpVect hammerPos = cpBodyLocal2World(hammerBody, anchor2)
+            + cpBodyGetVelAtLocalPoint(hammerBody, anchor2) * dt;
+    objectBounds.push_back(screenBounds(cameraToScreen,
+            cpBBMerge(cpBBNewForCircle(playerPos, 0.5), cpBBNewForCircle(hammerPos, 0.5))));
+    objectBounds.push_back(particleBounds);
+
+    hudBounds.clear();
+    for (const HudText &text : hudTexts) {
+        hudBounds.push_back(screenBounds(hudToScreen, textBounds(text)));
     }
-    cr->show_text(s);
+
+    // anything that changes the whole picture needs a full repaint
+    const bool cameraMoved = !cpveql(screenCenter, lastScreenCenter);
+    repaintAll = repaintAll || cameraMoved || state != lastState;
+
+    dirty.clear();
+    if (!repaintAll) {
+        dirty.insert(dirty.end(), lastObjectBounds.begin(), lastObjectBounds.end());
+        dirty.insert(dirty.end(), objectBounds.begin(), objectBounds.end());
+        for (size_t i = 0; i < hudTexts.size(); i++) {
+            if (i < lastHudTexts.size() && hudTexts[i] == lastHudTexts[i])
+                continue;
+            if (i < lastHudBounds.size())
+                dirty.push_back(lastHudBounds[i]);
+            dirty.push_back(hudBounds[i]);
+        }
+        for (size_t i = hudTexts.size(); i < lastHudBounds.size(); i++) {
+            dirty.push_back(lastHudBounds[i]);
+        }
+
+        dirty.erase(remove_if(dirty.begin(), dirty.end(), [](const PixelToaster::Rectangle &box) -> bool {
+            return box.xBegin >= box.xEnd || box.yBegin >= box.yEnd;
+        }), dirty.end());
+        coalesce(dirty);
+
+        // past a certain point, one big box is cheaper than many small ones
+        long area = 0;
+        for (const PixelToaster::Rectangle &box : dirty) {
+            area += long(box.xEnd - box.xBegin) * (box.yEnd - box.yBegin);
+        }
+        repaintAll = area * 2 > long(screenWidth) * screenHeight;
+    }
+    if (repaintAll) {
+        dirty.assign(1, PixelToaster::Rectangle(0, screenWidth, 0, screenHeight));
+    }
+
+    lastObjectBounds.swap(objectBounds);
+    lastHudTexts = hudTexts;
+    lastHudBounds.swap(hudBounds);
+    lastScreenCenter = screenCenter;
+    lastState = state;
 }
 
-void GameSys::render(RefPtr<Context> cr, double t, double dt) {
-    bgColor[1] = cpflerp(0.0, 1.0, cpfclamp01(5 * (t - damageTimer)));
-    bgColor[2] = bgColor[1];
-    cr->set_source_rgb(bgColor[0], bgColor[1], bgColor[2]);
-    cr->paint();
+double GameSys::getDamageFlash(double t) const {
+    return 1.0 - cpfclamp01(5 * (t - damageTimer));
+}
+
+void GameSys::render(RenderList &list, ParticleSystem::Snapshot &particles, double t, double dt,
+        vector<PixelToaster::Rectangle> &dirty) {
+    list.clear();
+
+    Matrix cameraToScreen = worldToScreen;
+    cameraToScreen.translate(-screenCenter.x, -screenCenter.y);
+    this->particles.snapshot(cameraToScreen, t, dt, screenWidth, screenHeight, particles);
+
+    const Matrix hudToScreen = layoutHud(t, hudTexts);
+    findDirtyBoxes(hudToScreen, dt, particles.bounds, dirty);
+    if (dirty.empty()) {
+        return;
+    }
+    repaintAll = false;
+
+    list.setColor(BACKGROUND_COLOR[0], BACKGROUND_COLOR[1], BACKGROUND_COLOR[2]);
+    list.paint();
 
     // center screen within window
-    cr->translate(-screenCenter.x, -screenCenter.y);
+    list.setMatrix(cameraToScreen);
 
     const double gridSpacing = 15.0;
-    cr->set_source_rgb(0.7, 0.7, 0.7);
-    cr->set_line_width(0.1);
+    list.setColor(0.7, 0.7, 0.7);
+    list.setLineWidth(0.1);
     for (double x = bounds.l; x < bounds.r; x += gridSpacing) {
-        cr->move_to(x, bounds.t);
-        cr->line_to(x, bounds.b);
-        cr->stroke();
+        list.line(x, bounds.t, x, bounds.b);
     }
     for (double y = bounds.b; y < bounds.t; y += gridSpacing) {
-        cr->move_to(bounds.l, y);
-        cr->line_to(bounds.r, y);
-        cr->stroke();
+        list.line(bounds.l, y, bounds.r, y);
     }
 
-    cr->set_source_rgb(0.0, 0.0, 0.0);
-    cr->set_line_width(0.2);
-    cr->move_to(bounds.l, bounds.t);
-    cr->line_to(bounds.l, bounds.b);
-    cr->line_to(bounds.r, bounds.b);
-    cr->line_to(bounds.r, bounds.t);
-    cr->line_to(bounds.l, bounds.t);
-    cr->stroke();
+    list.setColor(0.0, 0.0, 0.0);
+    list.setLineWidth(0.2);
+    list.rectangle(bounds.l, bounds.b, bounds.r - bounds.l, bounds.t - bounds.b, false);
 
     cpBody * const playerBody = hammerConstraint->a;
     cpBody * const hammerBody = hammerConstraint->b;
@@ -263,11 +467,9 @@ void GameSys::render(RefPtr<Context> cr, double t, double dt) {
             + cpBodyGetVelAtLocalPoint(playerBody, anchor1) * dt;
     const cpVect hammerPos = cpBodyLocal2World(hammerBody, anchor2)
             + cpBodyGetVelAtLocalPoint(hammerBody, anchor2) * dt;
-    cr->set_line_width(1.0);
-    cr->set_source_rgb(0.0, 0.0, 0.0);
-    cr->move_to(playerPos.x, playerPos.y);
-    cr->line_to(hammerPos.x, hammerPos.y);
-    cr->stroke();
+    list.setLineWidth(1.0);
+    list.setColor(0.0, 0.0, 0.0);
+    list.line(playerPos.x, playerPos.y, hammerPos.x, hammerPos.y);
 
     // render each game object
     for (shared_ptr<GameObject> gameObject : gameObjects) {
@@ -276,54 +478,53 @@ void GameSys::render(RefPtr<Context> cr, double t, double dt) {
         const cpVect pos = cpBodyGetPos(body) + cpBodyGetVel(body) * dt;
         const cpFloat angle = cpBodyGetAngle(body) + cpBodyGetAngVel(body) * dt;
 
-        cr->save();
-
         // transform into local coordinates to make drawing easy
-        cr->translate(pos.x, pos.y);
-        cr->rotate(angle);
-        gameObject->render(cr, t, dt);
-
-        cr->restore();
+        list.setMatrix(cameraToScreen);
+        list.translate(pos.x, pos.y);
+        list.rotate(angle);
+        gameObject->render(list, t, dt);
     }
 
-    if (state == WAITING) {
-        cr->scale(1.0, -1.0);
-        cr->set_source_rgb(0.0, 0.0, 0.0);
-        renderText(cr, "Press SPACE to start", 10, 0, -30);
-        renderText(cr, "CONKERS", 30, 0, 0);
-        renderText(cr, "Xo Wang & Nathan Hays", 12, 0, 30);
-    } else if (state == RUNNING) {
-        double scoreLeft = 20;
-        double scoreTop = 20;
-        screenToWorld.transform_point(scoreLeft, scoreTop);
-        // show score
-        char scoreText[9];
-        snprintf(scoreText, 9, "%08ld", (long) score);
-        cr->translate(screenCenter.x, screenCenter.y);
-        cr->scale(1.0, -1.0);
-        cr->set_source_rgb(0.0, 0.0, 0.0);
-        renderText(cr, scoreText, 7, scoreLeft, scoreTop, false);
-    } else if (state == TOPSCORE) {
-        char scoreText[9];
-        snprintf(scoreText, 9, "%08ld", (long) score);
-        cr->translate(screenCenter.x, screenCenter.y);
-        cr->scale(1.0, -1.0);
-        cr->set_source_rgb(0.0, 0.0, 0.0);
-        renderText(cr, "GAME OVER", 17, 0, -35);
-        renderText(cr, "2. 00000000", 10, 0, 0);
-        renderText(cr, "3. 00000000", 10, 0, 12);
-        renderText(cr, "4. 00000000", 10, 0, 24);
-        renderText(cr, "restart game to play again :(", 6, 0, 40);
-        cr->set_source_rgba(0.0, 0.0, 0.0, 0.6 + 0.4 * sin(t * M_PI));
-        renderText(cr, string("1. ") + scoreText, 10, 0, -12);
+    // draw the text overlay
+    list.setMatrix(hudToScreen);
+    for (const HudText &text : hudTexts) {
+        list.setColor(0.0, 0.0, 0.0, text.alpha);
+        list.showText(text.text, text.size, text.x, text.y, text.centered);
     }
 }
 
+void GameSys::queueInput(InputQueue::Event &event) {
+    event.time = simClock ? simClock->time() : 0.0;
+    input.push(event);
+}
+
 void GameSys::onMouseMove(DisplayInterface &display, Mouse mouse) {
-    this->mouse = mouse;
+    InputQueue::Event event;
+    event.type = InputQueue::Event::MOUSE_MOVE;
+    event.mouse = mouse;
+    queueInput(event);
 }
 
 void GameSys::onKeyUp(DisplayInterface &display, Key key) {
+    InputQueue::Event event;
+    event.type = InputQueue::Event::KEY_UP;
+    event.key = key;
+    queueInput(event);
+}
+
+void GameSys::onVisible(DisplayInterface &display, bool visible) {
+    this->visible = visible;
+}
+
+void GameSys::onConvertBegin(DisplayInterface &display) {
+    convertCounters.begin(convertSection);
+}
+
+void GameSys::onConvertEnd(DisplayInterface &display, int pixels) {
+    convertCounters.end(pixels);
+}
+
+void GameSys::keyUp(Key key) {
     switch (key) {
     case Key::Space: {
         if (state == WAITING) {
@@ -338,11 +539,35 @@ void GameSys::onKeyUp(DisplayInterface &display, Key key) {
         break;
     }
 
+    case Key::F3:
+        perfHudShown = !perfHudShown;
+        break;
+
     default:
         break;
     }
 }
 
+// each pair is in the lists of both its bodies, unless the other one is static or rogue and not iterated by the
+// space. it's counted from the body with the lower address. chipmunk hands over arbiters with the body iterated
+// as the first
+static void countPair(cpBody *body, cpArbiter *arb, void *data) {
+    CP_ARBITER_GET_BODIES(arb, a, b);
+    if (cpBodyIsStatic(b) || cpBodyIsRogue(b) || a < b) {
+        ++*static_cast<size_t *>(data);
+    }
+}
+
+static void countBodyPairs(cpBody *body, void *data) {
+    cpBodyEachArbiter(body, countPair, data);
+}
+
+size_t GameSys::getPairCount() const {
+    size_t pairs = 0;
+    cpSpaceEachBody(space, countBodyPairs, &pairs);
+    return pairs;
+}
+
 int GameSys::playerEnemyCollision(cpArbiter *arb, struct cpSpace *space) {
     CP_ARBITER_GET_SHAPES(arb, aShape, enemyShape);
     CP_ARBITER_GET_BODIES(arb, aBody, enemyBody);
@@ -372,10 +597,20 @@ int GameSys::playerEnemyCollision(cpArbiter *arb, struct cpSpace *space) {
     }
 
     if (state == RUNNING) {
+        const bool wasAlive = enemy->isAlive();
         enemy->damagingHit(aObject, -relVel, t);
         if (enemy->isAlive()) {
             score += cpvlength(relVel);
         }
+
+        // sparks where a live enemy was hit, and debris if the hit killed it
+        if (wasAlive && cpArbiterGetCount(arb) > 0) {
+            const int sparks = min(int(cpvlength(relVel) * 0.5), 100);
+            particles.emit(cpArbiterGetPoint(arb, 0), cpvzero, 60.0, sparks, 0.4, SPARK_COLOR, t);
+        }
+        if (wasAlive && !enemy->isAlive()) {
+            particles.emit(cpBodyGetPos(enemyBody), cpBodyGetVel(enemyBody), 40.0, 300, 1.0, DEBRIS_COLOR, t);
+        }
     }
 
     return 1;
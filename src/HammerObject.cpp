@@ -25,8 +25,6 @@
 
 #include "HammerObject.h"
 
-using namespace Cairo;
-
 HammerObject::HammerObject(cpFloat mass, cpFloat width, cpFloat height, const cpVect &pos) :
         GameObject(mass, cpMomentForBox(mass, width, height), pos), width(width), height(height) {
 }
@@ -47,8 +45,7 @@ void HammerObject::sim(double t, double dt) {
 
 }
 
-void HammerObject::render(RefPtr<Context> cr, double t, double dt) {
-    cr->set_source_rgba(0.0, 0.0, 0.0, 1.0);
-    cr->rectangle(-width * 0.5, -height * 0.5, width, height);
-    cr->fill();
+void HammerObject::render(RenderList &list, double t, double dt) {
+    list.setColor(0.0, 0.0, 0.0, 1.0);
+    list.rectangle(-width * 0.5, -height * 0.5, width, height, true);
 }
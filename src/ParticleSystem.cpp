@@ -0,0 +1,301 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "ParticleSystem.h"
+
+// the vector loops are built for their instruction sets whatever the compiler targets, and picked at run time.
+// the attribute also realigns the stack, which 32 bit windows keeps only 4 byte aligned
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define TARGET(instructionSet) __attribute__((target(instructionSet), force_align_arg_pointer))
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Cairo;
+
+const float ParticleSystem::GRAVITY = -200.0f;
+const float ParticleSystem::DRAG = 2.0f;
+
+// takes weight / 256 of the ink off each color channel of the pixel
+static inline uint32_t darken(uint32_t pixel, uint32_t ink, int weight) {
+    uint32_t result = pixel & 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        const int channel = int((pixel >> shift) & 0xff) - int((((ink >> shift) & 0xff) * weight) >> 8);
+        result |= uint32_t(max(channel, 0)) << shift;
+    }
+    return result;
+}
+
+// splat the particles over 2 x 2 pixels each, and move them ahead by a step. the integrate kernels do what they
+// can in whole vectors and return where they stopped, there is none without vectors
+typedef void (*SplatKernel)(const float *x, const float *y, const uint32_t *ink, size_t count, unsigned char *data,
+        int stride);
+typedef size_t (*IntegrateKernel)(float *x, float *y, float *vx, float *vy, size_t i, size_t end, float damping,
+        float fall, float dt);
+
+static void splatScalar(const float *x, const float *y, const uint32_t *ink, size_t count, unsigned char *data,
+        int stride) {
+    for (size_t i = 0; i < count; i++) {
+        const int ix = int(x[i]);
+        const int iy = int(y[i]);
+        const int fx = int((x[i] - ix) * 256);
+        const int fy = int((y[i] - iy) * 256);
+        uint32_t * const row0 = (uint32_t *) (data + iy * stride) + ix;
+        uint32_t * const row1 = (uint32_t *) ((unsigned char *) row0 + stride);
+        row0[0] = darken(row0[0], ink[i], ((256 - fx) * (256 - fy)) >> 8);
+        row0[1] = darken(row0[1], ink[i], (fx * (256 - fy)) >> 8);
+        row1[0] = darken(row1[0], ink[i], ((256 - fx) * fy) >> 8);
+        row1[1] = darken(row1[1], ink[i], (fx * fy) >> 8);
+    }
+}
+
+#ifdef TARGET
+
+TARGET("sse2") static void splatSse2(const float *x, const float *y, const uint32_t *ink, size_t count,
+        unsigned char *data, int stride) {
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < count; i++) {
+        const int ix = int(x[i]);
+        const int iy = int(y[i]);
+        const int fx = int((x[i] - ix) * 256);
+        const int fy = int((y[i] - iy) * 256);
+        const short w00 = short(((256 - fx) * (256 - fy)) >> 8);
+        const short w01 = short((fx * (256 - fy)) >> 8);
+        const short w10 = short(((256 - fx) * fy) >> 8);
+        const short w11 = short((fx * fy) >> 8);
+        uint32_t * const row0 = (uint32_t *) (data + iy * stride) + ix;
+        uint32_t * const row1 = (uint32_t *) ((unsigned char *) row0 + stride);
+        // both pixels of a row at once, one channel per 16 bit lane
+        const __m128i inkV = _mm_unpacklo_epi8(_mm_set1_epi32(int(ink[i])), zero);
+        const __m128i topInk = _mm_srli_epi16(
+                _mm_mullo_epi16(inkV, _mm_set_epi16(w01, w01, w01, w01, w00, w00, w00, w00)), 8);
+        const __m128i bottomInk = _mm_srli_epi16(
+                _mm_mullo_epi16(inkV, _mm_set_epi16(w11, w11, w11, w11, w10, w10, w10, w10)), 8);
+        _mm_storel_epi64((__m128i *) row0,
+                _mm_subs_epu8(_mm_loadl_epi64((const __m128i *) row0), _mm_packus_epi16(topInk, topInk)));
+        _mm_storel_epi64((__m128i *) row1,
+                _mm_subs_epu8(_mm_loadl_epi64((const __m128i *) row1), _mm_packus_epi16(bottomInk, bottomInk)));
+    }
+}
+
+TARGET("avx2") static size_t integrateAvx2(float *x, float *y, float *vx, float *vy, size_t i, size_t end,
+        float damping, float fall, float dt) {
+    const __m256 dampingV = _mm256_set1_ps(damping);
+    const __m256 fallV = _mm256_set1_ps(fall);
+    const __m256 dtV = _mm256_set1_ps(dt);
+    for (; i + 8 <= end; i += 8) {
+        const __m256 newVx = _mm256_mul_ps(_mm256_loadu_ps(&vx[i]), dampingV);
+        const __m256 newVy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&vy[i]), dampingV), fallV);
+        _mm256_storeu_ps(&vx[i], newVx);
+        _mm256_storeu_ps(&vy[i], newVy);
+        _mm256_storeu_ps(&x[i], _mm256_add_ps(_mm256_loadu_ps(&x[i]), _mm256_mul_ps(newVx, dtV)));
+        _mm256_storeu_ps(&y[i], _mm256_add_ps(_mm256_loadu_ps(&y[i]), _mm256_mul_ps(newVy, dtV)));
+    }
+    return i;
+}
+
+TARGET("sse2") static size_t integrateSse2(float *x, float *y, float *vx, float *vy, size_t i, size_t end,
+        float damping, float fall, float dt) {
+    const __m128 dampingV = _mm_set1_ps(damping);
+    const __m128 fallV = _mm_set1_ps(fall);
+    const __m128 dtV = _mm_set1_ps(dt);
+    for (; i + 4 <= end; i += 4) {
+        const __m128 newVx = _mm_mul_ps(_mm_loadu_ps(&vx[i]), dampingV);
+        const __m128 newVy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&vy[i]), dampingV), fallV);
+        _mm_storeu_ps(&vx[i], newVx);
+        _mm_storeu_ps(&vy[i], newVy);
+        _mm_storeu_ps(&x[i], _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(newVx, dtV)));
+        _mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(newVy, dtV)));
+    }
+    return i;
+}
+
+#endif
+
+static SplatKernel pickSplat() {
+    switch (PixelToaster::detectInstructionSet()) {
+#ifdef TARGET
+    case PixelToaster::InstructionSet::AVX2:
+    case PixelToaster::InstructionSet::SSSE3:
+    case PixelToaster::InstructionSet::SSE2:
+        return splatSse2;
+#endif
+    default:
+        return splatScalar;
+    }
+}
+
+static IntegrateKernel pickIntegrate() {
+    switch (PixelToaster::detectInstructionSet()) {
+#ifdef TARGET
+    case PixelToaster::InstructionSet::AVX2:
+        return integrateAvx2;
+    case PixelToaster::InstructionSet::SSSE3:
+    case PixelToaster::InstructionSet::SSE2:
+        return integrateSse2;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static const SplatKernel splatKernel = pickSplat();
+static const IntegrateKernel integrateKernel = pickIntegrate();
+
+ParticleSystem::Snapshot::Snapshot() :
+        bounds(0, 0, 0, 0) {
+}
+
+void ParticleSystem::Snapshot::clear() {
+    x.clear();
+    y.clear();
+    ink.clear();
+    bounds = PixelToaster::Rectangle(0, 0, 0, 0);
+}
+
+void ParticleSystem::Snapshot::draw(unsigned char *data, int width, int height, int stride) const {
+    if (!x.empty()) {
+        splatKernel(&x[0], &y[0], &ink[0], x.size(), data, stride);
+    }
+}
+
+ParticleSystem::ParticleSystem() :
+        x(CAPACITY), y(CAPACITY), vx(CAPACITY), vy(CAPACITY), expireTime(CAPACITY), inverseLifetime(CAPACITY),
+                ink(CAPACITY), head(0), count(0) {
+}
+
+void ParticleSystem::emit(const cpVect &pos, const cpVect &vel, double speed, int count, double lifetime,
+        const double color[3], double t) {
+    uint32_t particleInk = 0;
+    for (int c = 0; c < 3; c++) {
+        particleInk |= uint32_t(255 - int(cpfclamp01(color[c]) * 255 + 0.5)) << (16 - 8 * c);
+    }
+
+    uniform_real_distribution<float> angleDistribution(0.0f, float(2 * M_PI));
+    uniform_real_distribution<float> speedDistribution(0.0f, float(speed));
+    uniform_real_distribution<float> lifetimeDistribution(float(lifetime * 0.5), float(lifetime));
+    for (int i = 0; i < count; i++) {
+        const float angle = angleDistribution(random);
+        const float particleSpeed = speedDistribution(random);
+        const float particleLifetime = lifetimeDistribution(random);
+        x[head] = float(pos.x);
+        y[head] = float(pos.y);
+        vx[head] = float(vel.x) + cos(angle) * particleSpeed;
+        vy[head] = float(vel.y) + sin(angle) * particleSpeed;
+        expireTime[head] = float(t) + particleLifetime;
+        inverseLifetime[head] = 1.0f / particleLifetime;
+        ink[head] = particleInk;
+        head = (head + 1) & (CAPACITY - 1);
+    }
+    this->count = min(this->count + count, CAPACITY);
+}
+
+void ParticleSystem::integrate(size_t begin, size_t end, float dt) {
+    const float damping = max(1.0f - DRAG * dt, 0.0f);
+    const float fall = GRAVITY * dt;
+    size_t i = begin;
+    if (integrateKernel) {
+        i = integrateKernel(&x[0], &y[0], &vx[0], &vy[0], begin, end, damping, fall, dt);
+    }
+    for (; i < end; i++) {
+        vx[i] *= damping;
+        vy[i] = vy[i] * damping + fall;
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+    }
+}
+
+void ParticleSystem::sim(double t, double dt) {
+    // expired particles leave from the old end of the ring. a short lived one behind a longer lived one stays
+    // until that one goes too, snapshot skips it in the meantime
+    while (count > 0 && expireTime[(head - count) & (CAPACITY - 1)] <= float(t)) {
+        count--;
+    }
+
+    const size_t tail = (head - count) & (CAPACITY - 1);
+    if (tail + count <= CAPACITY) {
+        integrate(tail, tail + count, float(dt));
+    } else {
+        integrate(tail, CAPACITY, float(dt));
+        integrate(0, head, float(dt));
+    }
+}
+
+void ParticleSystem::snapshot(const Matrix &worldToScreen, double t, double dt, int screenWidth, int screenHeight,
+        Snapshot &out) const {
+    out.clear();
+
+    const float xx = float(worldToScreen.xx);
+    const float xy = float(worldToScreen.xy);
+    const float x0 = float(worldToScreen.x0);
+    const float yx = float(worldToScreen.yx);
+    const float yy = float(worldToScreen.yy);
+    const float y0 = float(worldToScreen.y0);
+    // particles splat to the right and down, they have to stay a pixel away from those edges
+    const float xLimit = float(screenWidth - 1);
+    const float yLimit = float(screenHeight - 1);
+    const float now = float(t + dt);
+    const float ahead = float(dt);
+    float minX = xLimit;
+    float maxX = 0.0f;
+    float minY = yLimit;
+    float maxY = 0.0f;
+
+    const size_t tail = head - count;
+    for (size_t k = 0; k < count; k++) {
+        const size_t i = (tail + k) & (CAPACITY - 1);
+        const float life = (expireTime[i] - now) * inverseLifetime[i];
+        if (life <= 0.0f) {
+            continue;
+        }
+        const float worldX = x[i] + vx[i] * ahead;
+        const float worldY = y[i] + vy[i] * ahead;
+        const float screenX = xx * worldX + xy * worldY + x0;
+        const float screenY = yx * worldX + yy * worldY + y0;
+        if (!(screenX >= 0.0f && screenX < xLimit && screenY >= 0.0f && screenY < yLimit)) {
+            continue;
+        }
+
+        // particles fade out over their life
+        const uint32_t fade = uint32_t(min(life, 1.0f) * 256);
+        const uint32_t particleInk = ((((ink[i] & 0xff00ff) * fade) >> 8) & 0xff00ff)
+                | ((((ink[i] & 0x00ff00) * fade) >> 8) & 0x00ff00);
+
+        out.x.push_back(screenX);
+        out.y.push_back(screenY);
+        out.ink.push_back(particleInk);
+        minX = min(minX, screenX);
+        maxX = max(maxX, screenX);
+        minY = min(minY, screenY);
+        maxY = max(maxY, screenY);
+    }
+
+    if (!out.x.empty()) {
+        out.bounds = PixelToaster::Rectangle(int(minX), int(maxX) + 2, int(minY), int(maxY) + 2);
+    }
+}
@@ -0,0 +1,215 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+static const char * const EVENT_NAMES[PerfCounters::EVENT_COUNT] = {
+    "cycles",
+    "instructions",
+    "L1d misses",
+    "LLC misses",
+    "branch misses"
+};
+
+#ifdef __linux__
+static int openEvent(uint32_t type, uint64_t config, int groupFd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // the leader starts the whole group once it is complete
+    attr.disabled = groupFd < 0;
+    // counting the user's code needs the least privilege, and the kernel's time isn't ours to tune
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+
+PerfCounters::PerfCounters() :
+        enabled(false),
+                opened(false),
+                current(-1),
+                startEnabledTime(0),
+                startRunningTime(0) {
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        fds[event] = -1;
+        startCounts[event] = 0;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+int PerfCounters::addSection(const string &name, const string &itemName) {
+    Section section;
+    section.name = name;
+    section.itemName = itemName;
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        section.counts[event] = 0;
+    }
+    section.enabledTime = 0;
+    section.runningTime = 0;
+    section.runs = 0;
+    section.items = 0.0;
+    sections.push_back(section);
+    return int(sections.size()) - 1;
+}
+
+void PerfCounters::setEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+void PerfCounters::open() {
+    opened = true;
+#ifdef __linux__
+    fds[CYCLES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fds[CYCLES] < 0) {
+        return;
+    }
+    fds[INSTRUCTIONS] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds[CYCLES]);
+    fds[L1D_MISSES] = openEvent(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            fds[CYCLES]);
+    fds[LLC_MISSES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds[CYCLES]);
+    fds[BRANCH_MISSES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fds[CYCLES]);
+    ioctl(fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void PerfCounters::close() {
+#ifdef __linux__
+    for (int event = EVENT_COUNT - 1; event >= 0; event--) {
+        if (fds[event] >= 0) {
+            ::close(fds[event]);
+        }
+        fds[event] = -1;
+    }
+#endif
+}
+
+bool PerfCounters::read(uint64_t counts[EVENT_COUNT], uint64_t &enabledTime, uint64_t &runningTime) const {
+#ifdef __linux__
+    // the group reads in one go: the number of events, the two times, then the events in the order they opened
+    uint64_t data[3 + EVENT_COUNT];
+    const ssize_t size = ::read(fds[CYCLES], data, sizeof(data));
+    if (size < ssize_t(3 * sizeof(uint64_t))) {
+        return false;
+    }
+    enabledTime = data[1];
+    runningTime = data[2];
+    const uint64_t *value = data + 3;
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        counts[event] = fds[event] >= 0 ? *value++ : 0;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PerfCounters::begin(int section) {
+    if (!enabled) {
+        return;
+    }
+    if (!opened) {
+        open();
+    }
+    if (fds[CYCLES] >= 0 && read(startCounts, startEnabledTime, startRunningTime)) {
+        current = section;
+    }
+}
+
+void PerfCounters::end(double items) {
+    if (current < 0) {
+        return;
+    }
+    uint64_t counts[EVENT_COUNT];
+    uint64_t enabledTime;
+    uint64_t runningTime;
+    if (read(counts, enabledTime, runningTime)) {
+        Section &section = sections[current];
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            section.counts[event] += counts[event] - startCounts[event];
+        }
+        section.enabledTime += enabledTime - startEnabledTime;
+        section.runningTime += runningTime - startRunningTime;
+        section.runs++;
+        section.items += items;
+    }
+    current = -1;
+}
+
+void PerfCounters::report(ostream &out) const {
+    if (!enabled) {
+        return;
+    }
+    if (!isAvailable()) {
+        for (const Section &section : sections) {
+            out << "perf " << section.name << ": hardware counters not available" << endl;
+        }
+        return;
+    }
+
+    for (const Section &section : sections) {
+        if (section.runs == 0 || section.runningTime == 0) {
+            continue;
+        }
+        // where the group only counted part of the time, the counts are scaled up to all of it
+        const double scale = double(section.enabledTime) / section.runningTime;
+        const double items = max(section.items, 1.0);
+        out << "perf " << section.name << ": " << section.runs << " runs";
+        if (fds[INSTRUCTIONS] >= 0 && section.counts[CYCLES] > 0) {
+            out << ", IPC " << double(section.counts[INSTRUCTIONS]) / section.counts[CYCLES];
+        }
+        out << ", per " << section.itemName << ":";
+        const char *separator = " ";
+        for (int event = 0; event < EVENT_COUNT; event++) {
+            if (fds[event] >= 0) {
+                out << separator << section.counts[event] * scale / items << " " << EVENT_NAMES[event];
+                separator = ", ";
+            }
+        }
+        if (section.runningTime < section.enabledTime) {
+            out << " (counted " << int(100.0 * section.runningTime / section.enabledTime) << "% of the time)";
+        }
+        out << endl;
+    }
+}
@@ -0,0 +1,162 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "PerfHud.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace Cairo;
+
+static const double TEXT_PERIOD = 0.25;
+// time at the top of a graph, and the time marked by the guide line across it
+static const double FULL_SCALE = 1.0 / 30;
+static const double FRAME_BUDGET = 1.0 / 60;
+// distance of the panel from the frame's edges
+static const int INSET = 8;
+
+static const uint32_t BACKGROUND_COLOR = 0xff202020;
+static const uint32_t GUIDE_COLOR = 0xff505050;
+static const uint32_t TEXT_COLOR = 0xffe0e0e0;
+static const uint32_t GRAPH_COLORS[PerfHud::GRAPHS] = { 0xff40c040, 0xff4080ff, 0xffffa020, 0xffff4040 };
+static const char * const GRAPH_NAMES[PerfHud::GRAPHS] = { "sim", "render", "present", "lock wait" };
+
+static void setColor(const RefPtr<Context> &cr, uint32_t color) {
+    cr->set_source_rgb(((color >> 16) & 0xff) / 255.0, ((color >> 8) & 0xff) / 255.0, (color & 0xff) / 255.0);
+}
+
+PerfHud::PerfHud() :
+        width(MARGIN + LABEL_WIDTH + HISTORY + MARGIN),
+                height(MARGIN + GRAPHS * ROW_HEIGHT + COUNTS_HEIGHT + MARGIN),
+                pixels(width * height, BACKGROUND_COLOR),
+                history(HISTORY, Sample()),
+                newest(HISTORY - 1),
+                total(),
+                totalFrames(0),
+                lastTextTime(-INFINITY),
+                textChanged(true) {
+    surface = ImageSurface::create((unsigned char *) pixels.data(), FORMAT_ARGB32, width, height, width * 4);
+    cr = Context::create(surface);
+    cr->select_font_face("monospace", FONT_SLANT_NORMAL, FONT_WEIGHT_NORMAL);
+    cr->set_font_size(12);
+    for (int i = 0; i <= GRAPHS; i++) {
+        lines[i][0] = '\0';
+    }
+}
+
+void PerfHud::addSample(const Sample &sample, double time) {
+    newest = (newest + 1) % HISTORY;
+    history[newest] = sample;
+
+    for (int g = 0; g < GRAPHS; g++) {
+        total.times[g] += sample.times[g];
+    }
+    total.steps += sample.steps;
+    totalFrames++;
+    if (time - lastTextTime < TEXT_PERIOD)
+        return;
+
+    for (int g = 0; g < GRAPHS; g++) {
+        snprintf(lines[g], sizeof(lines[g]), "%-9s %5.2f ms", GRAPH_NAMES[g], total.times[g] * 1000 / totalFrames);
+    }
+    snprintf(lines[GRAPHS], sizeof(lines[GRAPHS]), "%.1f steps/frame  %lu objects  %lu pairs",
+            double(total.steps) / totalFrames, (unsigned long) sample.objects, (unsigned long) sample.pairs);
+    total = Sample();
+    totalFrames = 0;
+    lastTextTime = time;
+    textChanged = true;
+}
+
+void PerfHud::drawGraphs() {
+    const int barHeight = ROW_HEIGHT - ROW_GAP;
+    const int guideRow = barHeight - int(barHeight * FRAME_BUDGET / FULL_SCALE + 0.5);
+    int heights[HISTORY];
+    for (int g = 0; g < GRAPHS; g++) {
+        // oldest frame on the left, so the graph scrolls left
+        for (int x = 0; x < HISTORY; x++) {
+            const double time = history[(newest + 1 + x) % HISTORY].times[g];
+            heights[x] = min(barHeight, int(time / FULL_SCALE * barHeight + 0.5));
+        }
+
+        // row by row, as the pixels lie in memory. a bar covers the rows at most its height from the bottom
+        for (int y = 0; y < barHeight; y++) {
+            uint32_t *row = &pixels[(MARGIN + g * ROW_HEIGHT + y) * width + MARGIN + LABEL_WIDTH];
+            const int level = barHeight - y;
+            const uint32_t background = y == guideRow ? GUIDE_COLOR : BACKGROUND_COLOR;
+            for (int x = 0; x < HISTORY; x++) {
+                row[x] = heights[x] >= level ? GRAPH_COLORS[g] : background;
+            }
+        }
+    }
+}
+
+void PerfHud::drawText() {
+    // the graphs were written behind cairo's back
+    surface->mark_dirty();
+
+    setColor(cr, BACKGROUND_COLOR);
+    cr->rectangle(0, 0, MARGIN + LABEL_WIDTH, height);
+    cr->rectangle(MARGIN + LABEL_WIDTH, MARGIN + GRAPHS * ROW_HEIGHT, HISTORY + MARGIN, COUNTS_HEIGHT + MARGIN);
+    cr->fill();
+
+    for (int g = 0; g < GRAPHS; g++) {
+        setColor(cr, GRAPH_COLORS[g]);
+        cr->move_to(MARGIN, MARGIN + g * ROW_HEIGHT + (ROW_HEIGHT - ROW_GAP) / 2 + 4);
+        cr->show_text(lines[g]);
+    }
+    setColor(cr, TEXT_COLOR);
+    cr->move_to(MARGIN, MARGIN + GRAPHS * ROW_HEIGHT + COUNTS_HEIGHT - 5);
+    cr->show_text(lines[GRAPHS]);
+
+    surface->flush();
+}
+
+PixelToaster::Rectangle PerfHud::getBounds(int frameWidth, int frameHeight) const {
+    return PixelToaster::Rectangle(min(INSET, frameWidth),
+            min(INSET + width, frameWidth),
+            max(frameHeight - INSET - height, 0),
+            max(frameHeight - INSET, 0));
+}
+
+void PerfHud::draw(unsigned char *frame, int frameWidth, int frameHeight, int frameStride) {
+    if (textChanged) {
+        drawText();
+        textChanged = false;
+    }
+    drawGraphs();
+
+    // clipped at the frame's top and right edges
+    const PixelToaster::Rectangle bounds = getBounds(frameWidth, frameHeight);
+    const int top = frameHeight - INSET - height;
+    for (int y = bounds.yBegin; y < bounds.yEnd; y++) {
+        memcpy(frame + y * frameStride + bounds.xBegin * sizeof(uint32_t),
+                &pixels[(y - top) * width],
+                (bounds.xEnd - bounds.xBegin) * sizeof(uint32_t));
+    }
+}
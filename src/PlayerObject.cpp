@@ -25,8 +25,6 @@
 
 #include "PlayerObject.h"
 
-using namespace Cairo;
-
 PlayerObject::PlayerObject(cpFloat mass, cpFloat radius, const cpVect &pos) :
         GameObject(mass, cpMomentForCircle(mass, 0, radius, cpvzero), pos), radius(radius) {
     hP = 102;
@@ -45,18 +43,14 @@ void PlayerObject::sim(double t, double dt) {
 
 }
 
-void PlayerObject::render(RefPtr<Context> cr, double t, double dt) {
-    cr->rotate(M_PI / 2 - cpBodyGetAngle(body)); // draw the health bar without rotation
-    cr->move_to(0.0, 0.0);
-    cr->set_source_rgba(0.2, 0.2, 0.2, 0.2);
+void PlayerObject::render(RenderList &list, double t, double dt) {
+    list.rotate(M_PI / 2 - cpBodyGetAngle(body)); // draw the health bar without rotation
+    list.setColor(0.2, 0.2, 0.2, 0.2);
     if (hP != 0.0) {
-        cr->arc_negative(0.0, 0.0, radius, 0, 2 * M_PI * (hP / maxHP));
+        list.arc(0.0, 0.0, radius, 0, 2 * M_PI * (hP / maxHP), true, true, true);
     } else {
-        cr->arc(0.0, 0.0, radius, 0, 2 * M_PI);
+        list.arc(0.0, 0.0, radius, 0, 2 * M_PI, false, true, true);
     }
-    cr->fill();
-    cr->move_to(0.0, 0.0);
-    cr->set_source_rgb(0.0, 0.0, 0.0);
-    cr->arc_negative(0.0, 0.0, radius, 2 * M_PI * (hP / maxHP), 0);
-    cr->fill();
+    list.setColor(0.0, 0.0, 0.0);
+    list.arc(0.0, 0.0, radius, 2 * M_PI * (hP / maxHP), 0, true, true, true);
 }
@@ -0,0 +1,233 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "PostProcess.h"
+
+// the vector kernels are built for their instruction sets whatever the compiler targets, and picked at run time.
+// the attribute also realigns the stack for spilled vectors, 32 bit windows keeps it only 4 byte aligned
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define TARGET(instructionSet) __attribute__((target(instructionSet), force_align_arg_pointer))
+#endif
+
+#include <algorithm>
+
+using namespace std;
+
+const float PostProcess::FLASH_COLOR[3] = { 2.0f, 0.1f, 0.0f };
+const float PostProcess::FLASH_CENTER = 0.5f;
+
+#ifdef TARGET
+
+// eight pixels at a time, one channel of all of them per vector
+TARGET("avx2") static int processRowAvx2(const uint32_t *in, uint32_t *out, const float *columnRadius, float rowRadius,
+        int x, int xEnd, const PostProcess::Constants &constants) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 vignetteV = _mm256_set1_ps(constants.vignette);
+    const __m256 scaleV = _mm256_set1_ps(constants.pixelScale);
+    const __m256 centerV = _mm256_set1_ps(constants.flashCenter);
+    const __m256 edgeV = _mm256_set1_ps(1.0f - constants.flashCenter);
+    const __m256 glowV[3] = { _mm256_set1_ps(constants.glow[0]), _mm256_set1_ps(constants.glow[1]),
+            _mm256_set1_ps(constants.glow[2]) };
+    const __m256 inverseWhiteV = _mm256_set1_ps(constants.inverseWhiteSquared);
+    const __m256 maxV = _mm256_set1_ps(255.0f);
+    const __m256 halfV = _mm256_set1_ps(0.5f);
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+    const __m256 rowV = _mm256_set1_ps(rowRadius);
+    for (; x + 8 <= xEnd; x += 8) {
+        const __m256i pixels = _mm256_loadu_si256((const __m256i *) (in + x));
+        const __m256 radius = _mm256_add_ps(_mm256_loadu_ps(columnRadius + x), rowV);
+        const __m256 scale = _mm256_mul_ps(scaleV, _mm256_sub_ps(one, _mm256_mul_ps(vignetteV, radius)));
+        const __m256 shape = _mm256_add_ps(centerV, _mm256_mul_ps(edgeV, radius));
+        __m256i result = alpha;
+        for (int c = 0; c < 3; c++) {
+            const __m128i shift = _mm_cvtsi32_si128(16 - 8 * c);
+            const __m256 channel = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixels, shift), mask));
+            const __m256 value = _mm256_add_ps(_mm256_mul_ps(channel, scale), _mm256_mul_ps(glowV[c], shape));
+            const __m256 mapped = _mm256_div_ps(
+                    _mm256_mul_ps(value, _mm256_add_ps(one, _mm256_mul_ps(value, inverseWhiteV))),
+                    _mm256_add_ps(one, value));
+            const __m256 scaled = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(mapped, maxV), halfV), maxV);
+            result = _mm256_or_si256(result, _mm256_sll_epi32(_mm256_cvttps_epi32(scaled), shift));
+        }
+        _mm256_storeu_si256((__m256i *) (out + x), result);
+    }
+    return x;
+}
+
+// four pixels at a time
+TARGET("sse2") static int processRowSse2(const uint32_t *in, uint32_t *out, const float *columnRadius, float rowRadius,
+        int x, int xEnd, const PostProcess::Constants &constants) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 vignetteV = _mm_set1_ps(constants.vignette);
+    const __m128 scaleV = _mm_set1_ps(constants.pixelScale);
+    const __m128 centerV = _mm_set1_ps(constants.flashCenter);
+    const __m128 edgeV = _mm_set1_ps(1.0f - constants.flashCenter);
+    const __m128 glowV[3] = { _mm_set1_ps(constants.glow[0]), _mm_set1_ps(constants.glow[1]),
+            _mm_set1_ps(constants.glow[2]) };
+    const __m128 inverseWhiteV = _mm_set1_ps(constants.inverseWhiteSquared);
+    const __m128 maxV = _mm_set1_ps(255.0f);
+    const __m128 halfV = _mm_set1_ps(0.5f);
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+    const __m128 rowV = _mm_set1_ps(rowRadius);
+    for (; x + 4 <= xEnd; x += 4) {
+        const __m128i pixels = _mm_loadu_si128((const __m128i *) (in + x));
+        const __m128 radius = _mm_add_ps(_mm_loadu_ps(columnRadius + x), rowV);
+        const __m128 scale = _mm_mul_ps(scaleV, _mm_sub_ps(one, _mm_mul_ps(vignetteV, radius)));
+        const __m128 shape = _mm_add_ps(centerV, _mm_mul_ps(edgeV, radius));
+        __m128i result = alpha;
+        for (int c = 0; c < 3; c++) {
+            const __m128i shift = _mm_cvtsi32_si128(16 - 8 * c);
+            const __m128 channel = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, shift), mask));
+            const __m128 value = _mm_add_ps(_mm_mul_ps(channel, scale), _mm_mul_ps(glowV[c], shape));
+            const __m128 mapped = _mm_div_ps(_mm_mul_ps(value, _mm_add_ps(one, _mm_mul_ps(value, inverseWhiteV))),
+                    _mm_add_ps(one, value));
+            const __m128 scaled = _mm_min_ps(_mm_add_ps(_mm_mul_ps(mapped, maxV), halfV), maxV);
+            result = _mm_or_si128(result, _mm_sll_epi32(_mm_cvttps_epi32(scaled), shift));
+        }
+        _mm_storeu_si128((__m128i *) (out + x), result);
+    }
+    return x;
+}
+
+#endif
+
+PostProcess::PostProcess(const unsigned char *source, unsigned char *target, int width, int height, int sourceStride,
+        int targetStride) :
+        source(source),
+                target(target),
+                width(width),
+                height(height),
+                sourceStride(sourceStride),
+                targetStride(targetStride),
+                exposure(1.0),
+                vignette(0.2),
+                flash(0.0),
+                changed(true),
+                columnRadius(width),
+                rowRadius(height),
+                rowKernel(NULL) {
+    for (int x = 0; x < width; x++) {
+        const double dx = (x + 0.5) / (width * 0.5) - 1.0;
+        columnRadius[x] = float(dx * dx * 0.5);
+    }
+    for (int y = 0; y < height; y++) {
+        const double dy = (y + 0.5) / (height * 0.5) - 1.0;
+        rowRadius[y] = float(dy * dy * 0.5);
+    }
+    constants.pixelScale = 0.0f;
+    constants.vignette = 0.0f;
+    constants.flashCenter = FLASH_CENTER;
+    fill(constants.glow, constants.glow + 3, 0.0f);
+    constants.inverseWhiteSquared = 1.0f;
+
+    switch (PixelToaster::detectInstructionSet()) {
+#ifdef TARGET
+    case PixelToaster::InstructionSet::AVX2:
+        rowKernel = processRowAvx2;
+        break;
+    case PixelToaster::InstructionSet::SSSE3:
+    case PixelToaster::InstructionSet::SSE2:
+        rowKernel = processRowSse2;
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+void PostProcess::setExposure(double exposure) {
+    if (exposure != this->exposure) {
+        this->exposure = exposure;
+        changed = true;
+    }
+}
+
+void PostProcess::setVignette(double vignette) {
+    if (vignette != this->vignette) {
+        this->vignette = vignette;
+        changed = true;
+    }
+}
+
+void PostProcess::setFlash(double flash) {
+    if (flash != this->flash) {
+        this->flash = flash;
+        changed = true;
+    }
+}
+
+// per channel: value = byte * exposure * (1 - vignette * radius) / 255 + glow * shape, then the extended Reinhard
+// curve value * (1 + value / white^2) / (1 + value), which takes white to 1 and is the identity when white is 1
+void PostProcess::process(const PixelToaster::Rectangle &box) {
+    for (int y = box.yBegin; y < box.yEnd; y++) {
+        const uint32_t * const in = (const uint32_t *) (source + y * sourceStride);
+        uint32_t * const out = (uint32_t *) (target + y * targetStride);
+        int x = box.xBegin;
+        if (rowKernel) {
+            x = rowKernel(in, out, &columnRadius[0], rowRadius[y], x, box.xEnd, constants);
+        }
+
+        for (; x < box.xEnd; x++) {
+            const float radius = columnRadius[x] + rowRadius[y];
+            const float scale = constants.pixelScale * (1.0f - constants.vignette * radius);
+            const float shape = FLASH_CENTER + (1.0f - FLASH_CENTER) * radius;
+            uint32_t pixel = 0xff000000;
+            for (int c = 0; c < 3; c++) {
+                const int shift = 16 - 8 * c;
+                const float value = float((in[x] >> shift) & 0xff) * scale + constants.glow[c] * shape;
+                const float mapped = value * (1.0f + value * constants.inverseWhiteSquared) / (1.0f + value);
+                pixel |= uint32_t(min(mapped * 255.0f + 0.5f, 255.0f)) << shift;
+            }
+            out[x] = pixel;
+        }
+    }
+}
+
+void PostProcess::apply(vector<PixelToaster::Rectangle> &dirty) {
+    if (changed) {
+        dirty.assign(1, PixelToaster::Rectangle(0, width, 0, height));
+        changed = false;
+    }
+
+    // the brightest the frame can get is mapped to white, the flash peaks in the corners
+    const double white = max(1.0, exposure + flash * *max_element(FLASH_COLOR, FLASH_COLOR + 3));
+    constants.pixelScale = float(exposure / 255.0);
+    constants.vignette = float(vignette);
+    for (int c = 0; c < 3; c++) {
+        constants.glow[c] = float(flash * FLASH_COLOR[c]);
+    }
+    constants.inverseWhiteSquared = float(1.0 / (white * white));
+
+    for (PixelToaster::Rectangle box : dirty) {
+        box.xBegin = max(box.xBegin, 0);
+        box.xEnd = min(box.xEnd, width);
+        box.yBegin = max(box.yBegin, 0);
+        box.yEnd = min(box.yEnd, height);
+        process(box);
+    }
+}
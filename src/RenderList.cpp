@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "RenderList.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+using namespace std;
+
+RenderList::RenderList() :
+        matrix(Cairo::identity_matrix()), matrixChanged(true), lineWidth(2.0) {
+}
+
+void RenderList::clear() {
+    commands.clear();
+    text.clear();
+    matrix = Cairo::identity_matrix();
+    matrixChanged = true;
+    lineWidth = 2.0;
+}
+
+RenderCommand &RenderList::add(RenderCommand::Type type) {
+    commands.push_back(RenderCommand());
+    commands.back().type = type;
+    return commands.back();
+}
+
+static int clampToInt(double x) {
+    return int(max(min(x, double(INT_MAX / 2)), double(INT_MIN / 2)));
+}
+
+// drawing commands need the current transform in effect, and the screen bounds of the user space box x0, y0 to x1, y1.
+// strokes reach out by half the line width, and antialiasing by a couple of pixels
+RenderCommand &RenderList::draw(RenderCommand::Type type, double x0, double y0, double x1, double y1, bool stroke) {
+    if (matrixChanged) {
+        add(RenderCommand::SET_MATRIX).matrix = matrix;
+        matrixChanged = false;
+    }
+    RenderCommand &command = add(type);
+
+    if (stroke) {
+        x0 -= lineWidth * 0.5;
+        y0 -= lineWidth * 0.5;
+        x1 += lineWidth * 0.5;
+        y1 += lineWidth * 0.5;
+    }
+    double xs[4] = { x0, x1, x0, x1 };
+    double ys[4] = { y0, y0, y1, y1 };
+    for (int i = 0; i < 4; i++) {
+        matrix.transform_point(xs[i], ys[i]);
+    }
+    command.bounds.xBegin = clampToInt(floor(*min_element(xs, xs + 4))) - 2;
+    command.bounds.xEnd = clampToInt(ceil(*max_element(xs, xs + 4))) + 2;
+    command.bounds.yBegin = clampToInt(floor(*min_element(ys, ys + 4))) - 2;
+    command.bounds.yEnd = clampToInt(ceil(*max_element(ys, ys + 4))) + 2;
+    return command;
+}
+
+void RenderList::setMatrix(const Cairo::Matrix &matrix) {
+    this->matrix = matrix;
+    matrixChanged = true;
+}
+
+void RenderList::translate(double x, double y) {
+    matrix.translate(x, y);
+    matrixChanged = true;
+}
+
+void RenderList::rotate(double angle) {
+    matrix.rotate(angle);
+    matrixChanged = true;
+}
+
+void RenderList::setColor(double r, double g, double b, double a) {
+    RenderCommand::Color &color = add(RenderCommand::SET_COLOR).color;
+    color.r = r;
+    color.g = g;
+    color.b = b;
+    color.a = a;
+}
+
+void RenderList::setLineWidth(double width) {
+    add(RenderCommand::SET_LINE_WIDTH).lineWidth = width;
+    lineWidth = width;
+}
+
+void RenderList::paint() {
+    RenderCommand &command = add(RenderCommand::PAINT);
+    command.bounds.xBegin = INT_MIN;
+    command.bounds.xEnd = INT_MAX;
+    command.bounds.yBegin = INT_MIN;
+    command.bounds.yEnd = INT_MAX;
+}
+
+void RenderList::rectangle(double x, double y, double width, double height, bool fill) {
+    RenderCommand::Rectangle &rectangle = draw(RenderCommand::RECTANGLE, x, y, x + width, y + height, !fill).rectangle;
+    rectangle.x = x;
+    rectangle.y = y;
+    rectangle.width = width;
+    rectangle.height = height;
+    rectangle.fill = fill;
+}
+
+void RenderList::circle(double x, double y, double radius, bool fill) {
+    arc(x, y, radius, 0, 2 * M_PI, false, false, fill);
+}
+
+void RenderList::arc(double x, double y, double radius, double angle1, double angle2, bool negative, bool sector, bool fill) {
+    RenderCommand::Arc &arc = draw(RenderCommand::ARC, x - radius, y - radius, x + radius, y + radius, !fill).arc;
+    arc.x = x;
+    arc.y = y;
+    arc.radius = radius;
+    arc.angle1 = angle1;
+    arc.angle2 = angle2;
+    arc.negative = negative;
+    arc.sector = sector;
+    arc.fill = fill;
+}
+
+void RenderList::line(double x0, double y0, double x1, double y1) {
+    RenderCommand::Line &line = draw(RenderCommand::LINE, min(x0, x1), min(y0, y1), max(x0, x1), max(y0, y1), true).line;
+    line.x0 = x0;
+    line.y0 = y0;
+    line.x1 = x1;
+    line.y1 = y1;
+}
+
+void RenderList::showText(const std::string &s, double size, double x, double y, bool centered) {
+    // a conservative estimate of the ink extents, the font's metrics are only known when drawing
+    const double width = size * (0.8 * s.size() + 0.5);
+    RenderCommand::Text &command = centered ?
+            draw(RenderCommand::TEXT, x - width / 2, y - size * 0.75, x + width / 2, y + size * 0.75, false).text :
+            draw(RenderCommand::TEXT, x - size * 0.25, -y - size * 0.25, x + width, -y + size * 1.25, false).text;
+    command.offset = text.size();
+    command.length = s.size();
+    command.size = size;
+    command.x = x;
+    command.y = y;
+    command.centered = centered;
+    text += s;
+}
@@ -0,0 +1,304 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "ReplayBuffer.h"
+#include "FrameCapture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+ReplayBuffer::ReplayBuffer(int width, int height, size_t maxFrames, size_t arenaBytes, int keyInterval) :
+        width(width),
+                height(height),
+                maxFrames(max(maxFrames, size_t(1))),
+                keyInterval(max(keyInterval, 1)),
+                pending(size_t(width) * height),
+                pendingFull(false),
+                current(size_t(width) * height),
+                previous(size_t(width) * height),
+                delta(size_t(width) * height),
+                arena(arenaBytes),
+                writeOffset(0),
+                storedBytes(0),
+                framesSinceKey(0),
+                clipRequested(false),
+                clipReady(false),
+                saving(false),
+                quit(false),
+                stopSaver(false) {
+    memset(&stats, 0, sizeof(stats));
+
+    // differences are mostly zeros, which run length encoding packs well and quickly
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, 1, Z_DEFLATED, 15, 8, Z_RLE);
+    compressed.resize(deflateBound(&stream, uLong(delta.size() * sizeof(uint32_t))));
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&wake, NULL);
+    pthread_cond_init(&clipCond, NULL);
+    pthread_create(&compressor, NULL, compressorMain, this);
+    pthread_create(&saver, NULL, saverMain, this);
+}
+
+ReplayBuffer::~ReplayBuffer() {
+    // a clip that was asked for is still written
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(compressor, NULL);
+
+    pthread_mutex_lock(&mutex);
+    stopSaver = true;
+    pthread_cond_signal(&clipCond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(saver, NULL);
+
+    pthread_cond_destroy(&clipCond);
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&mutex);
+    deflateEnd(&stream);
+}
+
+void *ReplayBuffer::compressorMain(void *arg) {
+    static_cast<ReplayBuffer *>(arg)->compressFrames();
+    return NULL;
+}
+
+void *ReplayBuffer::saverMain(void *arg) {
+    static_cast<ReplayBuffer *>(arg)->saveClips();
+    return NULL;
+}
+
+void ReplayBuffer::compressFrames() {
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        while (!quit && !pendingFull && !clipRequested)
+            pthread_cond_wait(&wake, &mutex);
+
+        if (clipRequested) {
+            clipRequested = false;
+            pthread_mutex_unlock(&mutex);
+            copyClip();
+            pthread_mutex_lock(&mutex);
+            clipReady = true;
+            pthread_cond_signal(&clipCond);
+        } else if (quit) {
+            break;
+        } else {
+            current.swap(pending);
+            pendingFull = false;
+            pthread_mutex_unlock(&mutex);
+            compressFrame();
+            pthread_mutex_lock(&mutex);
+            stats.frames = (unsigned int) records.size();
+            stats.storedBytes = double(storedBytes);
+            stats.rawBytes = double(records.size()) * width * height * sizeof(uint32_t);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void ReplayBuffer::saveClips() {
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        while (!stopSaver && !clipReady)
+            pthread_cond_wait(&clipCond, &mutex);
+        if (!clipReady)
+            break;
+        clipReady = false;
+        pthread_mutex_unlock(&mutex);
+        writeClip();
+        pthread_mutex_lock(&mutex);
+        saving = false;
+        stats.saves++;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void ReplayBuffer::compressFrame() {
+    const bool key = records.empty() || framesSinceKey >= keyInterval;
+    if (key) {
+        copy(current.begin(), current.end(), delta.begin());
+    } else {
+        for (size_t i = 0; i < delta.size(); i++) {
+            delta[i] = current[i] ^ previous[i];
+        }
+    }
+    previous.swap(current);
+
+    deflateReset(&stream);
+    stream.next_in = (Bytef *) &delta[0];
+    stream.avail_in = uInt(delta.size() * sizeof(uint32_t));
+    stream.next_out = &compressed[0];
+    stream.avail_out = uInt(compressed.size());
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        framesSinceKey = keyInterval;
+        return;
+    }
+    store(key);
+}
+
+void ReplayBuffer::store(bool key) {
+    const size_t size = stream.total_out;
+    if (size > arena.size()) {
+        // the next difference would be from a frame that isn't kept
+        framesSinceKey = keyInterval;
+        return;
+    }
+
+    // records sit in the arena oldest first from the write offset on, wrapping at the end. make room by
+    // dropping the oldest, and when the frame doesn't fit before the end, the ones past the write offset
+    const size_t offset = writeOffset + size <= arena.size() ? writeOffset : 0;
+    const bool wrapped = offset != writeOffset;
+    while (!records.empty()) {
+        const Record &oldest = records.front();
+        const bool overlaps = oldest.offset < offset + size && offset < oldest.offset + oldest.size;
+        if (!overlaps && !(wrapped && oldest.offset >= writeOffset))
+            break;
+        dropOldest();
+    }
+    if (!key && records.empty()) {
+        // the frame this one differs from was dropped to make room
+        framesSinceKey = keyInterval;
+        return;
+    }
+
+    memcpy(&arena[offset], &compressed[0], size);
+    Record record = { offset, size, key };
+    records.push_back(record);
+    storedBytes += size;
+    writeOffset = offset + size;
+    framesSinceKey = key ? 1 : framesSinceKey + 1;
+
+    while (records.size() > maxFrames) {
+        dropOldest();
+    }
+}
+
+// drops the oldest frame, and the differences that followed it up to the next whole frame since they can't be
+// rebuilt without it
+void ReplayBuffer::dropOldest() {
+    do {
+        storedBytes -= records.front().size;
+        records.pop_front();
+    } while (!records.empty() && !records.front().key);
+}
+
+void ReplayBuffer::copyClip() {
+    size_t size = 0;
+    for (const Record &record : records) {
+        size += record.size;
+    }
+    clip.resize(size);
+    clipRecords.clear();
+    size_t offset = 0;
+    for (const Record &record : records) {
+        memcpy(&clip[offset], &arena[record.offset], record.size);
+        Record copy = { offset, record.size, record.key };
+        clipRecords.push_back(copy);
+        offset += record.size;
+    }
+}
+
+void ReplayBuffer::writeClip() {
+    vector<uint32_t, PixelAllocator<uint32_t>> frame(size_t(width) * height);
+    vector<uint32_t, PixelAllocator<uint32_t>> difference(frame.size());
+    z_stream inflater;
+    memset(&inflater, 0, sizeof(inflater));
+    inflateInit(&inflater);
+
+    for (size_t i = 0; i < clipRecords.size(); i++) {
+        const Record &record = clipRecords[i];
+        inflateReset(&inflater);
+        inflater.next_in = &clip[record.offset];
+        inflater.avail_in = uInt(record.size);
+        inflater.next_out = (Bytef *) &difference[0];
+        inflater.avail_out = uInt(difference.size() * sizeof(uint32_t));
+        if (inflate(&inflater, Z_FINISH) != Z_STREAM_END)
+            break;
+
+        if (record.key) {
+            frame.swap(difference);
+        } else {
+            for (size_t j = 0; j < frame.size(); j++) {
+                frame[j] ^= difference[j];
+            }
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "-%06u.png", (unsigned int) i);
+        FrameCapture::writePng(clipPrefix + name, &frame[0], width, height, 2);
+    }
+
+    inflateEnd(&inflater);
+}
+
+bool ReplayBuffer::record(const uint32_t *pixels, int stride) {
+    pthread_mutex_lock(&mutex);
+    const bool full = pendingFull;
+    if (full) {
+        stats.dropped++;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (full) {
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(&pending[size_t(y) * width],
+                (const unsigned char *) pixels + size_t(y) * stride,
+                width * sizeof(uint32_t));
+    }
+
+    pthread_mutex_lock(&mutex);
+    pendingFull = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+bool ReplayBuffer::saveClip(const string &prefix) {
+    pthread_mutex_lock(&mutex);
+    const bool accepted = !saving;
+    if (accepted) {
+        saving = true;
+        clipRequested = true;
+        clipPrefix = prefix;
+        pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&mutex);
+    return accepted;
+}
+
+ReplayBuffer::Stats ReplayBuffer::getStats() {
+    pthread_mutex_lock(&mutex);
+    const Stats copy = stats;
+    pthread_mutex_unlock(&mutex);
+    return copy;
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "ResolutionScaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+ResolutionScaler::ResolutionScaler(double targetFrameTime, double minScale) :
+        targetFrameTime(targetFrameTime), minScale(minScale), scale(1.0), averageFrameTime(0.0), framesSinceChange(0) {
+    stats.scale = scale;
+    stats.lowestScale = scale;
+    stats.averageFrameTime = 0.0;
+    stats.scaleChanges = 0;
+    stats.frames = 0;
+}
+
+void ResolutionScaler::changeScale(double newScale) {
+    // expect the cost to follow the pixel count until the new scale has been measured
+    averageFrameTime *= (newScale / scale) * (newScale / scale);
+    scale = newScale;
+    framesSinceChange = 0;
+
+    stats.scale = scale;
+    stats.lowestScale = min(stats.lowestScale, scale);
+    stats.scaleChanges++;
+}
+
+bool ResolutionScaler::frameDone(double frameTime) {
+    // exponential moving average, so single slow frames don't count for much
+    averageFrameTime = stats.frames == 0 ? frameTime : averageFrameTime + (frameTime - averageFrameTime) * 0.1;
+    stats.frames++;
+    stats.averageFrameTime = averageFrameTime;
+
+    if (++framesSinceChange < HOLD_FRAMES)
+        return false;
+
+    const double step = 1.0 / STEPS;
+    if (averageFrameTime > targetFrameTime * 1.1 && scale > minScale) {
+        // aim a little below the target, and go down at least one step
+        const double wanted = scale * sqrt(targetFrameTime * 0.9 / averageFrameTime);
+        changeScale(max(min(floor(wanted * STEPS) / STEPS, scale - step), minScale));
+        return true;
+    }
+
+    if (scale < 1.0) {
+        const double bigger = min(scale + step, 1.0);
+        const double predicted = averageFrameTime * (bigger / scale) * (bigger / scale);
+        if (predicted < targetFrameTime * 0.8) {
+            changeScale(bigger);
+            return true;
+        }
+    }
+    return false;
+}
@@ -25,8 +25,18 @@
 
 #include "SimLoop.h"
 
-SimLoop::SimLoop(GameSys *gameSys, double dt) :
-        gameSys(gameSys), dt(dt), simRun(false), simLock(0), simLockReaders(0) {
+SimLoop::SimLoop(GameSys *gameSys, double dt, double idleDt) :
+        gameSys(gameSys),
+                dt(dt),
+                idleDt(idleDt),
+                t(0),
+                simRun(false),
+                hidden(false),
+                stepTime(0.0),
+                steps(0),
+                simLock(0),
+                simLockReaders(0) {
+    gameSys->setSimClock(&timer);
 }
 
 void *SimLoop::simLoop(void *arg) {
@@ -41,14 +51,20 @@ void SimLoop::loop() {
             while (simLockReaders > 0)
                 sched_yield();
             acquireSimLock();
+            const double stepStart = timer.time();
             gameSys->sim(t, dt);
+            stepTime += timer.time() - stepStart;
+            steps++;
             t += dt;
             releaseSimLock();
         }
 
-        const double timeToNextStep = realTime - t;
-        if (timeToNextStep > 0.001) {
-            sched_yield();
+        // sleep until the next step is due, then spin the last bit so steps land on time.
+        // when nobody needs the steps on time, sleep longer and don't spin at all
+        const bool throttled = hidden || gameSys->isIdle();
+        const double timeToNextStep = t + (throttled ? idleDt : dt) - timer.time();
+        if (timeToNextStep > 0) {
+            timer.wait(timeToNextStep, !throttled);
         }
     }
     gameSys->cleanup();
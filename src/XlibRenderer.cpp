@@ -0,0 +1,177 @@
+/*
+ *  Copyright (C) 2012 Xo Wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL XO
+ *  WANG BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ *  AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *  Except as contained in this notice, the name of Xo Wang shall not be
+ *  used in advertising or otherwise to promote the sale, use or other dealings
+ *  in this Software without prior written authorization from Xo Wang.
+ */
+
+#include "XlibRenderer.h"
+#include "CairoRenderer.h"
+
+#ifdef CAIRO_HAS_XLIB_SURFACE
+#include <cairomm/xlib_surface.h>
+#endif
+
+#include <stdint.h>
+
+using namespace std;
+using namespace Cairo;
+
+bool XlibRenderer::isSupported() {
+#ifdef CAIRO_HAS_XLIB_SURFACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef CAIRO_HAS_XLIB_SURFACE
+
+static bool overlaps(const RenderCommand::Bounds &a, const PixelToaster::Rectangle &b) {
+    return a.xBegin < b.xEnd && b.xBegin < a.xEnd && a.yBegin < b.yEnd && b.yBegin < a.yEnd;
+}
+
+XlibRenderer::XlibRenderer(void *handle, int width, int height) :
+        width(width),
+                height(height),
+                connection(XOpenDisplay(NULL)),
+                window(Window(uintptr_t(handle))),
+                pixmap(0) {
+    XWindowAttributes attributes;
+    if (!connection || !window || !XGetWindowAttributes(connection, window, &attributes)) {
+        if (connection) {
+            XCloseDisplay(connection);
+            connection = NULL;
+        }
+        return;
+    }
+
+    // the pixmap is made like the window, so copying between them is a plain blit on the server
+    pixmap = XCreatePixmap(connection, window, width, height, attributes.depth);
+    surface = XlibSurface::create(connection, pixmap, attributes.visual, width, height);
+    cr = Context::create(surface);
+    cr->set_font_face(ToyFontFace::create("Gotham Rounded Bold", FONT_SLANT_NORMAL, FONT_WEIGHT_NORMAL));
+
+    windowSurface = XlibSurface::create(connection, window, attributes.visual, width, height);
+    windowCr = Context::create(windowSurface);
+    windowCr->set_operator(OPERATOR_SOURCE);
+    windowCr->set_source(surface, 0, 0);
+
+    // the window has no backing store, the server clears whatever is uncovered. the display selects its own
+    // events on its own connection, this doesn't take them away
+    XSelectInput(connection, window, ExposureMask);
+}
+
+XlibRenderer::~XlibRenderer() {
+    if (!connection) {
+        return;
+    }
+
+    // cairo's surfaces have to go before the pixmap and the connection they draw with
+    windowCr.clear();
+    windowSurface.clear();
+    cr.clear();
+    surface.clear();
+    XFreePixmap(connection, pixmap);
+    XCloseDisplay(connection);
+}
+
+void XlibRenderer::handleEvents() {
+    while (XPending(connection) > 0) {
+        XEvent event;
+        XNextEvent(connection, &event);
+        if (event.type == Expose) {
+            const XExposeEvent &expose = event.xexpose;
+            exposed.push_back(PixelToaster::Rectangle(expose.x,
+                    expose.x + expose.width,
+                    expose.y,
+                    expose.y + expose.height));
+        }
+    }
+}
+
+void XlibRenderer::draw(const RenderList &list, const vector<PixelToaster::Rectangle> &dirty) {
+    if (!connection) {
+        return;
+    }
+    handleEvents();
+
+    if (!dirty.empty()) {
+        // commands outside all of the dirty boxes are skipped, cairo's clip takes care of the rest
+        PixelToaster::Rectangle bounds = dirty.front();
+        for (const PixelToaster::Rectangle &box : dirty) {
+            cr->rectangle(box.xBegin, box.yBegin, box.xEnd - box.xBegin, box.yEnd - box.yBegin);
+            bounds.xBegin = min(bounds.xBegin, box.xBegin);
+            bounds.xEnd = max(bounds.xEnd, box.xEnd);
+            bounds.yBegin = min(bounds.yBegin, box.yBegin);
+            bounds.yEnd = max(bounds.yEnd, box.yEnd);
+        }
+        cr->save();
+        cr->clip();
+
+        const string &text = list.getText();
+        for (const RenderCommand &command : list.getCommands()) {
+            if (command.type < RenderCommand::PAINT || overlaps(command.bounds, bounds)) {
+                CairoRenderer::replay(cr, command, text);
+            }
+        }
+
+        cr->restore();
+    }
+
+    // what was drawn, and what the window lost, goes from the pixmap to the window
+    for (const PixelToaster::Rectangle &box : dirty) {
+        windowCr->rectangle(box.xBegin, box.yBegin, box.xEnd - box.xBegin, box.yEnd - box.yBegin);
+    }
+    for (const PixelToaster::Rectangle &box : exposed) {
+        windowCr->rectangle(box.xBegin, box.yBegin, box.xEnd - box.xBegin, box.yEnd - box.yBegin);
+    }
+    if (!dirty.empty() || !exposed.empty()) {
+        windowCr->fill();
+        windowSurface->flush();
+    }
+    exposed.clear();
+
+    // nothing holds back a client that only sends requests. waiting for the server keeps the game from
+    // queuing up frames faster than they are drawn
+    XSync(connection, False);
+}
+
+#else
+
+XlibRenderer::XlibRenderer(void *handle, int width, int height) :
+        width(width),
+                height(height),
+                connection(NULL),
+                window(0),
+                pixmap(0) {
+}
+
+XlibRenderer::~XlibRenderer() {
+}
+
+void XlibRenderer::handleEvents() {
+}
+
+void XlibRenderer::draw(const RenderList &list, const vector<PixelToaster::Rectangle> &dirty) {
+}
+
+#endif
@@ -25,6 +25,18 @@
 
 #include "SimLoop.h"
 #include "GameSys.h"
+#include "RenderList.h"
+#include "CairoRenderer.h"
+#include "ResolutionScaler.h"
+#include "PostProcess.h"
+#include "ParticleSystem.h"
+#include "FrameCapture.h"
+#include "ReplayBuffer.h"
+#include "PixelAllocator.h"
+#include "XlibRenderer.h"
+#include "PerfCounters.h"
+#include "AllocationTracker.h"
+#include "PerfHud.h"
 
 #include "../PixelToaster/PixelToaster.h"
 
@@ -33,11 +45,77 @@
 
 #include <algorithm>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <vector>
 
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <stdint.h>
 
+// pixels in a set of boxes, counting overlaps more than once like the passes over them do
+static double area(const std::vector<PixelToaster::Rectangle> &boxes) {
+    double pixels = 0.0;
+    for (const PixelToaster::Rectangle &box : boxes) {
+        pixels += double(box.xEnd - box.xBegin) * (box.yEnd - box.yBegin);
+    }
+    return pixels;
+}
+
+// keeps count particles alive over the arena and times what a frame of the game does with them: two sim steps,
+// a snapshot and drawing into a white frame
+static void particleBenchmark(int count, int width, int height) {
+    using namespace PixelToaster;
+    using namespace std;
+
+    const int frames = 120;
+    const double simDt = 1.0 / 120;
+    const double color[3] = { 1.0, 0.6, 0.1 };
+    const double minDim = min(width, height);
+    const Cairo::Matrix worldToScreen(minDim * 0.01, 0, 0, -minDim * 0.01, width * 0.5, height * 0.5);
+
+    ParticleSystem particles;
+    ParticleSystem::Snapshot snapshot;
+    vector<uint32_t> pixels(width * height);
+    minstd_rand random;
+    uniform_real_distribution<> xDistribution(-50, 50);
+    uniform_real_distribution<> yDistribution(0, 50);
+    for (int emitted = 0; emitted < count; emitted += 300) {
+        particles.emit(cpv(xDistribution(random), yDistribution(random)), cpvzero, 20.0, min(300, count - emitted),
+                1000.0, color, 0.0);
+    }
+
+    Timer timer;
+    double simTime = 0.0;
+    double snapshotTime = 0.0;
+    double drawTime = 0.0;
+    size_t drawn = 0;
+    double t = 0.0;
+    for (int frame = 0; frame < frames; frame++) {
+        const double simStart = timer.time();
+        for (int step = 0; step < 2; step++) {
+            particles.sim(t, simDt);
+            t += simDt;
+        }
+        const double snapshotStart = timer.time();
+        particles.snapshot(worldToScreen, t, 0.0, width, height, snapshot);
+        const double drawStart = timer.time();
+        fill(pixels.begin(), pixels.end(), 0xffffffff);
+        snapshot.draw((unsigned char *) &pixels[0], width, height, width * 4);
+        const double drawEnd = timer.time();
+
+        simTime += snapshotStart - simStart;
+        snapshotTime += drawStart - snapshotStart;
+        drawTime += drawEnd - drawStart;
+        drawn += snapshot.x.size();
+    }
+
+    cout << "particles: " << particles.size() << " live, " << drawn / frames << " drawn per frame" << endl;
+    cout << "per frame: sim " << simTime * 1000 / frames << " ms, snapshot " << snapshotTime * 1000 / frames
+            << " ms, draw " << drawTime * 1000 / frames << " ms (clear included)" << endl;
+}
+
 int main(int argc, const char * const argv[]) {
     using namespace PixelToaster;
     using namespace Cairo;
@@ -46,22 +124,62 @@ int main(int argc, const char * const argv[]) {
     int width = 1280;
     int height = 800;
 
+    // "particles [count]" runs the particle benchmark instead of the game
+    if (argc >= 2 && strcmp(argv[1], "particles") == 0) {
+        particleBenchmark(argc >= 3 ? max(atoi(argv[2]), 1) : 100000, width, height);
+        return EXIT_SUCCESS;
+    }
+
     if (argc == 3) {
         width = std::max(atoi(argv[1]), 300);
         height = std::max(atoi(argv[2]), 300);
     }
 
-//    Display display("CONKERS - by Xo Wang", width, height, Output::Default, Mode::FloatingPoint);
-    Display display("CONKERS - by Xo Wang", width, height, Output::Default, Mode::TrueColor);
+    // present on a separate thread, so the next frame is rendered while the last one goes up.
+    // blocking keeps the render loop from running ahead of the display
+    Display display;
+    display.presentation(Presentation::AsynchronousBlocking, 2);
+    display.open("CONKERS - by Xo Wang", width, height, Output::Default, Mode::TrueColor);
+
+    // with CONKERS_RENDERER=xlib, cairo draws on the X server and the display presents nothing (see XlibRenderer).
+    // the stages that work on the pixels in memory, particles, post-processing, capture and replay, are left out
+    unique_ptr<XlibRenderer> xlibRenderer;
+    const char * const rendererName = getenv("CONKERS_RENDERER");
+    if (rendererName && strcmp(rendererName, "xlib") == 0) {
+        if (XlibRenderer::isSupported() && display.handle() && display.presentation(Presentation::External)) {
+            xlibRenderer.reset(new XlibRenderer(display.handle(), width, height));
+            if (!xlibRenderer->isValid()) {
+                xlibRenderer.reset();
+                display.presentation(Presentation::AsynchronousBlocking, 2);
+            }
+        }
+        if (!XlibRenderer::isSupported()) {
+            cerr << "xlib renderer not built, cairo has no xlib surface, drawing in memory" << endl;
+        } else if (!xlibRenderer) {
+            cerr << "xlib renderer not available, drawing in memory" << endl;
+        }
+    }
+    double xlibFrameTime = 0.0;
+    unsigned int xlibFrames = 0;
 
-//    vector<FloatingPointPixel> backBuffer(width * height);
-    vector<TrueColorPixel> pixels(width * height);
+    // cairo draws into the canvas, which keeps the last frame for redrawing only what changed. post-processing
+    // writes the frame that is shown, straight into the display's shared memory image when it has one (only
+    // when presenting synchronously). the frame's rows are packed, as the display takes them, the canvas's are
+    // padded
+    const int stride = paddedStride(width);
+    vector<TrueColorPixel, PixelAllocator<TrueColorPixel>> canvas(stride / sizeof(TrueColorPixel) * height);
+    vector<TrueColorPixel, PixelAllocator<TrueColorPixel>> pixels;
+    TrueColorPixel *frame = display.buffer();
+    if (!frame) {
+        pixels.resize(width * height);
+        frame = pixels.data();
+    }
 
-    RefPtr<ImageSurface> surface = ImageSurface::create((unsigned char *) pixels.data(),
+    RefPtr<ImageSurface> surface = ImageSurface::create((unsigned char *) canvas.data(),
             FORMAT_ARGB32,
             width,
             height,
-            ImageSurface::format_stride_for_width(FORMAT_ARGB32, width));
+            stride);
     RefPtr<Context> cr = Context::create(surface);
 
     const int minDim = std::min(width, height);
@@ -73,46 +191,224 @@ int main(int argc, const char * const argv[]) {
 
     GameSys gameSys(width, height, worldToScreen);
     display.listener(&gameSys);
+    // read input on a thread of its own, so it reaches the sim at its step rate rather than the frame rate.
+    // gameSys queues the events, and the sim thread applies them between steps
+    display.input(Input::Threaded);
+
+    // with CONKERS_PERF set, hardware counters are read around the sim's steps on its thread, around recording and
+    // post-processing frames on this one, and around PixelToaster's conversion on the thread that presents, and
+    // reported on exit
+    const bool perf = getenv("CONKERS_PERF") != NULL;
+    gameSys.getSimCounters().setEnabled(perf);
+    gameSys.getConvertCounters().setEnabled(perf);
+    PerfCounters frameCounters;
+    frameCounters.setEnabled(perf);
+    const int renderSection = frameCounters.addSection("GameSys::render", "object");
+    const int postProcessSection = frameCounters.addSection("post-process", "pixel");
+
+    // built with CONKERS_TRACK_ALLOCATIONS, heap allocations are counted by phase and reported on exit. phases
+    // named in CONKERS_ALLOCATION_FREE (comma separated) abort at their first allocation
+    const int renderPhase = AllocationTracker::addPhase("render");
+    const int postProcessPhase = AllocationTracker::addPhase("post-process");
+    const int presentPhase = AllocationTracker::addPhase("present");
+    if (const char * const allocationFree = getenv("CONKERS_ALLOCATION_FREE")) {
+        AllocationTracker::setAllocationFree(allocationFree);
+    }
 
     SimLoop simLoop(&gameSys, 1.0 / 120);
     simLoop.start();
 
+    vector<PixelToaster::Rectangle> dirtyBoxes;
+    RenderList renderList;
+    ParticleSystem::Snapshot particles;
+    // draws frames in tiles, on as many threads as there are processors
+    CairoRenderer renderer((unsigned char *) canvas.data(), width, height, stride);
+    // trades resolution for drawing time when frames take longer than this
+    ResolutionScaler scaler(1.0 / 60);
+    // exposure, vignette, damage flash and tonemapping, from the canvas to the frame in one pass
+    PostProcess postProcess((const unsigned char *) canvas.data(),
+            (unsigned char *) frame,
+            width,
+            height,
+            stride,
+            width * sizeof(TrueColorPixel));
+    // with CONKERS_CAPTURE set, every frame shown is also written to CONKERS_CAPTURE-000000.png and up
+    unique_ptr<FrameCapture> capture;
+    if (const char * const capturePrefix = getenv("CONKERS_CAPTURE")) {
+        capture.reset(new FrameCapture(capturePrefix, width, height));
+    }
+    // with CONKERS_REPLAY set, the last ten seconds of frames are kept in memory, and saved as
+    // CONKERS_REPLAY-death1-000000.png and up when the player dies
+    unique_ptr<ReplayBuffer> replay;
+    const char * const replayPrefix = getenv("CONKERS_REPLAY");
+    if (replayPrefix) {
+        replay.reset(new ReplayBuffer(width, height, 600));
+    }
+    unsigned int deaths = 0;
+    bool wasIdle = true;
+    // F3 shows where the frames' time goes, over the frame after post-processing, so captures and replays don't
+    // have it. the xlib renderer has no frame in memory to draw it on
+    PerfHud perfHud;
+    const PixelToaster::Rectangle perfHudBounds = perfHud.getBounds(width, height);
+    bool perfHudWasShown = false;
+    double lastStepTime = 0.0;
+    unsigned int lastSteps = 0;
+
+    // frame period while the game is idle, and event polling period while the window is hidden
+    const double idleFrameTime = 1.0 / 30;
+    const double hiddenPollTime = 1.0 / 10;
+    Timer frameTimer;
+
     while (display.open()) {
-        cr->save();
+        const double frameStart = frameTimer.time();
+
+        // nothing can be seen: don't render, only let the display process its events
+        simLoop.setHidden(!gameSys.isVisible());
+        if (!gameSys.isVisible()) {
+            display.update(frame, 0, 0);
+            frameTimer.wait(hiddenPollTime);
+            continue;
+        }
+
+        // only record the frame while the sim is held, cairo does the slow part after it's let go
+        const double lockStart = frameTimer.time();
         simLoop.acquireRenderLock();
+        const double renderStart = frameTimer.time();
         const double dt = simLoop.getRealTime() - simLoop.getLastSimTime();
-        gameSys.render(cr, simLoop.getLastSimTime(), dt);
+        AllocationTracker::enter(renderPhase);
+        frameCounters.begin(renderSection);
+        gameSys.render(renderList, particles, simLoop.getLastSimTime(), dt, dirtyBoxes);
+        frameCounters.end(gameSys.getObjectCount());
+        AllocationTracker::leave();
+        postProcess.setFlash(gameSys.getDamageFlash(simLoop.getLastSimTime()));
+        const bool idle = gameSys.isIdle();
+        const bool perfHudShown = gameSys.isPerfHudShown() && !xlibRenderer;
+        PerfHud::Sample sample;
+        sample.times[PerfHud::SIM] = simLoop.getStepTime() - lastStepTime;
+        sample.times[PerfHud::LOCK_WAIT] = renderStart - lockStart;
+        sample.steps = simLoop.getSteps() - lastSteps;
+        sample.objects = gameSys.getObjectCount();
+        sample.pairs = gameSys.getPairCount();
+        lastStepTime = simLoop.getStepTime();
+        lastSteps = simLoop.getSteps();
         simLoop.releaseRenderLock();
-        cr->restore();
-
-//        if ((uintptr_t(pixels.data()) & 0xF != 0) || (uintptr_t(backBuffer.data()) & 0xF != 0)) {
-//            fprintf(stderr, "pixel buffer is not aligned\n");
-//            break;
-//        }
-//        const __m128 scaling = _mm_set1_ps(1.0 / 255.0);
-//        for (size_t i = 0; i < pixels.size(); i += 4) {
-//            const __m128i bytes = _mm_load_si128((__m128i *) &pixels[i]);
-//            const __m128i shorts0 = _mm_unpacklo_epi8(bytes, _mm_set1_epi8(0));
-//            const __m128i shorts1 = _mm_unpackhi_epi8(bytes, _mm_set1_epi8(0));
-//            const __m128i longs0 = _mm_unpacklo_epi16(shorts0, _mm_set1_epi16(0));
-//            const __m128i longs1 = _mm_unpackhi_epi16(shorts0, _mm_set1_epi16(0));
-//            const __m128i longs2 = _mm_unpacklo_epi16(shorts1, _mm_set1_epi16(0));
-//            const __m128i longs3 = _mm_unpackhi_epi16(shorts1, _mm_set1_epi16(0));
-//            const __m128 fp0 = _mm_cvtepi32_ps(longs0);
-//            const __m128 fp1 = _mm_cvtepi32_ps(longs1);
-//            const __m128 fp2 = _mm_cvtepi32_ps(longs2);
-//            const __m128 fp3 = _mm_cvtepi32_ps(longs3);
-//            _mm_store_ps((float *) &backBuffer[i], _mm_mul_ps(fp0, scaling));
-//            _mm_store_ps((float *) &backBuffer[i + 1], _mm_mul_ps(fp1, scaling));
-//            _mm_store_ps((float *) &backBuffer[i + 2], _mm_mul_ps(fp2, scaling));
-//            _mm_store_ps((float *) &backBuffer[i + 3], _mm_mul_ps(fp3, scaling));
-//        }
-//
-//        display.update(backBuffer);
-        display.update(pixels);
+
+        if (xlibRenderer) {
+            // the server draws and shows the frame, the display only processes events. timed from the start of
+            // the frame until the display is done with it
+            xlibRenderer->draw(renderList, dirtyBoxes);
+            display.update(frame, 0, 0);
+            if (!dirtyBoxes.empty()) {
+                xlibFrameTime += frameTimer.time() - frameStart;
+                xlibFrames++;
+            }
+        } else {
+            const double drawStart = frameTimer.time();
+            renderer.draw(renderList, dirtyBoxes);
+            const double drawTime = frameTimer.time() - drawStart;
+            // particles are drawn straight into the pixels, on top of what cairo drew. their bounds are dirty, so
+            // they're drawn over a fresh background every frame
+            particles.draw((unsigned char *) canvas.data(), width, height, stride);
+
+            // frames with nothing to draw say nothing about the cost of drawing
+            const bool drawn = !dirtyBoxes.empty();
+
+            // the canvas never has the panel, reprocessing its box takes the last one off the frame
+            if (perfHudShown || perfHudWasShown) {
+                dirtyBoxes.push_back(perfHudBounds);
+            }
+
+            // a change of flash reprocesses, and presents, the whole frame
+            AllocationTracker::enter(postProcessPhase);
+            frameCounters.begin(postProcessSection);
+            postProcess.apply(dirtyBoxes);
+            frameCounters.end(area(dirtyBoxes));
+            AllocationTracker::leave();
+            sample.times[PerfHud::RENDER] = frameTimer.time() - renderStart;
+
+            if (capture) {
+                capture->capture((const uint32_t *) frame, width * sizeof(TrueColorPixel));
+            }
+            if (replay) {
+                replay->record((const uint32_t *) frame, width * sizeof(TrueColorPixel));
+                // the game only goes idle from running when the player dies
+                if (idle && !wasIdle) {
+                    char name[32];
+                    snprintf(name, sizeof(name), "-death%u", ++deaths);
+                    replay->saveClip(replayPrefix + string(name));
+                }
+            }
+
+            if (perfHudShown) {
+                perfHud.draw((unsigned char *) frame, width, height, width * sizeof(TrueColorPixel));
+            }
+
+            const double presentStart = frameTimer.time();
+            AllocationTracker::enter(presentPhase);
+            display.update(frame, dirtyBoxes.empty() ? 0 : &dirtyBoxes[0], (int) dirtyBoxes.size());
+            AllocationTracker::leave();
+            sample.times[PerfHud::PRESENT] = frameTimer.time() - presentStart;
+            perfHud.addSample(sample, frameTimer.time());
+            perfHudWasShown = perfHudShown;
+
+            // the scale is judged on cairo's drawing and the upscale, the part of the frame that shrinks with it.
+            // post-processing and presenting cost the same at any scale, a present stall mustn't lower it. a new
+            // scale takes effect from the next frame
+            if (drawn && scaler.frameDone(drawTime)) {
+                renderer.setScale(scaler.getScale());
+            }
+        }
+        wasIdle = idle;
+
+        // the waiting and top score screens don't need the full frame rate (offscreen runs are benchmarks, they do)
+        if (idle && display.output() != Output::Offscreen) {
+            const double timeToNextFrame = frameStart + idleFrameTime - frameTimer.time();
+            if (timeToNextFrame > 0) {
+                frameTimer.wait(timeToNextFrame);
+            }
+        }
     }
 
     simLoop.stop();
 
+    if (capture) {
+        capture->finish();
+        const FrameCapture::Stats stats = capture->getStats();
+        cout << "capture: " << stats.written << " frames written, " << stats.dropped << " dropped, "
+                << stats.failed << " failed, " << stats.bytes / (1024 * 1024) << " MB" << endl;
+        if (stats.written > 0) {
+            cout << "capture: " << stats.written / stats.elapsed << " frames/s, "
+                    << stats.encodeTime * 1000 / stats.written << " ms encoding per frame" << endl;
+        }
+    }
+
+    // without a window (PIXELTOASTER_OFFSCREEN set) this is a render and present benchmark
+    if (display.output() == Output::Offscreen) {
+        const unsigned int frames = display.presentStatistics().framesPresented;
+        const double seconds = simLoop.getRealTime();
+        cout << "offscreen: " << frames << " frames in " << seconds << " s, " << frames / seconds << " fps" << endl;
+    }
+
+    // stops the presentation thread, which converts, before its counts are read. the xlib renderer converts
+    // nothing and its surface is on the display's window, so that one stays open until the end
+    if (!xlibRenderer) {
+        display.close();
+    }
+
+    gameSys.getSimCounters().report(cout);
+    frameCounters.report(cout);
+    gameSys.getConvertCounters().report(cout);
+    AllocationTracker::report(cout);
+
+    if (xlibRenderer) {
+        cout << "xlib renderer: " << xlibFrames << " frames, "
+                << (xlibFrames > 0 ? xlibFrameTime * 1000 / xlibFrames : 0.0) << " ms per frame" << endl;
+    } else {
+        const ResolutionScaler::Stats &scaling = scaler.getStats();
+        cout << "render scale: " << scaling.scale << " (lowest " << scaling.lowestScale << ", "
+                << scaling.scaleChanges << " changes), " << scaling.averageFrameTime * 1000 << " ms drawing per frame"
+                << endl;
+    }
+
     return EXIT_SUCCESS;
 }